@@ -0,0 +1,63 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/AsyncCompute.h"
+
+#include "core/Log.h"
+
+namespace zrl {
+
+AsyncCompute::AsyncCompute(const Core &core)
+    : QueueHandoff(core.GetLogicalDevice(),
+                   core.GetLogicalDevice().GetComputeQueue(),
+                   core.GetLogicalDevice().GetComputeQueueFamily()) {
+  DLOG << "AsyncCompute: ctor: queue_family=" << GetQueueFamily()
+       << " dedicated=" << IsDedicated() << "\n";
+}
+
+void AsyncCompute::ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset,
+                                 VkDeviceSize size, VkAccessFlags dst_access,
+                                 VkPipelineStageFlags dst_stage) {
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = dst_access;
+  barrier.buffer = buffer;
+  barrier.offset = offset;
+  barrier.size = size;
+  Release(barrier, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stage);
+}
+
+void AsyncCompute::ReleaseImage(const Image &image, VkImageLayout old_layout,
+                                VkImageLayout new_layout,
+                                VkAccessFlags dst_access,
+                                VkPipelineStageFlags dst_stage) {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.image = image.GetHandle();
+  barrier.subresourceRange.aspectMask = image.GetAspects();
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = image.GetLevelCount();
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = image.GetLayerCount();
+  Release(barrier, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stage);
+}
+
+} // namespace zrl
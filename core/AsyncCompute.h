@@ -0,0 +1,57 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_ASYNC_COMPUTE_H_
+#define ZRL_CORE_ASYNC_COMPUTE_H_
+
+#include "vulkan/vulkan.h"
+
+#include "core/Core.h"
+#include "core/Image.h"
+#include "core/QueueHandoff.h"
+
+namespace zrl {
+
+// Submits compute work, such as IBL prefiltering or culling, on the async
+// compute queue so that it runs beside rendering. The resources it writes are
+// handed over to the gct queue as described in QueueHandoff. On devices with
+// a single queue family everything runs on the gct queue instead.
+//
+// Resources read by the compute work must not be owned by another queue
+// family, since no acquire is recorded for them here. Resources whose
+// previous contents do not matter can always be used.
+class AsyncCompute final : public QueueHandoff {
+public:
+  explicit AsyncCompute(const Core &core);
+
+  // Returns the command buffer to record compute work into. It is submitted
+  // by the next call to Submit().
+  VkCommandBuffer Record() { return Recording(); }
+
+  // Records that the compute shaders wrote to the buffer range, which is next
+  // used on the gct queue with dst_access at dst_stage.
+  void ReleaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                     VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+  // Same for all the subresources of image, which are transitioned from
+  // old_layout to new_layout.
+  void ReleaseImage(const Image &image, VkImageLayout old_layout,
+                    VkImageLayout new_layout, VkAccessFlags dst_access,
+                    VkPipelineStageFlags dst_stage);
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_ASYNC_COMPUTE_H_
@@ -0,0 +1,61 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/AtomicFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <cstdio>
+
+namespace zrl {
+
+// Replaces to with from in a single step. std::rename() does that on POSIX,
+// but fails on Windows when to exists.
+static bool RenameOver(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+bool WriteFileAtomically(const std::string &path,
+                         const std::vector<FileChunk> &chunks) {
+  const std::string tmp_path = path + ".tmp";
+  std::FILE *f = std::fopen(tmp_path.c_str(), "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  bool ok = true;
+  for (size_t i = 0; ok && i < chunks.size(); ++i) {
+    ok = std::fwrite(chunks[i].data, 1, chunks[i].size, f) == chunks[i].size;
+  }
+  ok = std::fclose(f) == 0 && ok;
+  if (ok) {
+    ok = RenameOver(tmp_path, path);
+  }
+  if (!ok) {
+    std::remove(tmp_path.c_str());
+  }
+  return ok;
+}
+
+} // namespace zrl
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_ATOMIC_FILE_H_
+#define ZRL_CORE_ATOMIC_FILE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace zrl {
+
+struct FileChunk {
+  const void *data;
+  size_t size;
+};
+
+// Writes the chunks, one after the other, to a temporary file next to path
+// and then renames it to path, replacing any existing file. A crash while
+// writing leaves the previous file untouched rather than a truncated one, and
+// readers see either the old contents or the new ones. Returns whether the
+// file was written.
+bool WriteFileAtomically(const std::string &path,
+                         const std::vector<FileChunk> &chunks);
+
+} // namespace zrl
+
+#endif // ZRL_CORE_ATOMIC_FILE_H_
@@ -20,8 +20,9 @@ namespace zrl {
 
 Buffer::Buffer(const Core &core, VkDeviceSize size,
                VkMemoryPropertyFlags mem_props, VkBufferUsageFlags usage)
-    : device_(core.GetLogicalDevice().GetHandle()), size_(size),
-      buffer_(VK_NULL_HANDLE), memory_(VK_NULL_HANDLE) {
+    : device_(core.GetLogicalDevice().GetHandle()),
+      allocator_(core.GetDeviceMemoryAllocator()), size_(size),
+      buffer_(VK_NULL_HANDLE) {
   VkBufferCreateInfo create_info = {};
   create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   create_info.pNext = nullptr;
@@ -37,19 +38,16 @@ Buffer::Buffer(const Core &core, VkDeviceSize size,
   VkMemoryRequirements mem_reqs;
   vkGetBufferMemoryRequirements(device_, buffer_, &mem_reqs);
 
-  VkMemoryAllocateInfo alloc_info = {};
-  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  alloc_info.pNext = nullptr;
-  alloc_info.allocationSize = mem_reqs.size;
-  alloc_info.memoryTypeIndex =
-      core.FindMemoryType(mem_reqs.memoryTypeBits, mem_props);
-  CHECK_VK(vkAllocateMemory(device_, &alloc_info, nullptr, &memory_));
-  CHECK_VK(vkBindBufferMemory(device_, buffer_, memory_, 0));
+  allocation_ = allocator_.Alloc(
+      mem_reqs, core.FindMemoryType(mem_reqs.memoryTypeBits, mem_props),
+      /* linear */ true);
+  CHECK_VK(vkBindBufferMemory(device_, buffer_, allocation_.memory,
+                              allocation_.offset));
 }
 
 Buffer::~Buffer() {
   vkDestroyBuffer(device_, buffer_, nullptr);
-  vkFreeMemory(device_, memory_, nullptr);
+  allocator_.Free(allocation_);
 }
 
 } // namespace zrl
@@ -20,6 +20,7 @@
 #include "vulkan/vulkan.h"
 
 #include "core/Core.h"
+#include "core/DeviceMemoryAllocator.h"
 
 namespace zrl {
 
@@ -34,9 +35,10 @@ public:
 
 protected:
   const VkDevice device_;
+  DeviceMemoryAllocator &allocator_;
   const VkDeviceSize size_;
   VkBuffer buffer_;
-  VkDeviceMemory memory_;
+  DeviceAllocation allocation_;
 };
 
 } // namespace zrl
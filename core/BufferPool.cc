@@ -14,71 +14,143 @@
 
 #include "core/BufferPool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "core/Log.h"
 
 namespace zrl {
 
-static inline Block Buddy(Block b) {
-  return Block(b.first, b.first ^ b.second);
+constexpr uint32_t BufferPool::kNil;
+
+static inline uint32_t LowestSetBit(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, v);
+  return static_cast<uint32_t>(index);
+#else
+  return static_cast<uint32_t>(__builtin_ctzll(v));
+#endif
+}
+
+static inline uint32_t HighestSetBit(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return static_cast<uint32_t>(index);
+#else
+  return static_cast<uint32_t>(63 - __builtin_clzll(v));
+#endif
+}
+
+static inline bool IsPowerOfTwo(VkDeviceSize v) {
+  return v != 0 && (v & (v - 1)) == 0;
 }
 
 BufferPool::BufferPool(const Core &core, const char *id, VkDeviceSize size,
                        VkMemoryPropertyFlags mem_props,
                        VkBufferUsageFlags usage, VkDeviceSize min_block_size,
-                       bool mapped)
+                       bool mapped, bool concurrent)
     : Buffer(core, size, mem_props, usage), id_(id),
-      min_block_size_(min_block_size), free_size_(size), mapped_(nullptr) {
-  CHECK_PC((size & (size - 1)) == 0, "size must be a power of two");
-  blocks_.insert(std::make_pair(size, 0));
+      min_block_size_(min_block_size),
+      min_block_shift_(IsPowerOfTwo(min_block_size)
+                           ? LowestSetBit(min_block_size)
+                           : 0),
+      order_count_(IsPowerOfTwo(size) && size >= min_block_size
+                       ? LowestSetBit(size) - min_block_shift_ + 1
+                       : 0),
+      free_size_(size), mapped_(nullptr), concurrent_(concurrent) {
+  CHECK_PC(IsPowerOfTwo(size), "size must be a power of two");
+  CHECK_PC(IsPowerOfTwo(min_block_size),
+           "min_block_size must be a power of two");
+  CHECK_PC(min_block_size <= size, "min_block_size must not exceed size");
+  const VkDeviceSize units = size >> min_block_shift_;
+  CHECK_PC(units < kNil, "too many blocks of min_block_size");
+
+  heads_.assign(order_count_, kNil);
+  next_.assign(units, kNil);
+  prev_.assign(units, kNil);
+  free_bits_base_.resize(order_count_);
+  size_t bit_count = 0;
+  for (uint32_t order = 0; order < order_count_; ++order) {
+    free_bits_base_[order] = bit_count;
+    bit_count += static_cast<size_t>(units >> order);
+  }
+  free_bits_.assign((bit_count + 63) / 64, 0);
+  PushFree(order_count_ - 1, 0);
+
+  if (concurrent_) {
+    const uint32_t cache_count = std::thread::hardware_concurrency();
+    for (uint32_t i = 0; i < std::max(cache_count, 1u); ++i) {
+      auto cache = std::make_unique<ThreadCache>();
+      for (auto &magazine : cache->magazines) {
+        magazine.reserve(kMagazineCapacity);
+      }
+      caches_.push_back(std::move(cache));
+    }
+  }
+
   if (mapped) {
-    CHECK_VK(vkMapMemory(device_, memory_, 0, size_, 0, &mapped_));
+    mapped_ = allocator_.Map(allocation_);
   }
 }
 
 BufferPool::~BufferPool() {
   if (mapped_ != nullptr) {
-    vkUnmapMemory(device_, memory_);
+    allocator_.Unmap(allocation_);
   }
 }
 
 Block BufferPool::Alloc(VkDeviceSize size) {
-  while (true) {
-    auto it = blocks_.lower_bound(std::make_pair(size, 0));
-    if (it == blocks_.end()) { // Out of memory
-      LOG(ERROR) << "BufferPool(" << id_ << "): OOM\n";
-      return kEmptyBlock;
-    }
-    if (it->first > min_block_size_ && size + size <= it->first) {
-      const VkDeviceSize new_size = it->first >> 1;
-      const auto lo = Block(new_size, it->second);
-      const auto hi = Block(new_size, it->second + new_size);
-      blocks_.erase(it);
-      blocks_.insert(lo);
-      blocks_.insert(hi);
+  TRACE_SCOPE("BufferPool::Alloc");
+  const uint32_t order = OrderFor(size);
+  uint32_t unit = kNil;
+  if (order < order_count_) {
+    if (concurrent_ && order < kMagazineOrders) {
+      unit = AllocCached(order);
     } else {
-      Block b = *it;
-      blocks_.erase(it);
-      free_size_ -= b.first;
-      return b;
+      std::unique_lock<std::mutex> lock(mu_, std::defer_lock);
+      if (concurrent_) {
+        lock.lock();
+      }
+      unit = AllocOrder(order);
     }
+    if (unit == kNil && concurrent_) {
+      // The missing space may be parked in other threads' magazines.
+      DrainCaches();
+      std::lock_guard<std::mutex> lock(mu_);
+      unit = AllocOrder(order);
+    }
+  }
+  if (unit == kNil) { // Out of memory
+    LOG(ERROR) << "BufferPool(" << id_ << "): OOM\n";
+    return kEmptyBlock;
   }
+  return MakeBlock(order, unit);
 }
 
 void BufferPool::Free(Block b) {
-  while (true) {
-    Block bb = Buddy(b);
-    auto it = blocks_.find(bb);
-    if (it != blocks_.end()) {
-      blocks_.erase(it);
-      b = Block(b.first << 1, std::min(b.second, bb.second));
-    } else {
-      blocks_.insert(b);
-      break;
-    }
+  CHECK_PC(IsPowerOfTwo(b.first) && b.first >= min_block_size_ &&
+               b.first <= size_ && (b.second & (b.first - 1)) == 0 &&
+               b.second < size_,
+           "not a block of this pool");
+  const uint32_t order = OrderOf(b.first);
+  const uint32_t unit = static_cast<uint32_t>(b.second >> min_block_shift_);
+  if (concurrent_ && order < kMagazineOrders) {
+    FreeCached(order, unit);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mu_, std::defer_lock);
+  if (concurrent_) {
+    lock.lock();
   }
-  free_size_ += b.first;
+  FreeOrder(order, unit);
 }
 
 void BufferPool::Write(VkDeviceSize offset, VkDeviceSize size,
@@ -87,7 +159,165 @@ void BufferPool::Write(VkDeviceSize offset, VkDeviceSize size,
 }
 
 VkDeviceSize BufferPool::LargestBlock() const {
-  return blocks_.rbegin()->first;
+  std::unique_lock<std::mutex> lock(mu_, std::defer_lock);
+  if (concurrent_) {
+    lock.lock();
+  }
+  if (non_empty_orders_ == 0) {
+    return 0;
+  }
+  return min_block_size_ << HighestSetBit(non_empty_orders_);
+}
+
+uint32_t BufferPool::OrderFor(VkDeviceSize size) const {
+  if (size <= min_block_size_) {
+    return 0;
+  }
+  if (size > size_) {
+    return order_count_;
+  }
+  return HighestSetBit(size - 1) + 1 - min_block_shift_;
+}
+
+Block BufferPool::MakeBlock(uint32_t order, uint32_t unit) const {
+  return Block(min_block_size_ << order,
+               static_cast<VkDeviceSize>(unit) << min_block_shift_);
+}
+
+uint32_t BufferPool::AllocOrder(uint32_t order) {
+  const uint64_t candidates = (non_empty_orders_ >> order) << order;
+  if (candidates == 0) {
+    return kNil;
+  }
+  uint32_t cur_order = LowestSetBit(candidates);
+  const uint32_t unit = PopFree(cur_order);
+  while (cur_order > order) {
+    --cur_order;
+    PushFree(cur_order, unit + (1u << cur_order));
+  }
+  free_size_ -= min_block_size_ << order;
+  return unit;
+}
+
+void BufferPool::FreeOrder(uint32_t order, uint32_t unit) {
+  CHECK_PC(!IsFree(order, unit), "block is already free");
+  free_size_ += min_block_size_ << order;
+  while (order + 1 < order_count_) {
+    const uint32_t buddy = unit ^ (1u << order);
+    if (!IsFree(order, buddy)) {
+      break;
+    }
+    RemoveFree(order, buddy);
+    unit &= ~(1u << order);
+    ++order;
+  }
+  PushFree(order, unit);
+}
+
+uint32_t BufferPool::AllocCached(uint32_t order) {
+  ThreadCache &cache = LocalCache();
+  std::lock_guard<std::mutex> cache_lock(cache.mu);
+  auto &magazine = cache.magazines[order];
+  if (magazine.empty()) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (size_t i = 0; i < kMagazineBatch; ++i) {
+      const uint32_t unit = AllocOrder(order);
+      if (unit == kNil) {
+        break;
+      }
+      magazine.push_back(unit);
+    }
+  }
+  if (magazine.empty()) {
+    return kNil;
+  }
+  const uint32_t unit = magazine.back();
+  magazine.pop_back();
+  return unit;
+}
+
+void BufferPool::FreeCached(uint32_t order, uint32_t unit) {
+  ThreadCache &cache = LocalCache();
+  std::lock_guard<std::mutex> cache_lock(cache.mu);
+  auto &magazine = cache.magazines[order];
+  magazine.push_back(unit);
+  if (magazine.size() >= kMagazineCapacity) {
+    // Return the oldest half so that long-lived free blocks can merge.
+    std::lock_guard<std::mutex> lock(mu_);
+    for (size_t i = 0; i < kMagazineBatch; ++i) {
+      FreeOrder(order, magazine[i]);
+    }
+    magazine.erase(magazine.begin(), magazine.begin() + kMagazineBatch);
+  }
+}
+
+void BufferPool::DrainCaches() {
+  for (auto &cache : caches_) {
+    std::lock_guard<std::mutex> cache_lock(cache->mu);
+    std::lock_guard<std::mutex> lock(mu_);
+    for (uint32_t order = 0; order < kMagazineOrders; ++order) {
+      for (uint32_t unit : cache->magazines[order]) {
+        FreeOrder(order, unit);
+      }
+      cache->magazines[order].clear();
+    }
+  }
+}
+
+BufferPool::ThreadCache &BufferPool::LocalCache() {
+  static std::atomic<size_t> next_slot(0);
+  static thread_local const size_t slot = next_slot.fetch_add(1);
+  return *caches_[slot % caches_.size()];
+}
+
+uint32_t BufferPool::OrderOf(VkDeviceSize block_size) const {
+  return LowestSetBit(block_size) - min_block_shift_;
+}
+
+size_t BufferPool::BitIndex(uint32_t order, uint32_t unit) const {
+  return free_bits_base_[order] + (unit >> order);
+}
+
+bool BufferPool::IsFree(uint32_t order, uint32_t unit) const {
+  const size_t bit = BitIndex(order, unit);
+  return (free_bits_[bit >> 6] >> (bit & 63)) & 1;
+}
+
+void BufferPool::PushFree(uint32_t order, uint32_t unit) {
+  const uint32_t head = heads_[order];
+  next_[unit] = head;
+  prev_[unit] = kNil;
+  if (head != kNil) {
+    prev_[head] = unit;
+  }
+  heads_[order] = unit;
+  const size_t bit = BitIndex(order, unit);
+  free_bits_[bit >> 6] |= uint64_t(1) << (bit & 63);
+  non_empty_orders_ |= uint64_t(1) << order;
+}
+
+uint32_t BufferPool::PopFree(uint32_t order) {
+  const uint32_t unit = heads_[order];
+  RemoveFree(order, unit);
+  return unit;
+}
+
+void BufferPool::RemoveFree(uint32_t order, uint32_t unit) {
+  const uint32_t prev = prev_[unit];
+  const uint32_t next = next_[unit];
+  if (prev != kNil) {
+    next_[prev] = next;
+  } else {
+    heads_[order] = next;
+  }
+  if (next != kNil) {
+    prev_[next] = prev;
+  }
+  const size_t bit = BitIndex(order, unit);
+  free_bits_[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+  if (heads_[order] == kNil) {
+    non_empty_orders_ &= ~(uint64_t(1) << order);
+  }
 }
 
 } // namespace zrl
@@ -19,8 +19,11 @@
 
 #include "vulkan/vulkan.h"
 
-#include <set>
-#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "core/Buffer.h"
 #include "core/Core.h"
@@ -31,11 +34,19 @@ using Block = std::pair<VkDeviceSize, VkDeviceSize>; // size, offset
 
 constexpr Block kEmptyBlock = Block(0, 0);
 
+// A buddy allocator over a single buffer.
+//
+// When created with concurrent=true, Alloc, Free, Write and LargestBlock may be
+// called from multiple threads. Small blocks are then served from per-thread
+// magazines, which are refilled from and drained into the central buddy tree
+// in batches under a single lock acquisition. Blocks sitting in a magazine
+// are not reported by LargestBlock.
 class BufferPool final : public Buffer {
 public:
   BufferPool(const Core &core, const char *id, VkDeviceSize size,
              VkMemoryPropertyFlags mem_props, VkBufferUsageFlags usage,
-             VkDeviceSize min_block_size, bool mapped);
+             VkDeviceSize min_block_size, bool mapped,
+             bool concurrent = false);
   ~BufferPool();
 
   Block Alloc(VkDeviceSize);
@@ -44,11 +55,53 @@ public:
   VkDeviceSize LargestBlock() const;
 
 private:
+  // Orders below kMagazineOrders are cached per thread in concurrent mode.
+  static constexpr uint32_t kMagazineOrders = 4;
+  static constexpr size_t kMagazineCapacity = 64;
+  static constexpr size_t kMagazineBatch = kMagazineCapacity / 2;
+
+  struct ThreadCache {
+    std::mutex mu;
+    std::array<std::vector<uint32_t>, kMagazineOrders> magazines;
+  };
+
+  // Free blocks are kept in one intrusive doubly-linked list per order, where
+  // order k holds blocks of size min_block_size_ << k. Since free blocks never
+  // overlap, the links are indexed by the block's first min-block unit. A
+  // bitmap per order tracks which blocks are free so that buddies can be
+  // checked and unlinked in O(1) when merging.
+  static constexpr uint32_t kNil = 0xFFFFFFFF;
+
   const std::string id_;
   const VkDeviceSize min_block_size_;
+  const uint32_t min_block_shift_;
+  const uint32_t order_count_;
   VkDeviceSize free_size_ = 0;
-  std::set<Block> blocks_;
+  uint64_t non_empty_orders_ = 0;
+  std::vector<uint32_t> heads_;
+  std::vector<uint32_t> next_;
+  std::vector<uint32_t> prev_;
+  std::vector<uint64_t> free_bits_;
+  std::vector<size_t> free_bits_base_;
   void *mapped_;
+  const bool concurrent_;
+  mutable std::mutex mu_; // Guards the buddy tree in concurrent mode.
+  std::vector<std::unique_ptr<ThreadCache>> caches_;
+
+  uint32_t OrderFor(VkDeviceSize size) const;
+  Block MakeBlock(uint32_t order, uint32_t unit) const;
+  uint32_t AllocOrder(uint32_t order);
+  void FreeOrder(uint32_t order, uint32_t unit);
+  uint32_t AllocCached(uint32_t order);
+  void FreeCached(uint32_t order, uint32_t unit);
+  void DrainCaches();
+  ThreadCache &LocalCache();
+  uint32_t OrderOf(VkDeviceSize block_size) const;
+  size_t BitIndex(uint32_t order, uint32_t unit) const;
+  bool IsFree(uint32_t order, uint32_t unit) const;
+  void PushFree(uint32_t order, uint32_t unit);
+  uint32_t PopFree(uint32_t order);
+  void RemoveFree(uint32_t order, uint32_t unit);
 };
 
 } // namespace zrl
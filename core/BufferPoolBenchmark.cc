@@ -0,0 +1,159 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the Alloc/Free throughput of BufferPool against the std::set
+// based buddy allocator it replaced, on the same random sequence of
+// allocations and frees. Needs a Vulkan device for the pool's buffer.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "core/BufferPool.h"
+#include "core/Core.h"
+#include "core/Log.h"
+
+namespace {
+
+constexpr VkDeviceSize kPoolSize = VkDeviceSize(1) << 28;
+constexpr VkDeviceSize kMinBlockSize = 256;
+constexpr size_t kSlotCount = 8192;
+constexpr size_t kOpCount = 2000000;
+
+// The allocator of BufferPool before per-order free lists, without the
+// buffer.
+class SetBufferPool {
+public:
+  explicit SetBufferPool(VkDeviceSize size) {
+    blocks_.insert(zrl::Block(size, 0));
+  }
+
+  zrl::Block Alloc(VkDeviceSize size) {
+    while (true) {
+      auto it = blocks_.lower_bound(std::make_pair(size, 0));
+      if (it == blocks_.end()) {
+        return zrl::kEmptyBlock;
+      }
+      if (it->first > kMinBlockSize && size + size <= it->first) {
+        const VkDeviceSize new_size = it->first >> 1;
+        const auto lo = zrl::Block(new_size, it->second);
+        const auto hi = zrl::Block(new_size, it->second + new_size);
+        blocks_.erase(it);
+        blocks_.insert(lo);
+        blocks_.insert(hi);
+      } else {
+        const zrl::Block b = *it;
+        blocks_.erase(it);
+        return b;
+      }
+    }
+  }
+
+  void Free(zrl::Block b) {
+    while (true) {
+      const zrl::Block bb(b.first, b.first ^ b.second);
+      auto it = blocks_.find(bb);
+      if (it == blocks_.end()) {
+        blocks_.insert(b);
+        return;
+      }
+      blocks_.erase(it);
+      b = zrl::Block(b.first << 1, std::min(b.second, bb.second));
+    }
+  }
+
+private:
+  std::set<zrl::Block> blocks_;
+};
+
+// A slot to toggle and, if it gets allocated, the size to allocate.
+struct Op {
+  uint32_t slot;
+  VkDeviceSize size;
+};
+
+// Sizes are log-uniform between kMinBlockSize and 64 KiB.
+std::vector<Op> MakeOps() {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint32_t> slot(0, kSlotCount - 1);
+  std::uniform_int_distribution<int> shift(8, 16);
+  std::uniform_real_distribution<double> fraction(0.5, 1.0);
+  std::vector<Op> ops(kOpCount);
+  for (Op &op : ops) {
+    op.slot = slot(rng);
+    op.size = static_cast<VkDeviceSize>(fraction(rng) *
+                                        (VkDeviceSize(1) << shift(rng)));
+  }
+  return ops;
+}
+
+// Returns the average time of an Alloc or a Free in nanoseconds.
+template <typename Pool>
+double Run(Pool &pool, const std::vector<Op> &ops) {
+  std::vector<zrl::Block> slots(kSlotCount, zrl::kEmptyBlock);
+  const auto start = std::chrono::steady_clock::now();
+  for (const Op &op : ops) {
+    zrl::Block &block = slots[op.slot];
+    if (block == zrl::kEmptyBlock) {
+      block = pool.Alloc(op.size);
+    } else {
+      pool.Free(block);
+      block = zrl::kEmptyBlock;
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+  for (zrl::Block &block : slots) {
+    if (block != zrl::kEmptyBlock) {
+      pool.Free(block);
+    }
+  }
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         ops.size();
+}
+
+} // namespace
+
+int main() {
+  const zrl::Config config{/* app_name */ "buffer_pool_benchmark",
+                           /* engine_name */ "zrl",
+                           /* width */ 64,
+                           /* height */ 64,
+                           /* fullscreen*/ false,
+                           /* debug*/ false,
+                           /* pipeline_cache_path */ "",
+                           /* headless */ true};
+  zrl::Core core(config);
+  const std::vector<Op> ops = MakeOps();
+
+  SetBufferPool set_pool(kPoolSize);
+  const double set_ns = Run(set_pool, ops);
+  zrl::BufferPool pool(core, "benchmark", kPoolSize,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, kMinBlockSize,
+                       /* mapped */ false);
+  const double pool_ns = Run(pool, ops);
+  zrl::BufferPool concurrent_pool(core, "benchmark", kPoolSize,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                  kMinBlockSize, /* mapped */ false,
+                                  /* concurrent */ true);
+  const double concurrent_ns = Run(concurrent_pool, ops);
+
+  std::cout << "std::set buddy allocator: " << set_ns << " ns/op\n"
+            << "BufferPool: " << pool_ns << " ns/op\n"
+            << "BufferPool, concurrent: " << concurrent_ns << " ns/op\n";
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Stress test of the concurrent mode of BufferPool: threads allocate and
+// free blocks of random sizes while every min-block unit of the pool
+// records the thread that owns it, so that two live blocks overlapping
+// fail the test. Needs a Vulkan device for the pool's buffer.
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "core/BufferPool.h"
+#include "core/Core.h"
+#include "core/Log.h"
+
+namespace {
+
+constexpr VkDeviceSize kPoolSize = VkDeviceSize(1) << 26;
+constexpr VkDeviceSize kMinBlockSize = 256;
+constexpr uint32_t kThreadCount = 8;
+constexpr size_t kSlotCount = 256;
+constexpr size_t kOpCount = 200000;
+
+using Owners = std::vector<std::atomic<uint32_t>>;
+
+void Own(Owners &owners, zrl::Block block, uint32_t owner) {
+  for (VkDeviceSize unit = block.second / kMinBlockSize;
+       unit < (block.second + block.first) / kMinBlockSize; ++unit) {
+    uint32_t expected = 0;
+    CHECK(owners[unit].compare_exchange_strong(expected, owner),
+          "block of size " << block.first << " at " << block.second
+                           << " overlaps a block of thread "
+                           << expected - 1);
+  }
+}
+
+void Disown(Owners &owners, zrl::Block block, uint32_t owner) {
+  for (VkDeviceSize unit = block.second / kMinBlockSize;
+       unit < (block.second + block.first) / kMinBlockSize; ++unit) {
+    CHECK(owners[unit].exchange(0) == owner,
+          "block at " << block.second << " changed owner while live");
+  }
+}
+
+// Toggles random slots between a live block of random size and no block,
+// and frees the remaining blocks at the end.
+void Stress(zrl::BufferPool &pool, Owners &owners, uint32_t thread) {
+  const uint32_t owner = thread + 1;
+  std::mt19937 rng(thread);
+  std::uniform_int_distribution<size_t> slot(0, kSlotCount - 1);
+  // Mostly small blocks, which go through the magazines, and some large
+  // ones, which go to the buddy tree directly.
+  std::uniform_int_distribution<int> shift(8, 17);
+  std::vector<zrl::Block> slots(kSlotCount, zrl::kEmptyBlock);
+  for (size_t i = 0; i < kOpCount; ++i) {
+    zrl::Block &block = slots[slot(rng)];
+    if (block == zrl::kEmptyBlock) {
+      block = pool.Alloc((VkDeviceSize(1) << shift(rng)) - 1);
+      if (block != zrl::kEmptyBlock) {
+        Own(owners, block, owner);
+      }
+    } else {
+      Disown(owners, block, owner);
+      pool.Free(block);
+      block = zrl::kEmptyBlock;
+    }
+  }
+  for (zrl::Block block : slots) {
+    if (block != zrl::kEmptyBlock) {
+      Disown(owners, block, owner);
+      pool.Free(block);
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  const zrl::Config config{/* app_name */ "buffer_pool_test",
+                           /* engine_name */ "zrl",
+                           /* width */ 64,
+                           /* height */ 64,
+                           /* fullscreen*/ false,
+                           /* debug*/ true,
+                           /* pipeline_cache_path */ "",
+                           /* headless */ true};
+  zrl::Core core(config);
+  zrl::BufferPool pool(core, "test", kPoolSize,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, kMinBlockSize,
+                       /* mapped */ false, /* concurrent */ true);
+  Owners owners(kPoolSize / kMinBlockSize);
+  for (auto &owner : owners) {
+    owner = 0;
+  }
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back(Stress, std::ref(pool), std::ref(owners), i);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Everything was freed, so the whole pool must be allocatable again once
+  // the magazines are drained, which a failing Alloc does.
+  const zrl::Block all = pool.Alloc(kPoolSize);
+  CHECK(all == zrl::Block(kPoolSize, 0), "blocks leaked from the pool");
+  pool.Free(all);
+  LOG(INFO) << "BufferPoolTest: passed\n";
+  zrl::FlushLog();
+  return 0;
+}
@@ -14,11 +14,17 @@
 
 #include "core/Core.h"
 
+#include <chrono>
 #include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "core/AtomicFile.h"
 #include "core/Constants.h"
 #include "core/Log.h"
+#include "core/MappedFile.h"
 
 namespace zrl {
 
@@ -49,12 +55,15 @@ static std::vector<VkExtensionProperties> GetSupportedInstanceExtensions() {
   return supported_extensions;
 }
 
-static std::vector<const char *> GetRequiredInstanceExtensions(bool debug) {
-  uint32_t glfw_extension_count = 0;
-  const char **glfw_extensions;
-  glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-  std::vector<const char *> extensions(glfw_extensions,
-                                       glfw_extensions + glfw_extension_count);
+static std::vector<const char *> GetRequiredInstanceExtensions(bool debug,
+                                                               bool headless) {
+  std::vector<const char *> extensions;
+  if (!headless) {
+    uint32_t glfw_extension_count = 0;
+    const char **glfw_extensions;
+    glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+  }
 
   for (auto ext : kRequiredInstanceExtensions) {
     extensions.push_back(ext);
@@ -96,8 +105,13 @@ GetSupportedDeviceExtensions(VkPhysicalDevice device) {
   return supported_extensions;
 }
 
-static std::vector<const char *> GetRequiredDeviceExtensions(bool debug) {
-  std::vector<const char *> extensions(kRequiredDeviceExtensions);
+static std::vector<const char *> GetRequiredDeviceExtensions(bool debug,
+                                                             bool headless) {
+  // Without a surface there is nothing to create a swapchain for.
+  std::vector<const char *> extensions;
+  if (!headless) {
+    extensions = kRequiredDeviceExtensions;
+  }
   if (debug) {
     for (auto ext : kRequiredDeviceExtensionsDebug) {
       extensions.push_back(ext);
@@ -106,6 +120,10 @@ static std::vector<const char *> GetRequiredDeviceExtensions(bool debug) {
   return extensions;
 }
 
+// Occurrences of a validation message logged before rate limiting it.
+constexpr uint64_t kDebugRepeats = 3;
+constexpr uint64_t kDebugRepeatPeriod = 1000;
+
 PFN_vkCreateDebugReportCallbackEXT CreateDebugReportCallback = VK_NULL_HANDLE;
 PFN_vkDestroyDebugReportCallbackEXT DestroyDebugReportCallback = VK_NULL_HANDLE;
 
@@ -113,52 +131,138 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL
 DebugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT obj_type,
               uint64_t obj, size_t location, int32_t code,
               const char *layer_prefix, const char *msg, void *) {
+  LogLevel level = DEBUG;
+  if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) {
+    level = ERROR;
+  } else if (flags & VK_DEBUG_REPORT_WARNING_BIT_EXT) {
+    level = WARNING;
+  } else if (flags & VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT) {
+    level = WARNING;
+  } else if (flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT) {
+    level = INFO;
+  }
+  if (static_cast<int>(level) < ZRL_MIN_LOG_LEVEL) {
+    return VK_FALSE;
+  }
+
+  // The same message is often reported for every draw or every frame, so
+  // after a few occurrences only every kDebugRepeatPeriod-th one is logged.
+  // Messages differ by the objects they mention, so they are told apart by
+  // where they were reported instead.
+  uint64_t occurrences = 0;
+  {
+    static std::mutex mu;
+    static std::unordered_map<std::string, uint64_t> counts;
+    std::lock_guard<std::mutex> lock(mu);
+    occurrences = ++counts[std::string(layer_prefix) + ":" +
+                           std::to_string(location) + ":" +
+                           std::to_string(code)];
+  }
+  if (occurrences > kDebugRepeats && occurrences % kDebugRepeatPeriod != 0) {
+    return VK_FALSE;
+  }
+
   std::string flags_str;
   for (auto kv : VkDebugReportFlagBitsEXTStr) {
     if (flags & kv.first) {
       flags_str += kv.second + " ";
     }
   }
-  const char *tag = DEBUG;
-  if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) {
-    tag = ERROR;
-  } else if (flags & VK_DEBUG_REPORT_WARNING_BIT_EXT) {
-    tag = WARNING;
-  } else if (flags & VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT) {
-    tag = WARNING;
-  } else if (flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT) {
-    tag = INFO;
-  }
-  LOG(tag) << tag << "DebugCallback:\n"
-           << "\tobj_type=" << VkDebugReportObjectTypeEXTStr.at(obj_type)
-           << "\n"
-           << "\tflags=" << flags_str << "\n"
-           << "\tlayer_prefix=" << layer_prefix << "\n"
-           << "\tmsg='" << msg << "'\n"
-           << "\tobj=" << obj << "\n"
-           << "\tlocation=" << location << "\n"
-           << "\tcode=" << code << "\n";
+
+  LOG(level) << "DebugCallback:\n"
+             << "\tobj_type=" << VkDebugReportObjectTypeEXTStr.at(obj_type)
+             << "\n"
+             << "\tflags=" << flags_str << "\n"
+             << "\tlayer_prefix=" << layer_prefix << "\n"
+             << "\tmsg='" << msg << "'\n"
+             << "\tobj=" << obj << "\n"
+             << "\tlocation=" << location << "\n"
+             << "\tcode=" << code << "\n";
+  if (occurrences == kDebugRepeats) {
+    LOG(level) << "DebugCallback: repeated " << occurrences
+               << " times, logging only every " << kDebugRepeatPeriod
+               << "th occurrence from now on\n";
+  } else if (occurrences > kDebugRepeats) {
+    LOG(level) << "DebugCallback: repeated " << occurrences << " times\n";
+  }
   return VK_FALSE;
 }
 
-Core::Core(Config config) : config_(config) {
+// Header written by vkGetPipelineCacheData, see
+// VkPipelineCacheHeaderVersionOne in the spec.
+struct PipelineCacheHeader {
+  uint32_t header_size;
+  uint32_t header_version;
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint8_t uuid[VK_UUID_SIZE];
+};
+
+// Returns whether data was produced by the given device and driver, and can
+// therefore be used to initialize a pipeline cache.
+static bool IsPipelineCacheCompatible(const uint8_t *data, uint64_t size,
+                                      const VkPhysicalDeviceProperties &props,
+                                      std::string &reason) {
+  PipelineCacheHeader header;
+  if (size < sizeof(header)) {
+    reason = "truncated header";
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.header_size < sizeof(header) || header.header_size > size) {
+    reason = "bad header size";
+    return false;
+  }
+  if (header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    reason = "unknown header version";
+    return false;
+  }
+  if (header.vendor_id != props.vendorID ||
+      header.device_id != props.deviceID) {
+    reason = "different device";
+    return false;
+  }
+  if (std::memcmp(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+    reason = "different driver";
+    return false;
+  }
+  return true;
+}
+
+Core::Core(Config config)
+    : config_(config), window_(nullptr), surface_(VK_NULL_HANDLE),
+      pipeline_cache_(VK_NULL_HANDLE),
+      pipeline_cache_warm_(false) {
   DLOG << "Core: ctor\n";
+  TRACE_SCOPE("Core::Core");
+  const auto start = std::chrono::steady_clock::now();
   CreateWindow();
   CreateInstance();
   SetupDebugCallback();
   CreateSurface();
   CreateLogicalDevice();
+  CreateDeviceMemoryAllocator();
+  CreatePipelineCache();
   CreateSwapchain();
+  LOG(INFO) << "Core: initialized in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "ms\n";
 }
 
 Core::~Core() {
   DLOG << "Core: dtor\n";
   swapchain_.reset();
+  DestroyPipelineCache();
+  allocator_.reset();
   device_.reset();
   DestroyDebugCallback();
   DestroySurface();
   vkDestroyInstance(instance_, nullptr);
-  glfwDestroyWindow(window_);
+  if (window_ != nullptr) {
+    glfwDestroyWindow(window_);
+  }
 }
 
 // See:
@@ -185,6 +289,7 @@ int32_t Core::FindMemoryType(uint32_t mem_type_requirements,
 }
 
 void Core::UpdateSwapchain() {
+  TRACE_SCOPE("Core::UpdateSwapchain");
   CHECK_VK(vkQueueWaitIdle(device_->GetGCTQueue()));
   CHECK_VK(vkQueueWaitIdle(device_->GetPresentQueue()));
   CHECK_VK(vkDeviceWaitIdle(device_->GetHandle()));
@@ -193,15 +298,26 @@ void Core::UpdateSwapchain() {
 }
 
 void Core::CreateSurface() {
+  TRACE_SCOPE("Core::CreateSurface");
+  if (config_.headless) {
+    return;
+  }
   LOG(INFO) << "Core: creating window surface\n";
   CHECK_VK(glfwCreateWindowSurface(instance_, window_, nullptr, &surface_));
 }
 
 void Core::DestroySurface() {
-  vkDestroySurfaceKHR(instance_, surface_, nullptr);
+  if (surface_ != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance_, surface_, nullptr);
+  }
 }
 
 void Core::CreateWindow() {
+  TRACE_SCOPE("Core::CreateWindow");
+  if (config_.headless) {
+    LOG(INFO) << "Core: running headless\n";
+    return;
+  }
   LOG(INFO) << "Core: creating GLFW window\n";
   glfwInit();
   GLFWmonitor *monitor = glfwGetPrimaryMonitor();
@@ -265,7 +381,8 @@ void Core::CheckLayerSupport() const {
 
 void Core::CheckInstanceExtensionSupport() const {
   LOG(INFO) << "Core: checking instance extension support\n";
-  auto required_extensions = GetRequiredInstanceExtensions(config_.debug);
+  auto required_extensions =
+      GetRequiredInstanceExtensions(config_.debug, config_.headless);
   auto supported_extensions = GetSupportedInstanceExtensions();
   for (auto extension : required_extensions) {
     bool ok = false;
@@ -280,6 +397,7 @@ void Core::CheckInstanceExtensionSupport() const {
 }
 
 void Core::CreateInstance() {
+  TRACE_SCOPE("Core::CreateInstance");
   LOG(INFO) << "Core: creating Vulkan instance\n";
   DLOG << "Core: vulkan header version: " << VK_HEADER_VERSION << "\n";
   VkApplicationInfo app_info = {};
@@ -302,7 +420,8 @@ void Core::CreateInstance() {
   CheckLayerSupport();
   CheckInstanceExtensionSupport();
 
-  auto required_extensions = GetRequiredInstanceExtensions(config_.debug);
+  auto required_extensions =
+      GetRequiredInstanceExtensions(config_.debug, config_.headless);
   create_info.enabledExtensionCount =
       static_cast<uint32_t>(required_extensions.size());
   create_info.ppEnabledExtensionNames = required_extensions.data();
@@ -346,13 +465,15 @@ void Core::DestroyDebugCallback() {
 }
 
 void Core::CreateLogicalDevice() {
+  TRACE_SCOPE("Core::CreateLogicalDevice");
   LOG(INFO) << "Core: creating logical device\n";
   auto physical_devices = PhysicalDevice::GetDevices(instance_);
   DLOG << "Core: enumerating physical devices\n";
   for (size_t i = 0; i < physical_devices.size(); ++i) {
     DLOG << "Core: physical device #" << i << "\n" << physical_devices[i];
   }
-  auto required_device_extensions = GetRequiredDeviceExtensions(config_.debug);
+  auto required_device_extensions =
+      GetRequiredDeviceExtensions(config_.debug, config_.headless);
   for (auto physical_device : physical_devices) {
     // TODO: score devices to pick the most suitable
     if (physical_device.SupportsExtensions(required_device_extensions)) {
@@ -360,7 +481,7 @@ void Core::CreateLogicalDevice() {
                 << "\n";
       device_ = std::make_unique<LogicalDevice>(
           physical_device, surface_, GetRequiredLayers(config_.debug),
-          GetRequiredDeviceExtensions(config_.debug));
+          required_device_extensions);
       break;
     }
   }
@@ -372,12 +493,81 @@ void Core::CreateLogicalDevice() {
 
   DLOG << "Core: gct queue: " << device_->GetGCTQueue() << "\n";
   DLOG << "Core: present queue: " << device_->GetPresentQueue() << "\n";
+  DLOG << "Core: transfer queue: " << device_->GetTransferQueue()
+       << (device_->HasDedicatedTransferQueue() ? " (dedicated)" : "") << "\n";
+  DLOG << "Core: compute queue: " << device_->GetComputeQueue()
+       << (device_->HasDedicatedComputeQueue() ? " (dedicated)" : "") << "\n";
+}
+
+void Core::CreateDeviceMemoryAllocator() {
+  TRACE_SCOPE("Core::CreateDeviceMemoryAllocator");
+  LOG(INFO) << "Core: creating device memory allocator\n";
+  allocator_ = std::make_unique<DeviceMemoryAllocator>(*device_, _64MB);
+}
+
+void Core::CreatePipelineCache() {
+  TRACE_SCOPE("Core::CreatePipelineCache");
+  LOG(INFO) << "Core: creating pipeline cache\n";
+  VkPipelineCacheCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.initialDataSize = 0;
+  create_info.pInitialData = nullptr;
+
+  std::unique_ptr<MappedFile> file;
+  const std::string &path = config_.pipeline_cache_path;
+  if (!path.empty() && MappedFile::Exists(path)) {
+    file = std::make_unique<MappedFile>(path);
+    std::string reason;
+    if (IsPipelineCacheCompatible(
+            file->GetData(), file->GetSize(),
+            device_->GetPhysicalDevice().GetProperties(), reason)) {
+      create_info.initialDataSize = static_cast<size_t>(file->GetSize());
+      create_info.pInitialData = file->GetData();
+      pipeline_cache_warm_ = true;
+    } else {
+      LOG(WARNING) << "Core: discarding pipeline cache '" << path
+                   << "': " << reason << "\n";
+    }
+  }
+  CHECK_VK(vkCreatePipelineCache(device_->GetHandle(), &create_info, nullptr,
+                                 &pipeline_cache_));
+  LOG(INFO) << "Core: pipeline cache is "
+            << (pipeline_cache_warm_ ? "warm" : "cold") << " ("
+            << create_info.initialDataSize << " bytes loaded)\n";
+}
+
+void Core::DestroyPipelineCache() {
+  const std::string &path = config_.pipeline_cache_path;
+  if (!path.empty()) {
+    size_t size = 0;
+    CHECK_VK(vkGetPipelineCacheData(device_->GetHandle(), pipeline_cache_,
+                                    &size, nullptr));
+    std::vector<uint8_t> data(size);
+    CHECK_VK(vkGetPipelineCacheData(device_->GetHandle(), pipeline_cache_,
+                                    &size, data.data()));
+    if (WriteFileAtomically(path, {{data.data(), size}})) {
+      DLOG << "Core: saved pipeline cache '" << path << "' (" << size
+           << " bytes)\n";
+    } else {
+      LOG(WARNING) << "Core: failed to save pipeline cache '" << path
+                   << "'\n";
+    }
+  }
+  vkDestroyPipelineCache(device_->GetHandle(), pipeline_cache_, nullptr);
 }
 
 void Core::CreateSwapchain() {
+  TRACE_SCOPE("Core::CreateSwapchain");
   LOG(INFO) << "Core: creating swapchain\n";
-  swapchain_ = std::make_unique<Swapchain>(*device_, surface_, config_.width,
-                                           config_.height);
+  if (config_.headless) {
+    swapchain_ = std::make_unique<Swapchain>(
+        *this, config_.width, config_.height, config_.headless_image_count);
+  } else {
+    swapchain_ = std::make_unique<Swapchain>(*device_, surface_, config_.width,
+                                             config_.height);
+  }
   CHECK_PC(swapchain_, "Could not create swapchain");
   DLOG << "Core: swapchain created:\n"
        << "\tformat: " << VkFormatStr.at(swapchain_->GetSurfaceFormat()) << "\n"
@@ -26,6 +26,7 @@
 #define GLFW_INCLUDE_VULKAN
 #include "GLFW/glfw3.h"
 
+#include "core/DeviceMemoryAllocator.h"
 #include "core/LogicalDevice.h"
 #include "core/Swapchain.h"
 
@@ -38,6 +39,13 @@ struct Config {
   uint32_t height;
   bool fullscreen;
   bool debug;
+  // File the pipeline cache is loaded from at startup and saved to at
+  // shutdown. If empty, the cache only lives as long as Core.
+  std::string pipeline_cache_path = "";
+  // Runs without a window or surface, rendering to an offscreen swapchain of
+  // headless_image_count images instead.
+  bool headless = false;
+  uint32_t headless_image_count = 3;
 };
 
 class Core {
@@ -47,7 +55,17 @@ public:
 
   const LogicalDevice &GetLogicalDevice() const { return *device_; }
   const Swapchain &GetSwapchain() const { return *swapchain_; }
+  DeviceMemoryAllocator &GetDeviceMemoryAllocator() const {
+    return *allocator_;
+  }
+  // Returns nullptr in headless mode.
   GLFWwindow *GetWindow() const { return window_; }
+  bool IsHeadless() const { return config_.headless; }
+  // The cache to create all pipelines with, so that they are not compiled
+  // again on the next run.
+  VkPipelineCache GetPipelineCache() const { return pipeline_cache_; }
+  // Whether the pipeline cache was initialized with data from a previous run.
+  bool IsPipelineCacheWarm() const { return pipeline_cache_warm_; }
   int32_t FindMemoryType(uint32_t mem_type_requirements,
                          VkMemoryPropertyFlags required_props) const;
   void UpdateSwapchain();
@@ -59,6 +77,9 @@ private:
   VkDebugReportCallbackEXT debug_callback_;
   VkSurfaceKHR surface_;
   std::unique_ptr<LogicalDevice> device_;
+  std::unique_ptr<DeviceMemoryAllocator> allocator_;
+  VkPipelineCache pipeline_cache_;
+  bool pipeline_cache_warm_;
   std::unique_ptr<Swapchain> swapchain_;
 
   void CreateWindow();
@@ -68,6 +89,9 @@ private:
   void SetupDebugCallback();
   void DestroyDebugCallback();
   void CreateLogicalDevice();
+  void CreateDeviceMemoryAllocator();
+  void CreatePipelineCache();
+  void DestroyPipelineCache();
   void CreateSwapchain();
   void ListSupportedInstanceExtensions() const;
   void ListSupportedDeviceExtensions() const;
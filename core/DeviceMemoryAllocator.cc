@@ -0,0 +1,285 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/DeviceMemoryAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include "core/Log.h"
+
+namespace zrl {
+
+// Vulkan alignments are always powers of two.
+static inline VkDeviceSize Align(VkDeviceSize offset, VkDeviceSize alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+std::ostream &operator<<(std::ostream &out, const DeviceMemoryStats &stats) {
+  out << "memory_objects=" << stats.memory_object_count
+      << " allocations=" << stats.allocation_count
+      << " reserved=" << stats.reserved_size << " used=" << stats.used_size
+      << " largest_free_range=" << stats.largest_free_range
+      << " fragmentation=" << stats.fragmentation;
+  return out;
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator(const LogicalDevice &device,
+                                             VkDeviceSize block_size)
+    : device_(device.GetHandle()),
+      mem_props_(device.GetPhysicalDevice().GetMemoryProperties()),
+      block_size_(block_size),
+      granularity_(device.GetPhysicalDevice()
+                       .GetProperties()
+                       .limits.bufferImageGranularity),
+      non_coherent_atom_size_(device.GetPhysicalDevice()
+                                  .GetProperties()
+                                  .limits.nonCoherentAtomSize),
+      max_allocation_count_(device.GetPhysicalDevice()
+                                .GetProperties()
+                                .limits.maxMemoryAllocationCount),
+      pools_(2 * VK_MAX_MEMORY_TYPES) {}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator() {
+  DLOG << "DeviceMemoryAllocator: dtor: " << GetStats() << "\n";
+  for (auto &pool : pools_) {
+    for (auto &block : pool) {
+      if (block.memory == VK_NULL_HANDLE) {
+        continue;
+      }
+      if (block.allocation_count > 0) {
+        LOG(WARNING) << "DeviceMemoryAllocator: " << block.allocation_count
+                     << " allocations still alive\n";
+      }
+      DestroyBlock(block);
+    }
+  }
+}
+
+DeviceAllocation DeviceMemoryAllocator::Alloc(const VkMemoryRequirements &reqs,
+                                              uint32_t memory_type,
+                                              bool linear) {
+  CHECK_PC(memory_type < mem_props_.memoryTypeCount, "invalid memory type");
+  CHECK_PC((reqs.memoryTypeBits & (1u << memory_type)) != 0,
+           "memory type not allowed by the requirements");
+  VkDeviceSize alignment = reqs.alignment;
+  VkDeviceSize size = reqs.size;
+  if (mem_props_.memoryTypes[memory_type].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    // Keeps flush and invalidate ranges valid for every allocation.
+    alignment = std::max(alignment, non_coherent_atom_size_);
+    size = Align(size, non_coherent_atom_size_);
+  }
+  const uint32_t pool =
+      2 * memory_type + ((granularity_ > 1 && !linear) ? 1 : 0);
+
+  std::lock_guard<std::mutex> lock(mu_);
+  DeviceAllocation allocation;
+  allocation.pool = pool;
+  allocation.size = size;
+  if (size > block_size_ / 2) {
+    allocation.block = CreateBlock(pool, memory_type, size, true);
+    pools_[pool][allocation.block].allocation_count = 1;
+    allocation.offset = 0;
+  } else {
+    auto &blocks = pools_[pool];
+    bool found = false;
+    for (uint32_t i = 0; i < blocks.size() && !found; ++i) {
+      if (blocks[i].memory != VK_NULL_HANDLE && !blocks[i].dedicated &&
+          AllocFromBlock(blocks[i], size, alignment, allocation.offset)) {
+        allocation.block = i;
+        found = true;
+      }
+    }
+    if (!found) {
+      const VkMemoryHeap &heap =
+          mem_props_.memoryHeaps[mem_props_.memoryTypes[memory_type].heapIndex];
+      const VkDeviceSize new_block_size =
+          std::max(std::min(block_size_, heap.size / 8), size);
+      allocation.block = CreateBlock(pool, memory_type, new_block_size, false);
+      found = AllocFromBlock(pools_[pool][allocation.block], size, alignment,
+                             allocation.offset);
+      CHECK_PC(found, "allocation does not fit in a new block");
+    }
+  }
+  allocation.memory = pools_[pool][allocation.block].memory;
+  return allocation;
+}
+
+void DeviceMemoryAllocator::Free(const DeviceAllocation &allocation) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto &blocks = pools_[allocation.pool];
+  Block &block = blocks[allocation.block];
+  CHECK_PC(block.memory == allocation.memory, "allocation is not alive");
+  if (block.dedicated) {
+    DestroyBlock(block);
+    return;
+  }
+
+  VkDeviceSize offset = allocation.offset;
+  VkDeviceSize size = allocation.size;
+  auto next = block.free_ranges.lower_bound(offset);
+  if (next != block.free_ranges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      block.free_ranges.erase(prev);
+    }
+  }
+  if (next != block.free_ranges.end() && offset + size == next->first) {
+    size += next->second;
+    block.free_ranges.erase(next);
+  }
+  block.free_ranges[offset] = size;
+  --block.allocation_count;
+
+  if (block.allocation_count == 0) {
+    // Keep one empty block around per pool to avoid churning driver
+    // allocations when a single resource is repeatedly created and destroyed.
+    const auto live_blocks =
+        std::count_if(blocks.begin(), blocks.end(), [](const Block &b) {
+          return b.memory != VK_NULL_HANDLE && !b.dedicated;
+        });
+    if (live_blocks > 1) {
+      DestroyBlock(block);
+    }
+  }
+}
+
+void *DeviceMemoryAllocator::Map(const DeviceAllocation &allocation) {
+  std::lock_guard<std::mutex> lock(mu_);
+  Block &block = pools_[allocation.pool][allocation.block];
+  if (block.mapped == nullptr) {
+    CHECK_VK(vkMapMemory(device_, block.memory, 0, VK_WHOLE_SIZE, 0,
+                         &block.mapped));
+  }
+  ++block.map_count;
+  return reinterpret_cast<char *>(block.mapped) + allocation.offset;
+}
+
+void DeviceMemoryAllocator::Unmap(const DeviceAllocation &allocation) {
+  std::lock_guard<std::mutex> lock(mu_);
+  Block &block = pools_[allocation.pool][allocation.block];
+  CHECK_PC(block.map_count > 0, "allocation is not mapped");
+  if (--block.map_count == 0) {
+    vkUnmapMemory(device_, block.memory);
+    block.mapped = nullptr;
+  }
+}
+
+DeviceMemoryStats DeviceMemoryAllocator::GetStats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  DeviceMemoryStats stats;
+  VkDeviceSize free_size = 0;
+  for (const auto &pool : pools_) {
+    for (const auto &block : pool) {
+      if (block.memory == VK_NULL_HANDLE) {
+        continue;
+      }
+      ++stats.memory_object_count;
+      stats.allocation_count += block.allocation_count;
+      stats.reserved_size += block.size;
+      VkDeviceSize block_free_size = 0;
+      for (const auto &range : block.free_ranges) {
+        block_free_size += range.second;
+        stats.largest_free_range =
+            std::max(stats.largest_free_range, range.second);
+      }
+      stats.used_size += block.size - block_free_size;
+      free_size += block_free_size;
+    }
+  }
+  if (free_size > 0) {
+    stats.fragmentation =
+        1.0f - static_cast<float>(stats.largest_free_range) / free_size;
+  }
+  return stats;
+}
+
+bool DeviceMemoryAllocator::AllocFromBlock(Block &block, VkDeviceSize size,
+                                           VkDeviceSize alignment,
+                                           VkDeviceSize &offset) {
+  // Best fit: pick the smallest free range that can hold the request.
+  auto best = block.free_ranges.end();
+  VkDeviceSize best_size = std::numeric_limits<VkDeviceSize>::max();
+  for (auto it = block.free_ranges.begin(); it != block.free_ranges.end();
+       ++it) {
+    const VkDeviceSize aligned = Align(it->first, alignment);
+    if (aligned + size <= it->first + it->second && it->second < best_size) {
+      best = it;
+      best_size = it->second;
+    }
+  }
+  if (best == block.free_ranges.end()) {
+    return false;
+  }
+  const VkDeviceSize range_offset = best->first;
+  const VkDeviceSize range_end = best->first + best->second;
+  block.free_ranges.erase(best);
+  offset = Align(range_offset, alignment);
+  if (offset > range_offset) {
+    block.free_ranges[range_offset] = offset - range_offset;
+  }
+  if (offset + size < range_end) {
+    block.free_ranges[offset + size] = range_end - (offset + size);
+  }
+  ++block.allocation_count;
+  return true;
+}
+
+uint32_t DeviceMemoryAllocator::CreateBlock(uint32_t pool,
+                                            uint32_t memory_type,
+                                            VkDeviceSize size, bool dedicated) {
+  CHECK_PC(memory_object_count_ < max_allocation_count_,
+           "maxMemoryAllocationCount exceeded");
+  Block block;
+  block.size = size;
+  block.dedicated = dedicated;
+  if (!dedicated) {
+    block.free_ranges[0] = size;
+  }
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.allocationSize = size;
+  alloc_info.memoryTypeIndex = memory_type;
+  CHECK_VK(vkAllocateMemory(device_, &alloc_info, nullptr, &block.memory));
+  ++memory_object_count_;
+  DLOG << "DeviceMemoryAllocator: new " << (dedicated ? "dedicated " : "")
+       << "block: memory_type=" << memory_type << " size=" << size << "\n";
+
+  auto &blocks = pools_[pool];
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    if (blocks[i].memory == VK_NULL_HANDLE) {
+      blocks[i] = std::move(block);
+      return i;
+    }
+  }
+  blocks.push_back(std::move(block));
+  return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void DeviceMemoryAllocator::DestroyBlock(Block &block) {
+  if (block.mapped != nullptr) {
+    vkUnmapMemory(device_, block.memory);
+  }
+  vkFreeMemory(device_, block.memory, nullptr);
+  --memory_object_count_;
+  block = Block();
+}
+
+} // namespace zrl
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_DEVICE_MEMORY_ALLOCATOR_H_
+#define ZRL_CORE_DEVICE_MEMORY_ALLOCATOR_H_
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "core/LogicalDevice.h"
+
+namespace zrl {
+
+struct DeviceAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  uint32_t pool = 0;
+  uint32_t block = 0;
+};
+
+struct DeviceMemoryStats {
+  uint32_t memory_object_count = 0;
+  uint32_t allocation_count = 0;
+  VkDeviceSize reserved_size = 0;
+  VkDeviceSize used_size = 0;
+  VkDeviceSize largest_free_range = 0;
+  // 1 - largest_free_range / free size, over all shared blocks. 0 means that
+  // all free space is contiguous.
+  float fragmentation = 0.0f;
+};
+
+std::ostream &operator<<(std::ostream &, const DeviceMemoryStats &);
+
+// Sub-allocates buffer and image memory from large VkDeviceMemory blocks, one
+// set of blocks per memory type, so that the number of driver allocations
+// stays far below maxMemoryAllocationCount. When bufferImageGranularity is
+// larger than 1, linear and optimal resources are kept in separate blocks so
+// they can never share a granularity page. Requests larger than half a block
+// get a dedicated VkDeviceMemory.
+class DeviceMemoryAllocator {
+public:
+  DeviceMemoryAllocator(const LogicalDevice &device, VkDeviceSize block_size);
+  ~DeviceMemoryAllocator();
+
+  DeviceMemoryAllocator(const DeviceMemoryAllocator &) = delete;
+  DeviceMemoryAllocator(DeviceMemoryAllocator &&) = delete;
+
+  // linear must be true for buffers and linear-tiling images.
+  DeviceAllocation Alloc(const VkMemoryRequirements &reqs,
+                         uint32_t memory_type, bool linear);
+  void Free(const DeviceAllocation &);
+  // Maps the block holding the allocation, which stays mapped until the last
+  // allocation mapped from it is unmapped, and returns the allocation address.
+  void *Map(const DeviceAllocation &);
+  void Unmap(const DeviceAllocation &);
+  DeviceMemoryStats GetStats() const;
+
+private:
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    bool dedicated = false;
+    uint32_t allocation_count = 0;
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges; // offset, size
+    void *mapped = nullptr;
+    uint32_t map_count = 0;
+  };
+
+  const VkDevice device_;
+  const VkPhysicalDeviceMemoryProperties mem_props_;
+  const VkDeviceSize block_size_;
+  const VkDeviceSize granularity_;
+  const VkDeviceSize non_coherent_atom_size_;
+  const uint32_t max_allocation_count_;
+  uint32_t memory_object_count_ = 0;
+  std::vector<std::vector<Block>> pools_;
+  mutable std::mutex mu_;
+
+  bool AllocFromBlock(Block &, VkDeviceSize size, VkDeviceSize alignment,
+                      VkDeviceSize &offset);
+  uint32_t CreateBlock(uint32_t pool, uint32_t memory_type, VkDeviceSize size,
+                       bool dedicated);
+  void DestroyBlock(Block &);
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_DEVICE_MEMORY_ALLOCATOR_H_
@@ -0,0 +1,139 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Creates hundreds of textures and buffers and checks, with the counters of
+// DeviceMemoryAllocator, that they share a handful of VkDeviceMemory objects,
+// that the holes left by freed resources are reused, and that every
+// allocation is returned. Needs a Vulkan device.
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "core/Buffer.h"
+#include "core/Constants.h"
+#include "core/Core.h"
+#include "core/DeviceMemoryAllocator.h"
+#include "core/Image.h"
+#include "core/Log.h"
+
+namespace {
+
+constexpr uint32_t kTextureCount = 400;
+constexpr uint32_t kBufferCount = 100;
+// The block size Core creates its allocator with.
+constexpr VkDeviceSize kBlockSize = zrl::_64MB;
+
+// A square texture with a full mip chain.
+std::unique_ptr<zrl::Image> CreateTexture(const zrl::Core &core,
+                                          uint32_t size) {
+  uint32_t levels = 1;
+  while ((size >> levels) > 0) {
+    ++levels;
+  }
+  return zrl::Image::Image2D(
+      core, VkExtent2D{size, size}, levels, 1, VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      VK_SAMPLE_COUNT_1_BIT);
+}
+
+VkDeviceSize BlocksFor(VkDeviceSize size) {
+  return (size + kBlockSize - 1) / kBlockSize;
+}
+
+} // namespace
+
+int main() {
+  const zrl::Config config{/* app_name */ "device_memory_allocator_test",
+                           /* engine_name */ "zrl",
+                           /* width */ 64,
+                           /* height */ 64,
+                           /* fullscreen*/ false,
+                           /* debug*/ true,
+                           /* pipeline_cache_path */ "",
+                           /* headless */ true};
+  zrl::Core core(config);
+  const zrl::DeviceMemoryAllocator &allocator =
+      core.GetDeviceMemoryAllocator();
+  const zrl::DeviceMemoryStats before = allocator.GetStats();
+
+  std::mt19937 rng(1);
+  std::vector<std::unique_ptr<zrl::Image>> textures;
+  VkDeviceSize texture_size = 0;
+  for (uint32_t i = 0; i < kTextureCount; ++i) {
+    const uint32_t size =
+        64u << std::uniform_int_distribution<int>(0, 3)(rng);
+    textures.push_back(CreateTexture(core, size));
+    texture_size += textures.back()->GetSize();
+  }
+  std::vector<std::unique_ptr<zrl::Buffer>> buffers;
+  VkDeviceSize buffer_size = 0;
+  for (uint32_t i = 0; i < kBufferCount; ++i) {
+    const VkDeviceSize size =
+        std::uniform_int_distribution<VkDeviceSize>(1, 256 * zrl::_1KB)(rng);
+    buffers.push_back(std::make_unique<zrl::Buffer>(
+        core, size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT));
+    buffer_size += size;
+  }
+
+  const zrl::DeviceMemoryStats loaded = allocator.GetStats();
+  LOG(INFO) << "DeviceMemoryAllocatorTest: loaded: " << loaded << "\n";
+  CHECK(loaded.allocation_count ==
+            before.allocation_count + kTextureCount + kBufferCount,
+        "every resource must be one allocation");
+  // The textures and the buffers may each fill their last block and spill
+  // alignment padding into one more.
+  const VkDeviceSize max_new_blocks =
+      BlocksFor(texture_size) + BlocksFor(buffer_size) + 2;
+  CHECK(loaded.memory_object_count <=
+            before.memory_object_count + max_new_blocks,
+        "resources are not sub-allocated: " << loaded.memory_object_count
+                                            << " memory objects");
+
+  // Replacing every other texture by one of the same size must fit in the
+  // holes, without new memory objects.
+  std::vector<uint32_t> sizes;
+  for (uint32_t i = 0; i < kTextureCount; i += 2) {
+    sizes.push_back(textures[i]->GetExtent().width);
+    textures[i].reset();
+  }
+  const zrl::DeviceMemoryStats holes = allocator.GetStats();
+  LOG(INFO) << "DeviceMemoryAllocatorTest: holes: " << holes << "\n";
+  CHECK(holes.fragmentation > 0.0f,
+        "freeing every other texture must leave holes");
+  for (uint32_t i = 0; i < kTextureCount; i += 2) {
+    textures[i] = CreateTexture(core, sizes[i / 2]);
+  }
+  const zrl::DeviceMemoryStats refilled = allocator.GetStats();
+  LOG(INFO) << "DeviceMemoryAllocatorTest: refilled: " << refilled << "\n";
+  CHECK(refilled.memory_object_count <= loaded.memory_object_count,
+        "freed ranges are not reused");
+  CHECK(refilled.fragmentation <= holes.fragmentation,
+        "refilling the holes must not increase fragmentation");
+
+  textures.clear();
+  buffers.clear();
+  const zrl::DeviceMemoryStats released = allocator.GetStats();
+  LOG(INFO) << "DeviceMemoryAllocatorTest: released: " << released << "\n";
+  CHECK(released.allocation_count == before.allocation_count,
+        "allocations leaked");
+  // One empty block is kept per pool, for buffers and for images.
+  CHECK(released.memory_object_count <= before.memory_object_count + 2,
+        "empty blocks are not released");
+
+  LOG(INFO) << "DeviceMemoryAllocatorTest: passed\n";
+  zrl::FlushLog();
+  return 0;
+}
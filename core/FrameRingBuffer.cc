@@ -0,0 +1,87 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/FrameRingBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "core/Log.h"
+
+namespace zrl {
+
+static inline VkDeviceSize Align(VkDeviceSize size, VkDeviceSize alignment) {
+  return (size - 1) - ((size - 1) % alignment) + alignment;
+}
+
+static VkDeviceSize OffsetAlignment(const Core &core,
+                                    VkBufferUsageFlags usage) {
+  const VkPhysicalDeviceLimits limits =
+      core.GetLogicalDevice().GetPhysicalDevice().GetProperties().limits;
+  VkDeviceSize alignment = 16;
+  if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+    alignment = std::max(alignment, limits.minUniformBufferOffsetAlignment);
+  }
+  if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+    alignment = std::max(alignment, limits.minStorageBufferOffsetAlignment);
+  }
+  return alignment;
+}
+
+FrameRingBuffer::FrameRingBuffer(const Core &core, VkDeviceSize frame_size,
+                                 uint32_t frame_count,
+                                 VkBufferUsageFlags usage)
+    : Buffer(core,
+             Align(frame_size, OffsetAlignment(core, usage)) * frame_count,
+             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+             usage),
+      alignment_(OffsetAlignment(core, usage)),
+      frame_size_(Align(frame_size, alignment_)), frame_count_(frame_count),
+      mapped_(nullptr), offset_(0), end_(frame_size_) {
+  CHECK_PC(frame_size > 0, "frame_size must be positive");
+  CHECK_PC(frame_count > 0, "frame_count must be positive");
+  mapped_ = allocator_.Map(allocation_);
+}
+
+FrameRingBuffer::~FrameRingBuffer() { allocator_.Unmap(allocation_); }
+
+void FrameRingBuffer::BeginFrame(uint32_t frame, VkFence fence) {
+  if (fence != VK_NULL_HANDLE) {
+    CHECK_VK(vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX));
+  }
+  offset_ = (frame % frame_count_) * frame_size_;
+  end_ = offset_ + frame_size_;
+}
+
+VkDeviceSize FrameRingBuffer::Alloc(VkDeviceSize size, void **dst) {
+  CHECK_PC(size > 0, "size must be positive");
+  CHECK_PC(offset_ + size <= end_, "frame segment overflow");
+  const VkDeviceSize cur_offset = offset_;
+  if (dst != nullptr) {
+    *dst = reinterpret_cast<char *>(mapped_) + cur_offset;
+  }
+  offset_ = std::min(Align(offset_ + size, alignment_), end_);
+  return cur_offset;
+}
+
+VkDeviceSize FrameRingBuffer::Push(VkDeviceSize size, const void *data) {
+  CHECK_PC(data != nullptr, "data cannot be nullptr");
+  void *dst = nullptr;
+  const VkDeviceSize offset = Alloc(size, &dst);
+  std::memcpy(dst, data, size);
+  return offset;
+}
+
+} // namespace zrl
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_FRAME_RING_BUFFER_H_
+#define ZRL_CORE_FRAME_RING_BUFFER_H_
+
+#include "vulkan/vulkan.h"
+
+#include "core/Buffer.h"
+#include "core/Core.h"
+
+namespace zrl {
+
+// A persistently mapped buffer for data that is rewritten every frame, such as
+// per-object uniforms. The buffer is split into one segment per frame in
+// flight and allocation within a segment is a pointer bump, aligned so that
+// every returned offset can be used as a dynamic uniform buffer offset. A
+// segment is reset as a whole when its frame comes around again.
+class FrameRingBuffer final : public Buffer {
+public:
+  FrameRingBuffer(const Core &core, VkDeviceSize frame_size,
+                  uint32_t frame_count, VkBufferUsageFlags usage);
+  ~FrameRingBuffer();
+
+  // Starts writing the segment of the given frame, discarding its previous
+  // contents. If fence is not VK_NULL_HANDLE, it must be the fence of the
+  // last submission that read from this segment and is waited on first.
+  void BeginFrame(uint32_t frame, VkFence fence);
+  // Reserves size bytes in the current segment and returns their offset in
+  // the buffer. If dst is not nullptr, it receives the mapped address.
+  VkDeviceSize Alloc(VkDeviceSize size, void **dst);
+  VkDeviceSize Push(VkDeviceSize size, const void *data);
+
+  uint32_t GetFrameCount() const { return frame_count_; }
+  VkDeviceSize GetFrameSize() const { return frame_size_; }
+  VkDeviceSize GetAlignment() const { return alignment_; }
+
+private:
+  const VkDeviceSize alignment_;
+  const VkDeviceSize frame_size_;
+  const uint32_t frame_count_;
+  void *mapped_;
+  VkDeviceSize offset_;
+  VkDeviceSize end_;
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_FRAME_RING_BUFFER_H_
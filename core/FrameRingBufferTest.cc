@@ -0,0 +1,135 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Tests FrameRingBuffer: every offset is aligned for dynamic uniform
+// buffers and stays in the segment of its frame, a full segment fails the
+// next allocation, and BeginFrame() wraps around the segments and resets
+// them. Needs a Vulkan device for the buffer.
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "core/Core.h"
+#include "core/FrameRingBuffer.h"
+#include "core/Log.h"
+
+namespace {
+
+constexpr VkDeviceSize kFrameSize = 4096 + 100;
+constexpr uint32_t kFrameCount = 3;
+
+// Checks that the allocations of a frame are aligned, do not overlap, stay
+// within the frame's segment and point into the mapped buffer at their
+// offset.
+void CheckFrame(zrl::FrameRingBuffer &ring, uint32_t frame, uint8_t *base) {
+  const VkDeviceSize segment = (frame % kFrameCount) * ring.GetFrameSize();
+  ring.BeginFrame(frame, VK_NULL_HANDLE);
+  VkDeviceSize end = segment;
+  for (VkDeviceSize size : {1, 17, 64, 255, 256, 1000}) {
+    void *dst = nullptr;
+    const VkDeviceSize offset = ring.Alloc(size, &dst);
+    CHECK(offset % ring.GetAlignment() == 0,
+          "offset " << offset << " is not aligned to "
+                    << ring.GetAlignment());
+    CHECK(offset >= end, "offset " << offset << " overlaps the previous "
+                                   << "allocation, which ends at " << end);
+    CHECK(offset + size <= segment + ring.GetFrameSize(),
+          "allocation at " << offset << " leaves frame " << frame);
+    CHECK(static_cast<uint8_t *>(dst) == base + offset,
+          "mapped address does not match offset " << offset);
+    end = offset + size;
+  }
+  // Push copies the data at its offset.
+  const std::vector<uint8_t> data(40, static_cast<uint8_t>(frame));
+  const VkDeviceSize offset = ring.Push(data.size(), data.data());
+  CHECK(std::memcmp(base + offset, data.data(), data.size()) == 0,
+        "Push did not copy its data");
+}
+
+// Fills the segment of frame 0, which must hold exactly its size, and
+// allocates past it. This must fail rather than spill into the next frame.
+void Overflow(zrl::FrameRingBuffer &ring) {
+  ring.BeginFrame(0, VK_NULL_HANDLE);
+  for (VkDeviceSize used = 0; used < ring.GetFrameSize();
+       used += ring.GetAlignment()) {
+    ring.Alloc(ring.GetAlignment(), nullptr);
+  }
+  ring.Alloc(1, nullptr);
+}
+
+} // namespace
+
+// With --overflow, only runs Overflow(), which is expected to abort. The
+// test runs itself that way to check it.
+int main(int argc, char *argv[]) {
+  const bool overflow = argc == 2 && std::string(argv[1]) == "--overflow";
+  const zrl::Config config{/* app_name */ "frame_ring_buffer_test",
+                           /* engine_name */ "zrl",
+                           /* width */ 64,
+                           /* height */ 64,
+                           /* fullscreen*/ false,
+                           /* debug*/ true,
+                           /* pipeline_cache_path */ "",
+                           /* headless */ true};
+  zrl::Core core(config);
+  zrl::FrameRingBuffer ring(core, kFrameSize, kFrameCount,
+                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+  if (overflow) {
+    Overflow(ring);
+    return 0;
+  }
+  const VkPhysicalDeviceLimits limits =
+      core.GetLogicalDevice().GetPhysicalDevice().GetProperties().limits;
+  CHECK(ring.GetAlignment() % limits.minUniformBufferOffsetAlignment == 0,
+        "alignment " << ring.GetAlignment() << " is not a multiple of "
+                     << limits.minUniformBufferOffsetAlignment);
+  CHECK(ring.GetFrameSize() >= kFrameSize &&
+            ring.GetFrameSize() % ring.GetAlignment() == 0,
+        "frame size " << ring.GetFrameSize());
+
+  // The buffer is mapped from its start, where frame 0 allocates first.
+  void *dst = nullptr;
+  ring.BeginFrame(0, VK_NULL_HANDLE);
+  CHECK(ring.Alloc(1, &dst) == 0, "frame 0 does not start the buffer");
+  auto *base = static_cast<uint8_t *>(dst);
+
+  // Twice around the ring, and back to frames already written, which start
+  // over at the beginning of their segment.
+  for (uint32_t frame = 0; frame < 2 * kFrameCount + 1; ++frame) {
+    CheckFrame(ring, frame, base);
+  }
+  CheckFrame(ring, 1, base);
+
+  // The fence of the last submission reading a segment is waited on.
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  VkFence fence = VK_NULL_HANDLE;
+  const VkDevice device = core.GetLogicalDevice().GetHandle();
+  CHECK_VK(vkCreateFence(device, &fence_info, nullptr, &fence));
+  ring.BeginFrame(kFrameCount + 2, fence);
+  CHECK(ring.Alloc(1, nullptr) == 2 * ring.GetFrameSize(),
+        "frame " << kFrameCount + 2 << " does not start its segment");
+  vkDestroyFence(device, fence, nullptr);
+
+  const std::string command = "\"" + std::string(argv[0]) + "\" --overflow";
+  CHECK(std::system(command.c_str()) != 0,
+        "allocating from a full segment did not fail");
+  LOG(INFO) << "FrameRingBufferTest: passed\n";
+  zrl::FlushLog();
+  return 0;
+}
@@ -27,7 +27,8 @@ Image::Image(const Core &core, VkExtent3D extent, uint32_t levels,
              VkImageUsageFlags usage, VkSampleCountFlagBits samples,
              VkMemoryPropertyFlags mem_prop_flags,
              VkImageAspectFlags aspect_mask)
-    : device_(core.GetLogicalDevice().GetHandle()), extent_(extent),
+    : device_(core.GetLogicalDevice().GetHandle()),
+      allocator_(core.GetDeviceMemoryAllocator()), extent_(extent),
       levels_(levels), layers_(layers), format_(format), view_type_(view_type),
       aspect_mask_(aspect_mask) {
 
@@ -57,13 +58,11 @@ Image::Image(const Core &core, VkExtent3D extent, uint32_t levels,
   vkGetImageMemoryRequirements(device_, image_, &mem_reqs);
   size_ = mem_reqs.size;
 
-  VkMemoryAllocateInfo alloc_info = {};
-  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  alloc_info.allocationSize = mem_reqs.size;
-  alloc_info.memoryTypeIndex =
-      core.FindMemoryType(mem_reqs.memoryTypeBits, mem_prop_flags);
-  CHECK_VK(vkAllocateMemory(device_, &alloc_info, nullptr, &memory_));
-  CHECK_VK(vkBindImageMemory(device_, image_, memory_, 0));
+  allocation_ = allocator_.Alloc(
+      mem_reqs, core.FindMemoryType(mem_reqs.memoryTypeBits, mem_prop_flags),
+      /* linear */ tiling == VK_IMAGE_TILING_LINEAR);
+  CHECK_VK(vkBindImageMemory(device_, image_, allocation_.memory,
+                             allocation_.offset));
 
   VkImageViewCreateInfo view_create_info = {};
   view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -81,7 +80,7 @@ Image::Image(const Core &core, VkExtent3D extent, uint32_t levels,
 Image::~Image() {
   vkDestroyImageView(device_, view_, nullptr);
   vkDestroyImage(device_, image_, nullptr);
-  vkFreeMemory(device_, memory_, nullptr);
+  allocator_.Free(allocation_);
 }
 
 std::unique_ptr<Image> Image::Image1D(const Core &core, uint32_t extent,
@@ -20,6 +20,7 @@
 #include "vulkan/vulkan.h"
 
 #include "core/Core.h"
+#include "core/DeviceMemoryAllocator.h"
 
 namespace zrl {
 
@@ -68,6 +69,7 @@ public:
 
 private:
   const VkDevice device_;
+  DeviceMemoryAllocator &allocator_;
   const VkExtent3D extent_;
   const uint32_t levels_;
   const uint32_t layers_;
@@ -77,7 +79,7 @@ private:
   const VkImageAspectFlags aspect_mask_;
   VkDeviceSize size_;
   VkImage image_;
-  VkDeviceMemory memory_;
+  DeviceAllocation allocation_;
   VkImageView view_;
 };
 
@@ -0,0 +1,200 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/Log.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace zrl {
+
+// Must be a power of 2.
+constexpr size_t kLogSlots = 4096;
+// The writer thread is not woken up by each message, it polls at this period.
+constexpr auto kLogDrainPeriod = std::chrono::milliseconds(5);
+
+static const char *kLogPrefixes[] = {
+    "\033[0;32mdebug: ",
+    "\033[0minfo: ",
+    "\033[0;33mwarn: ",
+    "\033[0;31merror: ",
+};
+
+// Cleared once the sink is destroyed at exit, after which messages, from
+// other static destructors, are written synchronously.
+static std::atomic<bool> sink_alive(false);
+
+namespace {
+
+// Bounded multi-producer queue of messages, drained by a single thread. Each
+// slot carries a sequence number telling whether it is free for the producer
+// of a given position or ready for the consumer, so that producers only
+// contend on a fetch of the enqueue position.
+class LogSink {
+public:
+  LogSink()
+      : enqueue_pos_(0), dequeue_pos_(0), written_pos_(0), dropped_(0),
+        stop_(false) {
+    for (size_t i = 0; i < kLogSlots; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    sink_alive = true;
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~LogSink() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    sink_alive = false;
+  }
+
+  void Push(LogLevel level, std::string text) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot = &slots_[pos & (kLogSlots - 1)];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Full: the writer is behind by a whole ring.
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->level = level;
+    slot->text = std::move(text);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  // Writes a message synchronously, once all the queued ones are written.
+  void WriteNow(LogLevel level, const std::string &text) {
+    Flush();
+    std::lock_guard<std::mutex> lock(out_mu_);
+    Write(level, text);
+    std::clog.flush();
+  }
+
+  void Flush() {
+    const size_t target = enqueue_pos_.load(std::memory_order_acquire);
+    while (written_pos_.load(std::memory_order_acquire) < target) {
+      cv_.notify_one();
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    LogLevel level;
+    std::string text;
+  };
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    for (;;) {
+      lock.unlock();
+      const bool drained = Drain();
+      lock.lock();
+      if (stop_ && drained) {
+        return;
+      }
+      cv_.wait_for(lock, kLogDrainPeriod);
+    }
+  }
+
+  // Returns whether the queue was found empty.
+  bool Drain() {
+    std::lock_guard<std::mutex> lock(out_mu_);
+    for (;;) {
+      const size_t pos = dequeue_pos_;
+      Slot &slot = slots_[pos & (kLogSlots - 1)];
+      if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        break;
+      }
+      Write(slot.level, slot.text);
+      slot.text.clear();
+      slot.sequence.store(pos + kLogSlots, std::memory_order_release);
+      dequeue_pos_ = pos + 1;
+      written_pos_.store(pos + 1, std::memory_order_release);
+    }
+    const size_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      Write(LogLevel::kWarning,
+            "Log: dropped " + std::to_string(dropped) + " messages\n");
+    }
+    std::clog.flush();
+    return enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_;
+  }
+
+  static void Write(LogLevel level, const std::string &text) {
+    std::clog << kLogPrefixes[static_cast<int>(level)] << text;
+  }
+
+  Slot slots_[kLogSlots];
+  std::atomic<size_t> enqueue_pos_;
+  size_t dequeue_pos_;
+  std::atomic<size_t> written_pos_;
+  std::atomic<size_t> dropped_;
+
+  std::mutex out_mu_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_;
+  std::thread thread_;
+};
+
+LogSink &GetLogSink() {
+  static LogSink sink;
+  return sink;
+}
+
+} // namespace
+
+LogMessage::~LogMessage() {
+  LogSink &sink = GetLogSink();
+  if (!sink_alive) {
+    std::clog << kLogPrefixes[static_cast<int>(level_)] << stream_.str();
+    return;
+  }
+  if (level_ == LogLevel::kError) {
+    sink.WriteNow(level_, stream_.str());
+  } else {
+    sink.Push(level_, stream_.str());
+  }
+}
+
+void FlushLog() {
+  if (sink_alive) {
+    GetLogSink().Flush();
+  }
+}
+
+} // namespace zrl
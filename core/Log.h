@@ -18,28 +18,68 @@
 #define ZRL_CORE_LOG_H
 
 #include <iostream>
+#include <sstream>
 
 #include "vulkan/vulkan.h"
 
 #include "core/Constants.h"
+#include "core/Trace.h"
 
 namespace zrl {
 
-#define DEBUG "\033[0;32mdebug: "
-#define INFO "\033[0minfo: "
-#define WARNING "\033[0;33mwarn: "
-#define ERROR "\033[0;31merror: "
+enum class LogLevel { kDebug = 0, kInfo = 1, kWarning = 2, kError = 3 };
 
-#define LOG(l) std::clog << (l)
+#define DEBUG ::zrl::LogLevel::kDebug
+#define INFO ::zrl::LogLevel::kInfo
+#define WARNING ::zrl::LogLevel::kWarning
+#define ERROR ::zrl::LogLevel::kError
 
+// Messages below this level are compiled out: the condition in LOG is a
+// constant, so the formatting code of a disabled LOG is never emitted.
+// Defaults to DEBUG, and INFO in NDEBUG builds.
+#ifndef ZRL_MIN_LOG_LEVEL
 #ifdef NDEBUG
-#define DLOG                                                                   \
-  if (false)                                                                   \
-  LOG(DEBUG)
+#define ZRL_MIN_LOG_LEVEL 1
 #else
-#define DLOG LOG(DEBUG)
+#define ZRL_MIN_LOG_LEVEL 0
+#endif
 #endif
 
+// Formats a message and hands it to a background thread that writes it to
+// std::clog, so that logging does not block on the terminal. Errors are
+// written synchronously, after everything logged before them, since they
+// usually precede an abort.
+class LogMessage {
+public:
+  explicit LogMessage(LogLevel level) : level_(level) {}
+  ~LogMessage();
+
+  LogMessage(const LogMessage &) = delete;
+  LogMessage(LogMessage &&) = delete;
+
+  std::ostream &stream() { return stream_; }
+
+private:
+  const LogLevel level_;
+  std::ostringstream stream_;
+};
+
+// Blocks until all the messages logged so far have been written.
+void FlushLog();
+
+#define LOG(l)                                                                 \
+  if (static_cast<int>(l) < ZRL_MIN_LOG_LEVEL) {                               \
+  } else                                                                       \
+    ::zrl::LogMessage(l).stream()
+
+#define DLOG LOG(DEBUG)
+
+// Records the enclosing scope as a span of the trace, see core/Trace.h.
+#define ZRL_TRACE_CONCAT_(a, b) a##b
+#define ZRL_TRACE_CONCAT(a, b) ZRL_TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name)                                                      \
+  zrl::TraceScope ZRL_TRACE_CONCAT(trace_scope_, __LINE__)("zrl", name)
+
 #define CHECK_GENERAL(condition, msg)                                          \
   if (!(condition)) {                                                          \
     LOG(ERROR) << __FILE__ << ":" << __LINE__ << ": " << (#condition) << ": "  \
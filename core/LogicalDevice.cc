@@ -25,17 +25,27 @@ LogicalDevice::LogicalDevice(
     const std::vector<const char *> &required_layers,
     const std::vector<const char *> &required_device_extensions)
     : physical_device_(physical_device), gct_queue_family_(kInvalidQueueFamily),
-      present_queue_family_(kInvalidQueueFamily), gct_queue_(VK_NULL_HANDLE),
-      present_queue_(VK_NULL_HANDLE) {
+      present_queue_family_(kInvalidQueueFamily),
+      transfer_queue_family_(kInvalidQueueFamily),
+      compute_queue_family_(kInvalidQueueFamily), gct_queue_(VK_NULL_HANDLE),
+      present_queue_(VK_NULL_HANDLE), transfer_queue_(VK_NULL_HANDLE),
+      compute_queue_(VK_NULL_HANDLE) {
+  // Without a surface, there is nothing to present to and the gct family is
+  // used for it.
+  auto supports_present = [&](uint32_t queue_family) {
+    return surface == VK_NULL_HANDLE ||
+           physical_device_.SupportsPresent(queue_family, surface);
+  };
   auto queue_families = physical_device_.GetQueueFamilies();
-  uint32_t queue_family = 0;
-  for (const auto &prop : queue_families) {
+  for (uint32_t queue_family = 0; queue_family < queue_families.size();
+       ++queue_family) {
+    const auto &prop = queue_families[queue_family];
     if (prop.queueCount == 0) {
       continue;
     }
     if ((prop.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
         (prop.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
-        physical_device_.SupportsPresent(queue_family, surface)) {
+        supports_present(queue_family)) {
       gct_queue_family_ = queue_family;
       present_queue_family_ = queue_family;
       break;
@@ -44,20 +54,45 @@ LogicalDevice::LogicalDevice(
                (prop.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
       gct_queue_family_ = queue_family;
     } else if (present_queue_family_ == kInvalidQueueFamily &&
-               physical_device_.SupportsPresent(queue_family, surface)) {
+               supports_present(queue_family)) {
       present_queue_family_ = queue_family;
     }
     if (gct_queue_family_ != kInvalidQueueFamily &&
         present_queue_family_ != kInvalidQueueFamily) {
       break;
     }
-    ++queue_family;
   }
   CHECK_PC(gct_queue_family_ != kInvalidQueueFamily,
            "no gct queue family found");
   CHECK_PC(present_queue_family_ != kInvalidQueueFamily,
            "no present queue family found");
 
+  // A transfer-only family usually maps to the DMA engines, which can copy
+  // while the gct queue renders.
+  transfer_queue_family_ = gct_queue_family_;
+  for (uint32_t queue_family = 0; queue_family < queue_families.size();
+       ++queue_family) {
+    const auto &prop = queue_families[queue_family];
+    if (prop.queueCount > 0 && (prop.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(prop.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+        !(prop.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+      transfer_queue_family_ = queue_family;
+      break;
+    }
+  }
+
+  // Same for an async compute family, which runs beside the gct queue.
+  compute_queue_family_ = gct_queue_family_;
+  for (uint32_t queue_family = 0; queue_family < queue_families.size();
+       ++queue_family) {
+    const auto &prop = queue_families[queue_family];
+    if (prop.queueCount > 0 && (prop.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(prop.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      compute_queue_family_ = queue_family;
+      break;
+    }
+  }
+
   std::set<uint32_t> unique_families = {
       gct_queue_family_,
       present_queue_family_,
@@ -65,8 +100,14 @@ LogicalDevice::LogicalDevice(
 
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
   float queue_priority = 1.0f;
-  for (int family : unique_families) {
+  for (uint32_t family : unique_families) {
     queue_families_.push_back(family);
+  }
+  // The transfer and compute families are not part of queue_families_, which
+  // lists the families that share swapchain images.
+  unique_families.insert(transfer_queue_family_);
+  unique_families.insert(compute_queue_family_);
+  for (uint32_t family : unique_families) {
     VkDeviceQueueCreateInfo queue_create_info = {};
     queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queue_create_info.queueFamilyIndex = family;
@@ -78,7 +119,12 @@ LogicalDevice::LogicalDevice(
   VkPhysicalDeviceFeatures device_features = {};
   device_features.fillModeNonSolid = true;
   device_features.samplerAnisotropy = true;
+  // Block compressed textures are used when the device can sample them, see
+  // SupportsSampledImage().
+  device_features.textureCompressionBC =
+      physical_device_.GetFeatures().textureCompressionBC;
   // TODO: make this configurable.
+  enabled_features_ = device_features;
 
   VkDeviceCreateInfo create_info = {};
   create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -96,10 +142,24 @@ LogicalDevice::LogicalDevice(
 
   vkGetDeviceQueue(device_, gct_queue_family_, 0, &gct_queue_);
   vkGetDeviceQueue(device_, present_queue_family_, 0, &present_queue_);
+  vkGetDeviceQueue(device_, transfer_queue_family_, 0, &transfer_queue_);
+  vkGetDeviceQueue(device_, compute_queue_family_, 0, &compute_queue_);
   CHECK_PC(gct_queue_ != VK_NULL_HANDLE, "no gct queue found");
   CHECK_PC(present_queue_ != VK_NULL_HANDLE, "no present queue found");
+  CHECK_PC(transfer_queue_ != VK_NULL_HANDLE, "no transfer queue found");
+  CHECK_PC(compute_queue_ != VK_NULL_HANDLE, "no compute queue found");
 }
 
 LogicalDevice::~LogicalDevice() { vkDestroyDevice(device_, nullptr); }
 
+bool LogicalDevice::SupportsSampledImage(VkFormat format) const {
+  if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+      format <= VK_FORMAT_BC7_SRGB_BLOCK &&
+      !enabled_features_.textureCompressionBC) {
+    return false;
+  }
+  return (physical_device_.GetFormatProperties(format).optimalTilingFeatures &
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
 } // namespace zrl
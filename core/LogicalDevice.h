@@ -43,18 +43,44 @@ public:
   std::vector<uint32_t> GetQueueFamilies() const { return queue_families_; }
   uint32_t GetGCTQueueFamily() const { return gct_queue_family_; }
   uint32_t GetPresentQueueFamily() const { return present_queue_family_; }
+  // The transfer queue belongs to a transfer-only family when the device has
+  // one, and is the gct queue otherwise.
+  uint32_t GetTransferQueueFamily() const { return transfer_queue_family_; }
+  // Likewise, the compute queue belongs to a compute family without graphics
+  // support when the device has one, and is the gct queue otherwise.
+  uint32_t GetComputeQueueFamily() const { return compute_queue_family_; }
   VkQueue GetGCTQueue() const { return gct_queue_; }
   VkQueue GetPresentQueue() const { return present_queue_; }
+  VkQueue GetTransferQueue() const { return transfer_queue_; }
+  VkQueue GetComputeQueue() const { return compute_queue_; }
   bool IsSingleQueue() const { return gct_queue_ == present_queue_; }
+  bool HasDedicatedTransferQueue() const {
+    return transfer_queue_family_ != gct_queue_family_;
+  }
+  bool HasDedicatedComputeQueue() const {
+    return compute_queue_family_ != gct_queue_family_;
+  }
+
+  const VkPhysicalDeviceFeatures &GetEnabledFeatures() const {
+    return enabled_features_;
+  }
+  // Whether optimally tiled images of format can be sampled, given the
+  // features the device was created with.
+  bool SupportsSampledImage(VkFormat format) const;
 
 private:
   VkDevice device_;
   PhysicalDevice physical_device_;
+  VkPhysicalDeviceFeatures enabled_features_;
   std::vector<uint32_t> queue_families_;
   uint32_t gct_queue_family_;
   uint32_t present_queue_family_;
+  uint32_t transfer_queue_family_;
+  uint32_t compute_queue_family_;
   VkQueue gct_queue_;
   VkQueue present_queue_;
+  VkQueue transfer_queue_;
+  VkQueue compute_queue_;
 };
 
 } // namespace zrl
@@ -0,0 +1,156 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "core/Log.h"
+
+namespace zrl {
+
+static uint64_t MappingGranularity() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwAllocationGranularity;
+#else
+  return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+MappedFile::MappedFile(const std::string &filename, bool populate)
+    : view_(nullptr), view_size_(0), data_(nullptr), size_(0),
+      file_size_(0) {
+  Map(filename, 0, 0, populate);
+}
+
+MappedFile::MappedFile(const std::string &filename, uint64_t offset,
+                       uint64_t size, bool populate)
+    : view_(nullptr), view_size_(0), data_(nullptr), size_(0),
+      file_size_(0) {
+  Map(filename, offset, size, populate);
+}
+
+MappedFile::~MappedFile() {
+  if (view_ == nullptr) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(view_);
+#else
+  munmap(view_, view_size_);
+#endif
+}
+
+void MappedFile::WillNeed(uint64_t offset, uint64_t size) const {
+  CHECK_PC(offset + size <= size_, "range out of bounds");
+  if (size == 0) {
+    return;
+  }
+#ifndef _WIN32
+  const uint64_t page_size = MappingGranularity();
+  const uint64_t begin = data_ - static_cast<const uint8_t *>(view_) + offset;
+  const uint64_t aligned_begin = begin - begin % page_size;
+  // Advice is only a hint, so failures are not worth reporting.
+  madvise(static_cast<uint8_t *>(view_) + aligned_begin,
+          begin + size - aligned_begin, MADV_WILLNEED);
+#endif
+}
+
+bool MappedFile::Exists(const std::string &filename) {
+#ifdef _WIN32
+  DWORD attrs = GetFileAttributesA(filename.c_str());
+  return attrs != INVALID_FILE_ATTRIBUTES &&
+         !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+}
+
+void MappedFile::Map(const std::string &filename, uint64_t offset,
+                     uint64_t size, bool populate) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  CHECK_PC(file != INVALID_HANDLE_VALUE, "cannot open file: " + filename);
+  LARGE_INTEGER file_size;
+  CHECK_PC(GetFileSizeEx(file, &file_size), "cannot stat file: " + filename);
+  file_size_ = static_cast<uint64_t>(file_size.QuadPart);
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_PC(fd >= 0, "cannot open file: " + filename);
+  struct stat st;
+  CHECK_PC(fstat(fd, &st) == 0, "cannot stat file: " + filename);
+  file_size_ = static_cast<uint64_t>(st.st_size);
+#endif
+  CHECK_PC(offset <= file_size_, "offset past the end of file: " + filename);
+  if (size == 0) {
+    size = file_size_ - offset;
+  }
+  CHECK_PC(offset + size <= file_size_,
+           "range past the end of file: " + filename);
+  size_ = size;
+
+  if (size_ > 0) {
+    const uint64_t view_offset = offset - offset % MappingGranularity();
+    view_size_ = offset + size_ - view_offset;
+#ifdef _WIN32
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CHECK_PC(mapping != nullptr, "cannot map file: " + filename);
+    view_ = MapViewOfFile(mapping, FILE_MAP_READ,
+                          static_cast<DWORD>(view_offset >> 32),
+                          static_cast<DWORD>(view_offset & 0xFFFFFFFF),
+                          static_cast<SIZE_T>(view_size_));
+    // The view keeps the mapping alive.
+    CloseHandle(mapping);
+    CHECK_PC(view_ != nullptr, "cannot map file: " + filename);
+    (void)populate;
+#else
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    view_ = mmap(nullptr, view_size_, PROT_READ, flags, fd,
+                 static_cast<off_t>(view_offset));
+    CHECK_PC(view_ != MAP_FAILED, "cannot map file: " + filename);
+    madvise(view_, view_size_, MADV_SEQUENTIAL);
+#endif
+    data_ = static_cast<const uint8_t *>(view_) + (offset - view_offset);
+  }
+
+#ifdef _WIN32
+  CloseHandle(file);
+#else
+  close(fd);
+#endif
+}
+
+} // namespace zrl
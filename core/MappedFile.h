@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_MAPPED_FILE_H_
+#define ZRL_CORE_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace zrl {
+
+// A read-only view of a file mapped into memory. The file is closed as soon
+// as it is mapped, and unmapped on destruction.
+//
+// If populate is set, the whole view is read in when mapping, where
+// supported. This avoids taking a page fault per page when the view is going
+// to be read in full anyway.
+class MappedFile {
+public:
+  // Maps the whole file.
+  explicit MappedFile(const std::string &filename, bool populate = false);
+  // Maps size bytes starting at offset. A size of zero maps up to the end of
+  // the file.
+  MappedFile(const std::string &filename, uint64_t offset, uint64_t size,
+             bool populate = false);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile(MappedFile &&) = delete;
+
+  const uint8_t *GetData() const { return data_; }
+  uint64_t GetSize() const { return size_; }
+  uint64_t GetFileSize() const { return file_size_; }
+
+  // Hints that the given range of the view is about to be read sequentially,
+  // so that the kernel starts reading it ahead.
+  void WillNeed(uint64_t offset, uint64_t size) const;
+
+  static bool Exists(const std::string &filename);
+
+private:
+  void Map(const std::string &filename, uint64_t offset, uint64_t size,
+           bool populate);
+
+  // The mapping starts at a page boundary at or before the requested offset.
+  void *view_;
+  uint64_t view_size_;
+  const uint8_t *data_;
+  uint64_t size_;
+  uint64_t file_size_;
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_MAPPED_FILE_H_
@@ -44,6 +44,12 @@ VkPhysicalDeviceMemoryProperties PhysicalDevice::GetMemoryProperties() const {
   return props;
 }
 
+VkPhysicalDeviceFeatures PhysicalDevice::GetFeatures() const {
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(physical_device_, &features);
+  return features;
+}
+
 std::vector<VkQueueFamilyProperties> PhysicalDevice::GetQueueFamilies() const {
   uint32_t queue_family_count;
   vkGetPhysicalDeviceQueueFamilyProperties(physical_device_,
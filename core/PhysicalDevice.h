@@ -33,6 +33,7 @@ public:
   std::string GetName() const;
   VkPhysicalDeviceProperties GetProperties() const;
   VkPhysicalDeviceMemoryProperties GetMemoryProperties() const;
+  VkPhysicalDeviceFeatures GetFeatures() const;
   std::vector<VkQueueFamilyProperties> GetQueueFamilies() const;
   VkSurfaceCapabilitiesKHR GetSurfaceCapabilities(VkSurfaceKHR) const;
   std::vector<VkSurfaceFormatKHR> GetSurfaceFormats(VkSurfaceKHR) const;
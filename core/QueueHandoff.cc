@@ -0,0 +1,269 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/QueueHandoff.h"
+
+#include <utility>
+
+#include "core/Log.h"
+
+namespace zrl {
+
+QueueHandoff::QueueHandoff(const LogicalDevice &device, VkQueue queue,
+                           uint32_t queue_family)
+    : device_(device.GetHandle()), queue_(queue), src_family_(queue_family),
+      dst_family_(device.GetGCTQueueFamily()), command_pool_(VK_NULL_HANDLE),
+      recording_(false), current_{} {
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = src_family_;
+  CHECK_VK(vkCreateCommandPool(device_, &pool_info, nullptr, &command_pool_));
+}
+
+QueueHandoff::~QueueHandoff() {
+  if (recording_) {
+    LOG(WARNING) << "QueueHandoff: submitting pending work on destruction\n";
+    Submit(VK_NULL_HANDLE);
+  }
+  // Besides the work submitted here, the gct submissions waiting on the
+  // semaphores must be done before they are destroyed.
+  CHECK_VK(vkDeviceWaitIdle(device_));
+  for (auto &batch : in_flight_) {
+    free_batches_.push_back(batch);
+  }
+  for (auto &batch : free_batches_) {
+    vkDestroyFence(device_, batch.fence, nullptr);
+    vkDestroySemaphore(device_, batch.semaphore, nullptr);
+  }
+  // Command buffers are freed along with the pool.
+  vkDestroyCommandPool(device_, command_pool_, nullptr);
+}
+
+void QueueHandoff::Submit(VkFence fence) { Submit({}, {}, fence); }
+
+void QueueHandoff::Submit(const std::vector<VkSemaphore> &wait_semaphores,
+                          const std::vector<VkPipelineStageFlags> &wait_stages,
+                          VkFence fence) {
+  CHECK_PC(wait_semaphores.size() == wait_stages.size(),
+           "each wait semaphore needs a wait stage");
+  if (!recording_) {
+    CHECK_PC(wait_semaphores.empty(), "nothing recorded to wait with");
+    if (fence != VK_NULL_HANDLE) {
+      CHECK_VK(vkQueueSubmit(queue_, 0, nullptr, fence));
+    }
+    return;
+  }
+  CHECK_VK(vkEndCommandBuffer(current_.cmd));
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount =
+      static_cast<uint32_t>(wait_semaphores.size());
+  submit_info.pWaitSemaphores = wait_semaphores.data();
+  submit_info.pWaitDstStageMask = wait_stages.data();
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &current_.cmd;
+  // A semaphore nobody waits on could never be signaled again.
+  submit_info.signalSemaphoreCount = current_.releases ? 1 : 0;
+  submit_info.pSignalSemaphores = &current_.semaphore;
+  CHECK_VK(vkQueueSubmit(queue_, 1, &submit_info, current_.fence));
+  // The batch keeps its own fence to know when it can be recycled, so the
+  // caller's fence goes in an empty submission, which signals once all the
+  // previous work on the queue has completed.
+  if (fence != VK_NULL_HANDLE) {
+    CHECK_VK(vkQueueSubmit(queue_, 0, nullptr, fence));
+  }
+
+  in_flight_.push_back(std::move(current_));
+  current_ = {};
+  recording_ = false;
+}
+
+void QueueHandoff::RecordAcquire(
+    VkCommandBuffer cmd, VkFence gct_fence,
+    std::vector<VkSemaphore> *wait_semaphores,
+    std::vector<VkPipelineStageFlags> *wait_stages) {
+  CHECK_PC(gct_fence != VK_NULL_HANDLE, "gct_fence cannot be VK_NULL_HANDLE");
+  CHECK_PC(vkGetFenceStatus(device_, gct_fence) == VK_NOT_READY,
+           "gct_fence must be unsignaled");
+  CHECK_PC(wait_semaphores != nullptr, "wait_semaphores cannot be nullptr");
+  CHECK_PC(wait_stages != nullptr, "wait_stages cannot be nullptr");
+  for (auto &batch : in_flight_) {
+    if (!batch.releases || batch.acquire_fence != VK_NULL_HANDLE) {
+      continue;
+    }
+    batch.acquire_fence = gct_fence;
+    const VkPipelineStageFlags stages =
+        batch.dst_stages != 0 ? batch.dst_stages
+                              : static_cast<VkPipelineStageFlags>(
+                                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    wait_semaphores->push_back(batch.semaphore);
+    wait_stages->push_back(stages);
+    if (batch.buffer_acquires.empty() && batch.image_acquires.empty()) {
+      continue;
+    }
+    // The source stages match the semaphore wait, so that the acquire is
+    // ordered after it.
+    vkCmdPipelineBarrier(
+        cmd, stages, stages, 0, 0, nullptr,
+        static_cast<uint32_t>(batch.buffer_acquires.size()),
+        batch.buffer_acquires.data(),
+        static_cast<uint32_t>(batch.image_acquires.size()),
+        batch.image_acquires.data());
+  }
+}
+
+void QueueHandoff::WaitIdle() {
+  for (const auto &batch : in_flight_) {
+    CHECK_VK(vkWaitForFences(device_, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+  }
+}
+
+VkCommandBuffer QueueHandoff::Recording() {
+  if (recording_) {
+    return current_.cmd;
+  }
+  Recycle();
+  if (!free_batches_.empty()) {
+    current_ = std::move(free_batches_.back());
+    free_batches_.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.pNext = nullptr;
+    alloc_info.commandPool = command_pool_;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    CHECK_VK(vkAllocateCommandBuffers(device_, &alloc_info, &current_.cmd));
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    CHECK_VK(vkCreateFence(device_, &fence_info, nullptr, &current_.fence));
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = nullptr;
+    semaphore_info.flags = 0;
+    CHECK_VK(vkCreateSemaphore(device_, &semaphore_info, nullptr,
+                               &current_.semaphore));
+  }
+  current_.buffer_acquires.clear();
+  current_.image_acquires.clear();
+  current_.dst_stages = 0;
+  current_.releases = false;
+  current_.acquire_fence = VK_NULL_HANDLE;
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  CHECK_VK(vkBeginCommandBuffer(current_.cmd, &begin_info));
+  recording_ = true;
+  return current_.cmd;
+}
+
+void QueueHandoff::Release(VkBufferMemoryBarrier barrier,
+                           VkPipelineStageFlags src_stage,
+                           VkPipelineStageFlags dst_stage) {
+  VkCommandBuffer cmd = Recording();
+  current_.dst_stages |= dst_stage;
+  current_.releases = true;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  if (!IsDedicated()) {
+    vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 1, &barrier,
+                         0, nullptr);
+    return;
+  }
+
+  // The destination access mask is ignored by the release, and the source one
+  // by the acquire.
+  const VkAccessFlags dst_access = barrier.dstAccessMask;
+  barrier.dstAccessMask = 0;
+  barrier.srcQueueFamilyIndex = src_family_;
+  barrier.dstQueueFamilyIndex = dst_family_;
+  vkCmdPipelineBarrier(cmd, src_stage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                       0, nullptr, 1, &barrier, 0, nullptr);
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = dst_access;
+  current_.buffer_acquires.push_back(barrier);
+}
+
+void QueueHandoff::Release(VkImageMemoryBarrier barrier,
+                           VkPipelineStageFlags src_stage,
+                           VkPipelineStageFlags dst_stage) {
+  VkCommandBuffer cmd = Recording();
+  current_.dst_stages |= dst_stage;
+  current_.releases = true;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  if (!IsDedicated()) {
+    vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr,
+                         1, &barrier);
+    return;
+  }
+
+  // The layout transition is part of the ownership transfer and must be
+  // identical in the release and the acquire.
+  const VkAccessFlags dst_access = barrier.dstAccessMask;
+  barrier.dstAccessMask = 0;
+  barrier.srcQueueFamilyIndex = src_family_;
+  barrier.dstQueueFamilyIndex = dst_family_;
+  vkCmdPipelineBarrier(cmd, src_stage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                       0, nullptr, 0, nullptr, 1, &barrier);
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = dst_access;
+  current_.image_acquires.push_back(barrier);
+}
+
+void QueueHandoff::Recycle() {
+  // A batch can be reused once its work completed and, if it signaled its
+  // semaphore, once the gct submission that waited on it completed too,
+  // which unsignaled it. RecordAcquire() requires an unsignaled gct fence,
+  // so a signaled one means that submission ran. A reset and resubmitted gct
+  // fence still works: its next signal also covers the earlier submissions
+  // on the gct queue.
+  for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+    Batch &batch = *it;
+    if (batch.releases && batch.acquire_fence == VK_NULL_HANDLE) {
+      ++it;
+      continue;
+    }
+    VkResult status = VK_SUCCESS;
+    if (batch.releases) {
+      status = vkGetFenceStatus(device_, batch.acquire_fence);
+    }
+    if (status == VK_SUCCESS) {
+      status = vkGetFenceStatus(device_, batch.fence);
+    }
+    if (status == VK_NOT_READY) {
+      ++it;
+      continue;
+    }
+    CHECK_VK(status);
+    CHECK_VK(vkResetFences(device_, 1, &batch.fence));
+    CHECK_VK(vkResetCommandBuffer(batch.cmd, 0));
+    free_batches_.push_back(std::move(batch));
+    it = in_flight_.erase(it);
+  }
+}
+
+} // namespace zrl
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_QUEUE_HANDOFF_H_
+#define ZRL_CORE_QUEUE_HANDOFF_H_
+
+#include <deque>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "core/LogicalDevice.h"
+
+namespace zrl {
+
+// Submits work on a queue other than the gct one and hands the resources it
+// writes over to the gct queue.
+//
+// When the queue belongs to another family, each submission releases those
+// resources and RecordAcquire() records the matching acquire barriers in a gct
+// command buffer, whose submission must also wait on the semaphores
+// RecordAcquire() returns. When it is the gct family itself, the same calls
+// work, and no ownership transfer takes place.
+//
+// Each submission that releases resources signals a binary semaphore, which
+// is only signaled again once the gct submission that waited on it has
+// completed, as told by the fence given to RecordAcquire(). Submissions that
+// release nothing, such as work whose results are read by the host, signal
+// no semaphore and are reused as soon as they complete.
+//
+// Not thread-safe.
+class QueueHandoff {
+public:
+  virtual ~QueueHandoff();
+
+  QueueHandoff(const QueueHandoff &) = delete;
+  QueueHandoff(QueueHandoff &&) = delete;
+
+  // Submits the work recorded since the previous call, after waiting on the
+  // given semaphores, if any. If fence is not VK_NULL_HANDLE, it is signaled
+  // once the work completes.
+  void Submit(VkFence fence);
+  void Submit(const std::vector<VkSemaphore> &wait_semaphores,
+              const std::vector<VkPipelineStageFlags> &wait_stages,
+              VkFence fence);
+  // Records the acquire barriers of all submitted work into cmd, which must
+  // be executed on the gct queue by a submission that signals gct_fence, and
+  // appends to wait_semaphores and wait_stages what that submission must wait
+  // on. gct_fence must be unsignaled and not in use by a pending submission,
+  // so that its next signal comes from the submission executing cmd: reset it
+  // after waiting on it and before recording. It may be reused for later
+  // submissions, but must outlive the QueueHandoff.
+  void RecordAcquire(VkCommandBuffer cmd, VkFence gct_fence,
+                     std::vector<VkSemaphore> *wait_semaphores,
+                     std::vector<VkPipelineStageFlags> *wait_stages);
+  // Blocks until all submitted work has completed.
+  void WaitIdle();
+
+  VkQueue GetQueue() const { return queue_; }
+  uint32_t GetQueueFamily() const { return src_family_; }
+  bool IsDedicated() const { return src_family_ != dst_family_; }
+
+protected:
+  QueueHandoff(const LogicalDevice &device, VkQueue queue,
+               uint32_t queue_family);
+
+  // Returns the command buffer being recorded, beginning a new one if needed.
+  VkCommandBuffer Recording();
+  // Records a barrier from src_stage that makes the resource available to
+  // the gct queue at dst_stage with the barrier's dstAccessMask. The queue
+  // family indices of the barrier are filled in here.
+  void Release(VkBufferMemoryBarrier barrier, VkPipelineStageFlags src_stage,
+               VkPipelineStageFlags dst_stage);
+  void Release(VkImageMemoryBarrier barrier, VkPipelineStageFlags src_stage,
+               VkPipelineStageFlags dst_stage);
+
+private:
+  struct Batch {
+    VkCommandBuffer cmd;
+    VkFence fence;
+    VkSemaphore semaphore;
+    std::vector<VkBufferMemoryBarrier> buffer_acquires;
+    std::vector<VkImageMemoryBarrier> image_acquires;
+    VkPipelineStageFlags dst_stages;
+    // Whether anything was released, in which case the submission signals
+    // semaphore.
+    bool releases;
+    // The fence of the gct submission waiting on semaphore, once recorded.
+    VkFence acquire_fence;
+  };
+
+  void Recycle();
+
+  const VkDevice device_;
+  const VkQueue queue_;
+  const uint32_t src_family_;
+  const uint32_t dst_family_;
+  VkCommandPool command_pool_;
+  bool recording_;
+  Batch current_;
+  std::deque<Batch> in_flight_;
+  std::vector<Batch> free_batches_;
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_QUEUE_HANDOFF_H_
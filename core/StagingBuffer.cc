@@ -14,64 +14,221 @@
 
 #include "core/StagingBuffer.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "core/Log.h"
+#include "core/MappedFile.h"
 
 namespace zrl {
 
+static constexpr VkDeviceSize kPushAlignment = 16;
+
 static inline VkDeviceSize Align(VkDeviceSize size, VkDeviceSize alignment) {
   return (size - 1) - ((size - 1) % alignment) + alignment;
 }
 
-StagingBuffer::StagingBuffer(const Core &core, VkDeviceSize size)
+static inline VkDeviceSize AlignDown(VkDeviceSize size,
+                                     VkDeviceSize alignment) {
+  return size - (size % alignment);
+}
+
+StagingBuffer::StagingBuffer(const Core &core, VkDeviceSize size, bool ring)
     : Buffer(core, size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
              VK_BUFFER_USAGE_TRANSFER_SRC_BIT),
       non_coherent_atom_size_(core.GetLogicalDevice()
                                   .GetPhysicalDevice()
                                   .GetProperties()
                                   .limits.nonCoherentAtomSize),
-      mapped_(nullptr), offset_(0) {
-  CHECK_VK(vkMapMemory(device_, memory_, 0, size_, 0, &mapped_));
+      ring_(ring), mapped_(nullptr), offset_(0), head_(0), tail_(0),
+      flushed_(0), retired_(0) {
+  CHECK_ARG(!ring_ || size % kPushAlignment == 0,
+            "ring size must be a multiple of 16");
+  mapped_ = allocator_.Map(allocation_);
 }
 
-StagingBuffer::~StagingBuffer() { vkUnmapMemory(device_, memory_); }
+StagingBuffer::~StagingBuffer() {
+  // The memory and the fences can only go once the GPU is done with them.
+  while (ReleaseSegment(/* wait */ true)) {
+  }
+  for (auto fence : free_fences_) {
+    vkDestroyFence(device_, fence, nullptr);
+  }
+  allocator_.Unmap(allocation_);
+}
 
 VkDeviceSize StagingBuffer::PushData(VkDeviceSize size, const void *data) {
   CHECK_PC(size > 0, "size must be positive");
-  CHECK_PC(offset_ + size <= size_, "buffer overflow");
   CHECK_PC(data != nullptr, "data cannot be nullptr");
-  VkDeviceSize cur_offset = offset_;
-  std::memcpy(reinterpret_cast<char *>(mapped_) + offset_, data, size);
-  offset_ = Align(offset_ + size, 16);
+  VkDeviceSize cur_offset = Reserve(size);
+  std::memcpy(reinterpret_cast<char *>(mapped_) + cur_offset, data, size);
   return cur_offset;
 }
 
 VkDeviceSize StagingBuffer::PushFile(VkDeviceSize size,
                                      const std::string &filename) {
+  return PushFile(size, filename, 0);
+}
+
+VkDeviceSize StagingBuffer::PushFile(VkDeviceSize size,
+                                     const std::string &filename,
+                                     uint64_t file_offset) {
+  CHECK_PC(size > 0, "size must be positive");
+  // Only the requested range is mapped, and it is read in while mapping, so
+  // the copy below does not fault page by page.
+  MappedFile file(filename, file_offset, size, /* populate */ true);
+  VkDeviceSize cur_offset = Reserve(size);
+  std::memcpy(reinterpret_cast<char *>(mapped_) + cur_offset, file.GetData(),
+              size);
+  return cur_offset;
+}
+
+VkDeviceSize StagingBuffer::PushInPlace(VkDeviceSize size, void **data) {
   CHECK_PC(size > 0, "size must be positive");
-  CHECK_PC(offset_ + size <= size_, "buffer overflow");
-  VkDeviceSize cur_offset = offset_;
-  std::FILE *f = std::fopen(filename.c_str(), "rb");
-  CHECK_PC(
-      std::fread(reinterpret_cast<char *>(mapped_) + offset_, size, 1, f) == 1,
-      "error reading from file");
-  offset_ = Align(offset_ + size, 16);
+  CHECK_PC(data != nullptr, "data cannot be nullptr");
+  VkDeviceSize cur_offset = Reserve(size);
+  *data = reinterpret_cast<char *>(mapped_) + cur_offset;
   return cur_offset;
 }
 
 void StagingBuffer::Flush() {
+  TRACE_SCOPE("StagingBuffer::Flush");
+  if (ring_) {
+    FlushRange(flushed_, head_);
+    flushed_ = head_;
+    return;
+  }
   if (offset_ == 0) {
     return;
   }
-  VkMappedMemoryRange range = {};
-  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-  range.pNext = nullptr;
-  range.memory = memory_;
-  range.offset = 0;
-  range.size = Align(offset_, non_coherent_atom_size_);
-  CHECK_VK(vkFlushMappedMemoryRanges(device_, 1, &range));
+  FlushRange(0, offset_);
   offset_ = 0;
 }
 
+VkFence StagingBuffer::Retire() {
+  CHECK_PC(ring_, "Retire is only available in ring mode");
+  if (head_ == retired_) {
+    return VK_NULL_HANDLE;
+  }
+  Flush();
+
+  VkFence fence = VK_NULL_HANDLE;
+  if (!free_fences_.empty()) {
+    fence = free_fences_.back();
+    free_fences_.pop_back();
+  } else {
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+    CHECK_VK(vkCreateFence(device_, &fence_info, nullptr, &fence));
+  }
+  segments_.push_back({head_, fence});
+  retired_ = head_;
+  return fence;
+}
+
+bool StagingBuffer::CanPush(VkDeviceSize size) {
+  CHECK_PC(ring_, "CanPush is only available in ring mode");
+  while (!RingFits(size)) {
+    if (!ReleaseSegment(/* wait */ false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+VkDeviceSize StagingBuffer::Reserve(VkDeviceSize size) {
+  if (!ring_) {
+    CHECK_PC(offset_ + size <= size_, "buffer overflow");
+    VkDeviceSize cur_offset = offset_;
+    offset_ = Align(offset_ + size, kPushAlignment);
+    return cur_offset;
+  }
+
+  CHECK_PC(size <= size_, "data does not fit in the staging ring");
+  // Prefer reclaiming what has already completed, and only then block on the
+  // oldest transfer still in flight.
+  while (!RingFits(size)) {
+    if (ReleaseSegment(/* wait */ false)) {
+      continue;
+    }
+    CHECK_PC(ReleaseSegment(/* wait */ true),
+             "staging ring is full of data that was never retired");
+  }
+  const VkDeviceSize start = head_ + RingPadding(size);
+  head_ = Align(start + size, kPushAlignment);
+  return start % size_;
+}
+
+VkDeviceSize StagingBuffer::RingPadding(VkDeviceSize size) const {
+  // Pushes are contiguous, so the space left before the end of the buffer is
+  // skipped if it is too small.
+  const VkDeviceSize pos = head_ % size_;
+  return pos + size > size_ ? size_ - pos : 0;
+}
+
+bool StagingBuffer::RingFits(VkDeviceSize size) {
+  if (head_ == tail_ && head_ % size_ != 0) {
+    // The ring is empty: restart from the beginning of the buffer so that any
+    // push up to the full size fits.
+    head_ = tail_ = flushed_ = retired_ = Align(head_, size_);
+  }
+  return head_ + RingPadding(size) + Align(size, kPushAlignment) - tail_ <=
+         size_;
+}
+
+void StagingBuffer::FlushRange(VkDeviceSize begin, VkDeviceSize end) {
+  if (begin == end) {
+    return;
+  }
+  VkDeviceSize length = end - begin;
+  VkDeviceSize offsets[2] = {begin % size_, 0};
+  VkDeviceSize sizes[2] = {std::min(length, size_ - offsets[0]), 0};
+  sizes[1] = length - sizes[0];
+
+  VkMappedMemoryRange ranges[2] = {};
+  uint32_t range_count = 0;
+  for (int i = 0; i < 2; ++i) {
+    if (sizes[i] == 0) {
+      continue;
+    }
+    // Ranges must be aligned to nonCoherentAtomSize. The allocator pads host
+    // visible allocations accordingly, so rounding out stays within ours.
+    const VkDeviceSize first = AlignDown(offsets[i], non_coherent_atom_size_);
+    const VkDeviceSize last =
+        std::min(Align(offsets[i] + sizes[i], non_coherent_atom_size_),
+                 allocation_.size);
+    VkMappedMemoryRange &range = ranges[range_count++];
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.pNext = nullptr;
+    range.memory = allocation_.memory;
+    range.offset = allocation_.offset + first;
+    range.size = last - first;
+  }
+  CHECK_VK(vkFlushMappedMemoryRanges(device_, range_count, ranges));
+}
+
+bool StagingBuffer::ReleaseSegment(bool wait) {
+  if (segments_.empty()) {
+    return false;
+  }
+  const Segment segment = segments_.front();
+  if (wait) {
+    CHECK_VK(
+        vkWaitForFences(device_, 1, &segment.fence, VK_TRUE, UINT64_MAX));
+  } else {
+    VkResult status = vkGetFenceStatus(device_, segment.fence);
+    if (status == VK_NOT_READY) {
+      return false;
+    }
+    CHECK_VK(status);
+  }
+  CHECK_VK(vkResetFences(device_, 1, &segment.fence));
+  free_fences_.push_back(segment.fence);
+  tail_ = segment.end;
+  segments_.pop_front();
+  return true;
+}
+
 } // namespace zrl
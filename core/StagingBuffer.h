@@ -17,6 +17,9 @@
 #ifndef ZRL_CORE_STAGING_BUFFER_H_
 #define ZRL_CORE_STAGING_BUFFER_H_
 
+#include <deque>
+#include <vector>
+
 #include "vulkan/vulkan.h"
 
 #include "core/Buffer.h"
@@ -24,19 +27,72 @@
 
 namespace zrl {
 
+// A host-visible buffer used as the source of transfers to device-local
+// resources.
+//
+// By default the buffer is a bump allocator: pushes fail once it is full and
+// Flush() makes the data visible to the device and starts over from the
+// beginning, so the caller must wait for the transfers to complete before
+// pushing again.
+//
+// In ring mode, pushes wrap around and the space is only reclaimed once the
+// transfers that read it have completed. Data pushed since the last call to
+// Retire() belongs to a segment guarded by the fence returned by Retire(),
+// which must be signaled by the submission that consumes the data. When the
+// ring is full, a push waits for the oldest segments to be released, so
+// uploads of any total size can stream through a ring of fixed size.
 class StagingBuffer final : public Buffer {
 public:
-  StagingBuffer(const Core &core, VkDeviceSize size);
+  StagingBuffer(const Core &core, VkDeviceSize size, bool ring = false);
+  // Waits for the transfers reading the retired segments, so their fences
+  // must all have been submitted.
   ~StagingBuffer();
 
   VkDeviceSize PushData(VkDeviceSize size, const void *data);
   VkDeviceSize PushFile(VkDeviceSize size, const std::string &filename);
+  // Pushes size bytes of the file starting at file_offset. The file is
+  // memory-mapped and copied straight into the staging memory.
+  VkDeviceSize PushFile(VkDeviceSize size, const std::string &filename,
+                        uint64_t file_offset);
+  // Reserves size bytes for the caller to write in place through *data,
+  // before the next call to Flush() or Retire(). Returns their offset.
+  VkDeviceSize PushInPlace(VkDeviceSize size, void **data);
   void Flush();
 
+  // Ring mode only. Flushes the data pushed since the previous call and
+  // returns an unsignaled fence that must be passed to the submission reading
+  // it. Returns VK_NULL_HANDLE if nothing was pushed.
+  VkFence Retire();
+  // Ring mode only. Returns whether size bytes can be pushed without waiting,
+  // reclaiming the segments whose fences have already signaled.
+  bool CanPush(VkDeviceSize size);
+
+  bool IsRing() const { return ring_; }
+
 private:
+  struct Segment {
+    VkDeviceSize end;
+    VkFence fence;
+  };
+
+  VkDeviceSize Reserve(VkDeviceSize size);
+  VkDeviceSize RingPadding(VkDeviceSize size) const;
+  bool RingFits(VkDeviceSize size);
+  void FlushRange(VkDeviceSize begin, VkDeviceSize end);
+  bool ReleaseSegment(bool wait);
+
   const VkDeviceSize non_coherent_atom_size_;
+  const bool ring_;
   void *mapped_;
   VkDeviceSize offset_;
+  // Ring mode state. Positions grow monotonically and are reduced modulo the
+  // buffer size to get offsets, so that head_ - tail_ is the space in use.
+  VkDeviceSize head_;
+  VkDeviceSize tail_;
+  VkDeviceSize flushed_;
+  VkDeviceSize retired_;
+  std::deque<Segment> segments_;
+  std::vector<VkFence> free_fences_;
 };
 
 } // namespace zrl
@@ -16,6 +16,8 @@
 
 #include <limits>
 
+#include "core/Core.h"
+#include "core/Image.h"
 #include "core/Log.h"
 
 namespace zrl {
@@ -69,7 +71,8 @@ static VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR &capabilities,
 
 Swapchain::Swapchain(LogicalDevice &device, VkSurfaceKHR surface, int width,
                      int height)
-    : device_(device.GetHandle()) {
+    : device_(device.GetHandle()), queue_(device.GetGCTQueue()),
+      next_image_(0) {
   auto physical_device = device.GetPhysicalDevice();
   auto queue_families = device.GetQueueFamilies();
   auto surface_capabilities = physical_device.GetSurfaceCapabilities(surface);
@@ -120,6 +123,81 @@ Swapchain::Swapchain(LogicalDevice &device, VkSurfaceKHR surface, int width,
                           images_.data());
 }
 
-Swapchain::~Swapchain() { vkDestroySwapchainKHR(device_, swapchain_, nullptr); }
+Swapchain::Swapchain(const Core &core, uint32_t width, uint32_t height,
+                     uint32_t image_count)
+    : device_(core.GetLogicalDevice().GetHandle()),
+      queue_(core.GetLogicalDevice().GetGCTQueue()),
+      swapchain_(VK_NULL_HANDLE),
+      surface_format_{kPreferredColorFormat, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR},
+      extent_{width, height}, image_count_(image_count),
+      present_mode_(VK_PRESENT_MODE_IMMEDIATE_KHR), next_image_(0) {
+  CHECK_ARG(image_count_ > 0, "image_count must be positive");
+  for (uint32_t i = 0; i < image_count_; ++i) {
+    offscreen_images_.push_back(Image::Image2D(
+        core, extent_, 1, 1, surface_format_.format,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_SAMPLE_COUNT_1_BIT));
+    images_.push_back(offscreen_images_.back()->GetHandle());
+  }
+}
+
+Swapchain::~Swapchain() {
+  if (swapchain_ != VK_NULL_HANDLE) {
+    vkDestroySwapchainKHR(device_, swapchain_, nullptr);
+  }
+}
+
+VkResult Swapchain::AcquireNextImage(VkSemaphore semaphore, VkFence fence,
+                                     uint32_t *image_index) const {
+  CHECK_PC(image_index != nullptr, "image_index cannot be nullptr");
+  if (!IsHeadless()) {
+    return vkAcquireNextImageKHR(device_, swapchain_,
+                                 std::numeric_limits<uint64_t>::max(),
+                                 semaphore, fence, image_index);
+  }
+  *image_index = next_image_;
+  next_image_ = (next_image_ + 1) % image_count_;
+  if (semaphore == VK_NULL_HANDLE && fence == VK_NULL_HANDLE) {
+    return VK_SUCCESS;
+  }
+  // The image is ready as soon as the work previously submitted on the queue
+  // is done, which is what an empty submission signals.
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.signalSemaphoreCount = semaphore != VK_NULL_HANDLE ? 1 : 0;
+  submit_info.pSignalSemaphores = &semaphore;
+  return vkQueueSubmit(queue_, 1, &submit_info, fence);
+}
+
+VkResult Swapchain::Present(VkQueue queue, VkSemaphore wait_semaphore,
+                            uint32_t image_index) const {
+  CHECK_PC(image_index < image_count_, "image_index out of range");
+  if (!IsHeadless()) {
+    VkPresentInfoKHR present_info = {};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.pNext = nullptr;
+    present_info.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE ? 1 : 0;
+    present_info.pWaitSemaphores = &wait_semaphore;
+    present_info.swapchainCount = 1;
+    present_info.pSwapchains = &swapchain_;
+    present_info.pImageIndices = &image_index;
+    present_info.pResults = nullptr;
+    return vkQueuePresentKHR(queue, &present_info);
+  }
+  if (wait_semaphore == VK_NULL_HANDLE) {
+    return VK_SUCCESS;
+  }
+  // Nothing is displayed, but the semaphore must still be waited on so that
+  // it can be signaled again.
+  const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount = 1;
+  submit_info.pWaitSemaphores = &wait_semaphore;
+  submit_info.pWaitDstStageMask = &wait_stage;
+  return vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+}
 
 } // namespace zrl
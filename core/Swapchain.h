@@ -17,17 +17,41 @@
 #ifndef ZRL_SWAPCHAIN_H_
 #define ZRL_SWAPCHAIN_H_
 
+#include <memory>
+#include <vector>
+
 #include "vulkan/vulkan.h"
 
 #include "core/LogicalDevice.h"
 
 namespace zrl {
 
+class Core;
+class Image;
+
+// The images frames are rendered to before being presented.
+//
+// In headless mode there is no surface, and the swapchain is a set of
+// device-local images handed out in turn, so that frames can be rendered and
+// timed without a display. Code meant to run in both modes must acquire and
+// present through AcquireNextImage() and Present().
 class Swapchain {
 public:
   Swapchain(LogicalDevice &device, VkSurfaceKHR surface, int width, int height);
+  // Creates a headless swapchain of image_count images.
+  Swapchain(const Core &core, uint32_t width, uint32_t height,
+            uint32_t image_count);
   ~Swapchain();
 
+  // Acquires the next image to render to. semaphore and fence, if not
+  // VK_NULL_HANDLE, are signaled once the image can be written.
+  VkResult AcquireNextImage(VkSemaphore semaphore, VkFence fence,
+                            uint32_t *image_index) const;
+  // Presents the image on queue once wait_semaphore, if not VK_NULL_HANDLE,
+  // is signaled.
+  VkResult Present(VkQueue queue, VkSemaphore wait_semaphore,
+                   uint32_t image_index) const;
+
   VkSwapchainKHR GetHandle() const { return swapchain_; }
   VkFormat GetSurfaceFormat() const { return surface_format_.format; }
   VkColorSpaceKHR GetColorSpace() const { return surface_format_.colorSpace; }
@@ -38,15 +62,20 @@ public:
   uint32_t GetImageCount() const { return image_count_; }
   VkPresentModeKHR GetPresentMode() const { return present_mode_; }
   const std::vector<VkImage> &GetImages() const { return images_; }
+  bool IsHeadless() const { return swapchain_ == VK_NULL_HANDLE; }
 
 private:
   VkDevice device_;
+  VkQueue queue_;
   VkSwapchainKHR swapchain_;
   VkSurfaceFormatKHR surface_format_;
   VkExtent2D extent_;
   uint32_t image_count_;
   VkPresentModeKHR present_mode_;
   std::vector<VkImage> images_;
+  // Headless mode only.
+  std::vector<std::unique_ptr<Image>> offscreen_images_;
+  mutable uint32_t next_image_;
 };
 
 } // namespace zrl
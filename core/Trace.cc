@@ -0,0 +1,242 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/Trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "core/Log.h"
+
+namespace zrl {
+
+// 64K spans of 32 bytes, 2MB per recording thread.
+constexpr size_t kEventsPerThread = 1 << 16;
+// Track of the GPU spans, threads get the following ones.
+constexpr uint32_t kGpuTrack = 0;
+
+namespace {
+
+struct Event {
+  const char *category;
+  const char *name;
+  int64_t begin_ns;
+  int64_t duration_ns;
+};
+
+// Written only by its thread. The count is published after the event, so
+// that the writer of the trace sees complete events. Start() does not touch
+// the buffers: it bumps the generation of the registry, and each thread
+// clears its own buffer on its next span. The generation is published after
+// the count is cleared, so that the writer of the trace never sees spans of
+// a previous trace under the current generation.
+struct ThreadBuffer {
+  uint32_t track;
+  std::unique_ptr<Event[]> events;
+  std::atomic<size_t> count;
+  std::atomic<size_t> dropped;
+  std::atomic<uint64_t> generation;
+};
+
+// Buffers outlive their threads, so that their spans can still be written.
+struct Registry {
+  std::mutex mu;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::unique_ptr<ThreadBuffer> gpu;
+  std::unordered_set<std::string> interned;
+  int64_t start_ns = 0;
+  // Incremented by each Start().
+  std::atomic<uint64_t> generation{0};
+};
+
+Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+std::unique_ptr<ThreadBuffer> NewBuffer(uint32_t track) {
+  std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+  buffer->track = track;
+  buffer->events.reset(new Event[kEventsPerThread]);
+  buffer->count = 0;
+  buffer->dropped = 0;
+  buffer->generation = 0;
+  return buffer;
+}
+
+ThreadBuffer &GetThreadBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mu);
+    registry.buffers.push_back(
+        NewBuffer(static_cast<uint32_t>(registry.buffers.size()) + 1));
+    buffer = registry.buffers.back().get();
+  }
+  return *buffer;
+}
+
+void Append(ThreadBuffer &buffer, const Event &event) {
+  const uint64_t generation =
+      GetRegistry().generation.load(std::memory_order_acquire);
+  if (buffer.generation.load(std::memory_order_relaxed) != generation) {
+    buffer.count.store(0, std::memory_order_relaxed);
+    buffer.dropped.store(0, std::memory_order_relaxed);
+    buffer.generation.store(generation, std::memory_order_release);
+  }
+  const size_t count = buffer.count.load(std::memory_order_relaxed);
+  if (count == kEventsPerThread) {
+    buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer.events[count] = event;
+  buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void WriteJsonString(std::ostream &out, const char *s) {
+  out << '"';
+  for (; *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\') {
+      out << '\\' << *s;
+    } else if (static_cast<unsigned char>(*s) < 0x20) {
+      out << ' ';
+    } else {
+      out << *s;
+    }
+  }
+  out << '"';
+}
+
+void WriteTrackName(std::ostream &out, uint32_t track, const std::string &name,
+                    bool *first) {
+  out << (*first ? "\n" : ",\n");
+  *first = false;
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track
+      << ",\"args\":{\"name\":\"" << name << "\"}}";
+}
+
+// Returns the number of dropped spans. Buffers last written during a previous
+// trace are skipped.
+size_t WriteBuffer(std::ostream &out, const ThreadBuffer &buffer,
+                   uint64_t generation, int64_t start_ns, bool *first) {
+  if (buffer.generation.load(std::memory_order_acquire) != generation) {
+    return 0;
+  }
+  const size_t count = buffer.count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < count; ++i) {
+    const Event &event = buffer.events[i];
+    out << (*first ? "\n" : ",\n");
+    *first = false;
+    out << "{\"name\":";
+    WriteJsonString(out, event.name);
+    out << ",\"cat\":";
+    WriteJsonString(out, event.category);
+    out << ",\"ph\":\"X\",\"ts\":" << (event.begin_ns - start_ns) / 1000.0
+        << ",\"dur\":" << event.duration_ns / 1000.0
+        << ",\"pid\":1,\"tid\":" << buffer.track << "}";
+  }
+  return buffer.dropped.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+std::atomic<bool> Trace::enabled_(false);
+
+void Trace::Start() {
+  Registry &registry = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mu);
+    if (registry.gpu == nullptr) {
+      registry.gpu = NewBuffer(kGpuTrack);
+    }
+    registry.generation.fetch_add(1, std::memory_order_release);
+    registry.start_ns = Now();
+  }
+  enabled_.store(true, std::memory_order_release);
+  LOG(INFO) << "Trace: recording\n";
+}
+
+bool Trace::Stop(const std::string &filename) {
+  enabled_.store(false, std::memory_order_release);
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  if (registry.gpu == nullptr) {
+    LOG(WARNING) << "Trace: stopped without being started\n";
+    return false;
+  }
+  std::ofstream out(filename);
+  if (!out) {
+    LOG(WARNING) << "Trace: cannot write '" << filename << "'\n";
+    return false;
+  }
+
+  bool first = true;
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  WriteTrackName(out, kGpuTrack, "gpu", &first);
+  for (const auto &buffer : registry.buffers) {
+    WriteTrackName(out, buffer->track,
+                   "thread " + std::to_string(buffer->track), &first);
+  }
+  const uint64_t generation =
+      registry.generation.load(std::memory_order_relaxed);
+  size_t dropped = WriteBuffer(out, *registry.gpu, generation,
+                               registry.start_ns, &first);
+  for (const auto &buffer : registry.buffers) {
+    dropped +=
+        WriteBuffer(out, *buffer, generation, registry.start_ns, &first);
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  if (dropped > 0) {
+    LOG(WARNING) << "Trace: dropped " << dropped << " spans, buffers full\n";
+  }
+  LOG(INFO) << "Trace: wrote '" << filename << "'\n";
+  return static_cast<bool>(out);
+}
+
+int64_t Trace::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Trace::Complete(const char *category, const char *name, int64_t begin_ns,
+                     int64_t duration_ns) {
+  if (!IsEnabled()) {
+    return;
+  }
+  Append(GetThreadBuffer(), {category, name, begin_ns, duration_ns});
+}
+
+void Trace::CompleteGpu(const char *name, int64_t begin_ns,
+                        int64_t duration_ns) {
+  if (!IsEnabled()) {
+    return;
+  }
+  // GPU spans are read back by the thread driving the frame loop, so a single
+  // writer is assumed here as well.
+  Append(*GetRegistry().gpu, {"gpu", name, begin_ns, duration_ns});
+}
+
+const char *Trace::Intern(const std::string &name) {
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mu);
+  return registry.interned.insert(name).first->c_str();
+}
+
+} // namespace zrl
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_TRACE_H_
+#define ZRL_CORE_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace zrl {
+
+// Records timed spans into per-thread buffers and writes them in the Chrome
+// trace event format, which chrome://tracing and Perfetto can load.
+//
+// Recording is off until Start(). While off, a trace scope costs one relaxed
+// atomic load. While on, recording a span appends to a buffer owned by the
+// calling thread, without locks; when the buffer is full, spans are dropped.
+//
+// Names and categories are not copied, and must outlive the trace: use string
+// literals, or Intern() for names built at runtime.
+class Trace {
+public:
+  // Clears the recorded spans and starts recording.
+  static void Start();
+  // Stops recording and writes the spans recorded since Start() to filename.
+  // Spans still being recorded by other threads may be missed.
+  static bool Stop(const std::string &filename);
+
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Nanoseconds on the steady clock, the time base of all spans.
+  static int64_t Now();
+
+  // Records a span on the calling thread's track.
+  static void Complete(const char *category, const char *name, int64_t begin_ns,
+                       int64_t duration_ns);
+  // Records a span on the GPU track. The times must already be converted to
+  // the steady clock.
+  static void CompleteGpu(const char *name, int64_t begin_ns,
+                          int64_t duration_ns);
+
+  // Returns a copy of name that lives until the process exits.
+  static const char *Intern(const std::string &name);
+
+private:
+  static std::atomic<bool> enabled_;
+};
+
+// Records a span from its construction to its destruction.
+class TraceScope {
+public:
+  TraceScope(const char *category, const char *name)
+      : category_(category), name_(name),
+        begin_ns_(Trace::IsEnabled() ? Trace::Now() : -1) {}
+  ~TraceScope() {
+    if (begin_ns_ >= 0) {
+      Trace::Complete(category_, name_, begin_ns_, Trace::Now() - begin_ns_);
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope(TraceScope &&) = delete;
+
+private:
+  const char *category_;
+  const char *name_;
+  const int64_t begin_ns_;
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_TRACE_H_
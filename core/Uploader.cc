@@ -0,0 +1,93 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/Uploader.h"
+
+#include "core/Log.h"
+
+namespace zrl {
+
+Uploader::Uploader(const Core &core)
+    : Uploader(core, core.GetLogicalDevice().GetTransferQueue(),
+               core.GetLogicalDevice().GetTransferQueueFamily()) {}
+
+Uploader::Uploader(const Core &core, VkQueue queue, uint32_t queue_family)
+    : QueueHandoff(core.GetLogicalDevice(), queue, queue_family) {
+  DLOG << "Uploader: ctor: queue_family=" << GetQueueFamily()
+       << " dedicated=" << IsDedicated() << "\n";
+}
+
+void Uploader::CopyBuffer(VkBuffer src, VkDeviceSize src_offset, VkBuffer dst,
+                          VkDeviceSize dst_offset, VkDeviceSize size,
+                          VkAccessFlags dst_access,
+                          VkPipelineStageFlags dst_stage) {
+  CHECK_PC(size > 0, "size must be positive");
+  VkCommandBuffer cmd = Recording();
+
+  VkBufferCopy region = {};
+  region.srcOffset = src_offset;
+  region.dstOffset = dst_offset;
+  region.size = size;
+  vkCmdCopyBuffer(cmd, src, dst, 1, &region);
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = dst_access;
+  barrier.buffer = dst;
+  barrier.offset = dst_offset;
+  barrier.size = size;
+  Release(barrier, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage);
+}
+
+void Uploader::CopyBufferToImage(VkBuffer src,
+                                 const std::vector<VkBufferImageCopy> &regions,
+                                 const Image &dst, VkImageLayout final_layout,
+                                 VkAccessFlags dst_access,
+                                 VkPipelineStageFlags dst_stage) {
+  CHECK_PC(!regions.empty(), "regions cannot be empty");
+  VkCommandBuffer cmd = Recording();
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = dst.GetHandle();
+  barrier.subresourceRange.aspectMask = dst.GetAspects();
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = dst.GetLevelCount();
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = dst.GetLayerCount();
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  vkCmdCopyBufferToImage(cmd, src, dst.GetHandle(),
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()), regions.data());
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = final_layout;
+  Release(barrier, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage);
+}
+
+} // namespace zrl
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZRL_CORE_UPLOADER_H_
+#define ZRL_CORE_UPLOADER_H_
+
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "core/Core.h"
+#include "core/Image.h"
+#include "core/QueueHandoff.h"
+
+namespace zrl {
+
+// Records copies out of staging buffers and submits them on the transfer
+// queue, so that uploads overlap with rendering on the gct queue. The
+// destination resources are handed over to the gct queue as described in
+// QueueHandoff.
+class Uploader final : public QueueHandoff {
+public:
+  explicit Uploader(const Core &core);
+  // Submits on queue, of queue_family, instead of the transfer queue. Given
+  // the gct queue, no ownership transfer takes place.
+  Uploader(const Core &core, VkQueue queue, uint32_t queue_family);
+
+  // Copies size bytes from src into dst. dst_access and dst_stage describe
+  // how dst is first used on the gct queue.
+  void CopyBuffer(VkBuffer src, VkDeviceSize src_offset, VkBuffer dst,
+                  VkDeviceSize dst_offset, VkDeviceSize size,
+                  VkAccessFlags dst_access, VkPipelineStageFlags dst_stage);
+  // Copies regions from src into dst, whose previous contents are discarded,
+  // and leaves it in final_layout.
+  void CopyBufferToImage(VkBuffer src,
+                         const std::vector<VkBufferImageCopy> &regions,
+                         const Image &dst, VkImageLayout final_layout,
+                         VkAccessFlags dst_access,
+                         VkPipelineStageFlags dst_stage);
+};
+
+} // namespace zrl
+
+#endif // ZRL_CORE_UPLOADER_H_
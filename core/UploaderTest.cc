@@ -0,0 +1,236 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Tests Uploader: a buffer and an image uploaded through it are acquired by
+// a gct submission, which copies them to a host-visible buffer whose contents
+// are checked. Runs once on the transfer queue, which takes the dedicated path
+// if the device has a separate transfer family, and once on the gct queue,
+// which is the single-family fallback. Needs a Vulkan device.
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "core/Buffer.h"
+#include "core/Core.h"
+#include "core/Image.h"
+#include "core/Log.h"
+#include "core/StagingBuffer.h"
+#include "core/Uploader.h"
+
+namespace {
+
+constexpr VkDeviceSize kBufferSize = 1000;
+constexpr uint32_t kImageSize = 16;
+constexpr VkDeviceSize kImageBytes = kImageSize * kImageSize * 4;
+// Each Uploader uploads several times, so that its batches and the gct fence
+// get reused.
+constexpr uint32_t kRounds = 3;
+
+// A buffer the gct queue copies the uploaded resources into for the host to
+// read.
+class ReadbackBuffer final : public zrl::Buffer {
+public:
+  ReadbackBuffer(const zrl::Core &core, VkDeviceSize size)
+      : Buffer(core, size,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
+    mapped_ = allocator_.Map(allocation_);
+  }
+  ~ReadbackBuffer() { allocator_.Unmap(allocation_); }
+
+  const uint8_t *GetData() const { return static_cast<uint8_t *>(mapped_); }
+
+private:
+  void *mapped_;
+};
+
+std::vector<uint8_t> Pattern(VkDeviceSize size, uint32_t seed) {
+  std::vector<uint8_t> data(size);
+  for (VkDeviceSize i = 0; i < size; ++i) {
+    data[i] = static_cast<uint8_t>(i * 7 + seed * 31 + 1);
+  }
+  return data;
+}
+
+void Upload(const zrl::Core &core, zrl::Uploader &uploader,
+            VkCommandPool command_pool, VkFence gct_fence, uint32_t round) {
+  const VkDevice device = core.GetLogicalDevice().GetHandle();
+  const std::vector<uint8_t> image_data = Pattern(kImageBytes, 2 * round);
+  const std::vector<uint8_t> buffer_data = Pattern(kBufferSize, 2 * round + 1);
+
+  zrl::StagingBuffer staging(core, kImageBytes + kBufferSize);
+  const VkDeviceSize image_offset =
+      staging.PushData(image_data.size(), image_data.data());
+  const VkDeviceSize buffer_offset =
+      staging.PushData(buffer_data.size(), buffer_data.data());
+  staging.Flush();
+
+  zrl::Buffer buffer(
+      core, kBufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  auto image = zrl::Image::Image2D(
+      core, {kImageSize, kImageSize}, 1, 1, VK_FORMAT_R8G8B8A8_UNORM,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      VK_SAMPLE_COUNT_1_BIT);
+
+  uploader.CopyBuffer(staging.GetHandle(), buffer_offset, buffer.GetHandle(),
+                      0, kBufferSize, VK_ACCESS_TRANSFER_READ_BIT,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT);
+  VkBufferImageCopy region = {};
+  region.bufferOffset = image_offset;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {kImageSize, kImageSize, 1};
+  uploader.CopyBufferToImage(staging.GetHandle(), {region}, *image,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_ACCESS_TRANSFER_READ_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT);
+  uploader.Submit(VK_NULL_HANDLE);
+
+  // The gct side: acquire both resources and copy them back.
+  ReadbackBuffer readback(core, kImageBytes + kBufferSize);
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.commandPool = command_pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  VkCommandBuffer cmd = VK_NULL_HANDLE;
+  CHECK_VK(vkAllocateCommandBuffers(device, &alloc_info, &cmd));
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  CHECK_VK(vkBeginCommandBuffer(cmd, &begin_info));
+
+  // The fence signaled for the previous round, which let the uploader reuse
+  // the batch it acquired when copying above. It must be unsignaled again.
+  CHECK_VK(vkResetFences(device, 1, &gct_fence));
+  std::vector<VkSemaphore> wait_semaphores;
+  std::vector<VkPipelineStageFlags> wait_stages;
+  uploader.RecordAcquire(cmd, gct_fence, &wait_semaphores, &wait_stages);
+  // One submission released both resources.
+  CHECK(wait_semaphores.size() == 1 && wait_stages.size() == 1,
+        "waiting on " << wait_semaphores.size() << " semaphores");
+
+  VkBufferImageCopy image_region = region;
+  image_region.bufferOffset = 0;
+  vkCmdCopyImageToBuffer(cmd, image->GetHandle(),
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         readback.GetHandle(), 1, &image_region);
+  VkBufferCopy buffer_region = {};
+  buffer_region.srcOffset = 0;
+  buffer_region.dstOffset = kImageBytes;
+  buffer_region.size = kBufferSize;
+  vkCmdCopyBuffer(cmd, buffer.GetHandle(), readback.GetHandle(), 1,
+                  &buffer_region);
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  CHECK_VK(vkEndCommandBuffer(cmd));
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.waitSemaphoreCount =
+      static_cast<uint32_t>(wait_semaphores.size());
+  submit_info.pWaitSemaphores = wait_semaphores.data();
+  submit_info.pWaitDstStageMask = wait_stages.data();
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  submit_info.signalSemaphoreCount = 0;
+  submit_info.pSignalSemaphores = nullptr;
+  CHECK_VK(vkQueueSubmit(core.GetLogicalDevice().GetGCTQueue(), 1,
+                         &submit_info, gct_fence));
+  CHECK_VK(vkWaitForFences(device, 1, &gct_fence, VK_TRUE, UINT64_MAX));
+  vkFreeCommandBuffers(device, command_pool, 1, &cmd);
+
+  CHECK(std::memcmp(readback.GetData(), image_data.data(), kImageBytes) == 0,
+        "round " << round << ": image contents differ");
+  CHECK(std::memcmp(readback.GetData() + kImageBytes, buffer_data.data(),
+                    kBufferSize) == 0,
+        "round " << round << ": buffer contents differ");
+  // The staging buffer must outlive the transfers reading it.
+  uploader.WaitIdle();
+}
+
+void Run(const zrl::Core &core, zrl::Uploader &uploader) {
+  const VkDevice device = core.GetLogicalDevice().GetHandle();
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  pool_info.queueFamilyIndex = core.GetLogicalDevice().GetGCTQueueFamily();
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  CHECK_VK(vkCreateCommandPool(device, &pool_info, nullptr, &command_pool));
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  VkFence gct_fence = VK_NULL_HANDLE;
+  CHECK_VK(vkCreateFence(device, &fence_info, nullptr, &gct_fence));
+
+  for (uint32_t round = 0; round < kRounds; ++round) {
+    Upload(core, uploader, command_pool, gct_fence, round);
+  }
+
+  uploader.WaitIdle();
+  vkDestroyFence(device, gct_fence, nullptr);
+  vkDestroyCommandPool(device, command_pool, nullptr);
+}
+
+} // namespace
+
+int main() {
+  const zrl::Config config{/* app_name */ "uploader_test",
+                           /* engine_name */ "zrl",
+                           /* width */ 64,
+                           /* height */ 64,
+                           /* fullscreen*/ false,
+                           /* debug*/ true,
+                           /* pipeline_cache_path */ "",
+                           /* headless */ true};
+  zrl::Core core(config);
+  const zrl::LogicalDevice &device = core.GetLogicalDevice();
+
+  {
+    zrl::Uploader uploader(core);
+    if (!uploader.IsDedicated()) {
+      LOG(WARNING) << "No dedicated transfer queue family, only the "
+                   << "single-family path is tested\n";
+    }
+    Run(core, uploader);
+  }
+  {
+    zrl::Uploader uploader(core, device.GetGCTQueue(),
+                           device.GetGCTQueueFamily());
+    CHECK(!uploader.IsDedicated(), "the gct queue is not the fallback");
+    Run(core, uploader);
+  }
+  return 0;
+}
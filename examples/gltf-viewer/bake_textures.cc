@@ -0,0 +1,162 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Bakes the images of a glTF model into textures with a precomputed mip
+// chain, next to the model, which gltf-viewer maps instead of decoding the
+// images and building their mip chains at startup.
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "core/Log.h"
+#include "tiny_gltf.h"
+#include "util/baked_texture.h"
+#include "util/hash.h"
+#include "util/mipmap.h"
+#include "util/thread_pool.h"
+#include "vulkan/vulkan.h"
+
+// How an image is sampled by the materials that use it.
+enum class ImageRole { kUnused, kColor, kNormal, kOcclusion, kData };
+
+static bool StoreEncodedImage(tinygltf::Image *, const int image_idx,
+                              std::string *, std::string *, int, int,
+                              const unsigned char *bytes, int size,
+                              void *user_data) {
+  auto *encoded =
+      static_cast<std::vector<std::vector<unsigned char>> *>(user_data);
+  if (encoded->size() <= static_cast<size_t>(image_idx)) {
+    encoded->resize(image_idx + 1);
+  }
+  (*encoded)[image_idx].assign(bytes, bytes + size);
+  return true;
+}
+
+static std::vector<ImageRole> GetImageRoles(const tinygltf::Model &model) {
+  std::vector<ImageRole> roles(model.images.size(), ImageRole::kUnused);
+  auto use = [&](int texture, ImageRole role) {
+    if (texture == -1) {
+      return;
+    }
+    ImageRole &current = roles[model.textures[texture].source];
+    // Images with several roles, such as occlusion packed with metallic and
+    // roughness, are baked as plain data.
+    current = current == ImageRole::kUnused || current == role
+                  ? role
+                  : ImageRole::kData;
+  };
+  for (const auto &mat : model.materials) {
+    use(mat.pbrMetallicRoughness.baseColorTexture.index, ImageRole::kColor);
+    use(mat.emissiveTexture.index, ImageRole::kColor);
+    use(mat.normalTexture.index, ImageRole::kNormal);
+    use(mat.occlusionTexture.index, ImageRole::kOcclusion);
+    use(mat.pbrMetallicRoughness.metallicRoughnessTexture.index,
+        ImageRole::kData);
+  }
+  return roles;
+}
+
+static void Bake(const std::string &path, const std::vector<uint8_t> &encoded,
+                 ImageRole role) {
+  int width, height, channels;
+  stbi_uc *pixels =
+      stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()),
+                            &width, &height, &channels, STBI_rgb_alpha);
+  CHECK_PC(pixels != nullptr, "failed to decode image for " + path);
+
+  MipFilter filter = MipFilter::kLinear;
+  if (role == ImageRole::kColor) {
+    filter = MipFilter::kSrgb;
+  } else if (role == ImageRole::kNormal) {
+    filter = MipFilter::kNormal;
+  }
+  const uint32_t level_count = MipLevelCount(width, height);
+  std::vector<BakedTexture::Level> levels(level_count);
+  levels[0] = {static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+               std::vector<uint8_t>(pixels, pixels + 4 * width * height)};
+  stbi_image_free(pixels);
+  for (uint32_t level = 1; level < level_count; ++level) {
+    const BakedTexture::Level &prev = levels[level - 1];
+    BakedTexture::Level &cur = levels[level];
+    cur.width = MipLevelSize(prev.width, 1);
+    cur.height = MipLevelSize(prev.height, 1);
+    cur.data.resize(4 * cur.width * cur.height);
+    DownsampleRGBA8(prev.data.data(), prev.width, prev.height, filter,
+                    cur.data.data());
+  }
+
+  CHECK_PC(BakedTexture::Write(path, VK_FORMAT_R8G8B8A8_UNORM,
+                               HashBytes(encoded.data(), encoded.size()),
+                               levels),
+           "failed to bake " + path);
+  LOG(INFO) << "bake_textures: baked '" << path << "': width=" << width
+            << " height=" << height << " levels=" << level_count << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    LOG(ERROR) << "usage: bake_textures <gltf_file>\n";
+    return -1;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const std::string filename = argv[1];
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::vector<std::vector<unsigned char>> encoded;
+  loader.SetImageLoader(StoreEncodedImage, &encoded);
+  std::string err;
+  std::string warn;
+  const bool binary = filename.size() >= 4 &&
+                      filename.compare(filename.size() - 4, 4, ".glb") == 0;
+  const bool ret =
+      binary ? loader.LoadBinaryFromFile(&model, &err, &warn, filename)
+             : loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+  if (!warn.empty()) {
+    LOG(WARNING) << warn << "\n";
+  }
+  if (!err.empty()) {
+    LOG(ERROR) << err << "\n";
+  }
+  if (!ret) {
+    LOG(ERROR) << "failed to parse glTF\n";
+    return -1;
+  }
+  encoded.resize(model.images.size());
+
+  const std::string base_dir = tinygltf::GetBaseDir(filename);
+  const std::vector<ImageRole> roles = GetImageRoles(model);
+  ThreadPool pool;
+  std::vector<std::future<void>> baked;
+  for (size_t image = 0; image < model.images.size(); ++image) {
+    if (roles[image] == ImageRole::kUnused || encoded[image].empty()) {
+      continue;
+    }
+    const std::string path = BakedTexture::PathFor(
+        base_dir, model.images[image].uri, static_cast<int>(image));
+    baked.push_back(pool.Submit([&, image, path] {
+      Bake(path, encoded[image], roles[image]);
+    }));
+  }
+  for (auto &result : baked) {
+    result.get();
+  }
+  LOG(INFO) << "bake_textures: baked " << baked.size() << " images in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "ms\n";
+  return 0;
+}
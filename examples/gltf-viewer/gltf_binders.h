@@ -17,6 +17,26 @@
 #ifndef GLTF_BINDERS_H_
 #define GLTF_BINDERS_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "core/LogicalDevice.h"
+#include "core/MappedFile.h"
+#include "util/baked_texture.h"
+#include "util/hash.h"
+#include "util/mesh_optimizer.h"
+#include "util/thread_pool.h"
+
 namespace zrl {
 namespace support {
 namespace gltf {
@@ -69,24 +89,418 @@ template <int Type> constexpr const char *TypeString() {
   }
 }
 
+// Bytes of the buffers of a model.
+//
+// A .glb file is memory-mapped, and the buffer stored in its BIN chunk is
+// read from the mapping instead of being copied into model.buffers by
+// tinygltf, so that accessors point straight into the page cache and the
+// geometry is only copied once, into the staging buffer. Only the images
+// stored in the chunk are copied, as the image loader needs them anyway.
+class ModelBuffers {
+public:
+  ModelBuffers() = default;
+  ModelBuffers(const ModelBuffers &) = delete;
+  ModelBuffers(ModelBuffers &&) = delete;
+
+  // Loads a .gltf or a .glb file into model.
+  bool Load(tinygltf::TinyGLTF &loader, const std::string &filename,
+            tinygltf::Model *model, std::string *err, std::string *warn) {
+    if (filename.size() < 4 ||
+        filename.compare(filename.size() - 4, 4, ".glb") != 0) {
+      return loader.LoadASCIIFromFile(model, err, warn, filename);
+    }
+    if (!MappedFile::Exists(filename)) {
+      *err = "cannot open '" + filename + "'";
+      return false;
+    }
+    file_.reset(new MappedFile(filename));
+    const unsigned char *data = file_->GetData();
+    const size_t size = file_->GetSize();
+    const std::string base_dir = tinygltf::GetBaseDir(filename);
+
+    // A 12 bytes header is followed by a JSON chunk and an optional BIN
+    // chunk, each starting with its length and type. header holds the former
+    // and the start of the JSON chunk.
+    uint32_t header[5];
+    if (size < sizeof(header)) {
+      *err = "'" + filename + "' is not a glTF binary";
+      return false;
+    }
+    std::memcpy(header, data, sizeof(header));
+    if (header[0] != kGlbMagic || header[2] < sizeof(header) ||
+        header[2] > size ||
+        header[3] > header[2] - sizeof(header) || header[4] != kJsonChunk) {
+      *err = "'" + filename + "' is not a glTF binary";
+      return false;
+    }
+    const size_t bin_chunk = sizeof(header) + header[3];
+    uint32_t chunk[2];
+    if (bin_chunk + sizeof(chunk) <= header[2]) {
+      std::memcpy(chunk, data + bin_chunk, sizeof(chunk));
+      if (chunk[1] == kBinChunk &&
+          chunk[0] <= header[2] - bin_chunk - sizeof(chunk)) {
+        bin_ = data + bin_chunk + sizeof(chunk);
+        bin_size_ = chunk[0];
+      }
+    }
+    nlohmann::json json = nlohmann::json::parse(
+        data + sizeof(header), data + bin_chunk, nullptr, false);
+    if (bin_ == nullptr || json.is_discarded() ||
+        !json["buffers"].is_array() || json["buffers"].empty() ||
+        json["buffers"][0].count("uri") != 0) {
+      // Nothing to map, tinygltf reports the errors if any.
+      bin_ = nullptr;
+      return loader.LoadBinaryFromMemory(model, err, warn, data,
+                                         static_cast<unsigned int>(size),
+                                         base_dir);
+    }
+    if (json["buffers"][0].value("byteLength", size_t(0)) > bin_size_) {
+      *err = "the BIN chunk of '" + filename + "' is too short";
+      return false;
+    }
+
+    // tinygltf is handed a BIN chunk that only holds the images, with their
+    // buffer views moved accordingly.
+    std::vector<unsigned char> images;
+    std::set<size_t> moved_views;
+    nlohmann::json &views = json["bufferViews"];
+    for (const nlohmann::json &image : json["images"]) {
+      if (!image.count("bufferView") || !views.is_array()) {
+        continue;
+      }
+      const size_t index = image["bufferView"].get<size_t>();
+      if (index >= views.size() || views[index].value("buffer", -1) != 0 ||
+          !moved_views.insert(index).second) {
+        continue;
+      }
+      nlohmann::json &view = views[index];
+      const size_t offset = view.value("byteOffset", size_t(0));
+      const size_t length = view.value("byteLength", size_t(0));
+      if (offset > bin_size_ || length > bin_size_ - offset) {
+        *err = "an image buffer view of '" + filename + "' is out of range";
+        return false;
+      }
+      view["byteOffset"] = images.size();
+      images.insert(images.end(), bin_ + offset, bin_ + offset + length);
+      images.resize((images.size() + 3) & ~size_t(3));
+    }
+    // tinygltf rejects empty BIN chunks.
+    images.resize(std::max(images.size(), size_t(4)));
+    json["buffers"][0]["byteLength"] = images.size();
+
+    std::string text = json.dump();
+    text.resize((text.size() + 3) & ~size_t(3), ' ');
+    std::vector<unsigned char> glb(sizeof(header) + text.size() +
+                                   sizeof(chunk) + images.size());
+    header[2] = static_cast<uint32_t>(glb.size());
+    header[3] = static_cast<uint32_t>(text.size());
+    chunk[0] = static_cast<uint32_t>(images.size());
+    chunk[1] = kBinChunk;
+    unsigned char *out = glb.data();
+    std::memcpy(out, header, sizeof(header));
+    out = std::copy(text.begin(), text.end(), out + sizeof(header));
+    std::memcpy(out, chunk, sizeof(chunk));
+    std::copy(images.begin(), images.end(), out + sizeof(chunk));
+    if (!loader.LoadBinaryFromMemory(model, err, warn, glb.data(),
+                                     static_cast<unsigned int>(glb.size()),
+                                     base_dir)) {
+      return false;
+    }
+    // The image loader has taken its copy of the images.
+    std::vector<unsigned char>().swap(model->buffers[0].data);
+    return true;
+  }
+
+  const unsigned char *GetData(const tinygltf::Model &model,
+                               int buffer) const {
+    return buffer == 0 && bin_ != nullptr ? bin_
+                                          : model.buffers[buffer].data.data();
+  }
+
+  // Returns the elements of an accessor tightly packed, as the renderer
+  // binds each attribute as its own stream. The elements of interleaved
+  // buffer views are gathered, and sparse accessors densified, once per
+  // accessor. Both are kept for as long as the buffers.
+  const unsigned char *GetPackedData(const tinygltf::Model &model,
+                                     int accessor) const {
+    const tinygltf::Accessor &a = model.accessors[accessor];
+    const size_t element_size =
+        tinygltf::GetComponentSizeInBytes(a.componentType) *
+        tinygltf::GetTypeSizeInBytes(a.type);
+    const unsigned char *src = nullptr;
+    size_t stride = element_size;
+    if (a.bufferView >= 0) {
+      const tinygltf::BufferView &view = model.bufferViews[a.bufferView];
+      src = GetData(model, view.buffer) + view.byteOffset + a.byteOffset;
+      if (view.byteStride != 0) {
+        stride = view.byteStride;
+      }
+      if (stride == element_size && !a.sparse.isSparse) {
+        return src;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<unsigned char> &packed = packed_[accessor];
+    if (packed.empty()) {
+      // Accessors without a buffer view start as zeros.
+      packed.assign(a.count * element_size, 0);
+      for (size_t i = 0; src != nullptr && i < a.count; ++i) {
+        std::memcpy(&packed[i * element_size], src + i * stride,
+                    element_size);
+      }
+      if (a.sparse.isSparse) {
+        ApplySparse(model, a, element_size, packed.data());
+      }
+    }
+    return packed.data();
+  }
+
+  // Returns the indices of an accessor in a type Vulkan can read, widening
+  // 8 bit indices to 16 bits once.
+  const unsigned char *GetIndexData(const tinygltf::Model &model,
+                                    int accessor,
+                                    VkIndexType &index_type) const {
+    const tinygltf::Accessor &a = model.accessors[accessor];
+    const unsigned char *src = GetPackedData(model, accessor);
+    switch (a.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      index_type = VK_INDEX_TYPE_UINT16;
+      return src;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      index_type = VK_INDEX_TYPE_UINT32;
+      return src;
+    }
+    CHECK_PC(a.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,
+             "indices must be unsigned integers");
+    index_type = VK_INDEX_TYPE_UINT16;
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<uint16_t> &widened = widened_[accessor];
+    if (widened.size() != a.count) {
+      widened.assign(src, src + a.count);
+    }
+    return reinterpret_cast<const unsigned char *>(widened.data());
+  }
+
+  // A primitive whose triangles and vertices were reordered by
+  // OptimizePrimitives().
+  struct OptimizedPrimitive {
+    VkIndexType index_type;
+    uint32_t index_count;
+    std::vector<unsigned char> indices;
+    uint32_t vertex_count;
+    // The reordered elements of each attribute, by accessor.
+    std::map<int, std::vector<unsigned char>> attributes;
+  };
+
+  // Reorders the triangles of the indexed triangle lists of model for the
+  // post-transform vertex cache, then their vertices in the order they are
+  // fetched, see util/mesh_optimizer.h. Indices are narrowed to 16 bits when
+  // the vertex count allows it. Primitives are optimized in parallel on
+  // pool, which must not be running the caller.
+  void OptimizePrimitives(const tinygltf::Model &model, ThreadPool &pool) {
+    // The cache miss ratios before and after, weighted by triangle count.
+    std::vector<std::future<std::pair<double, double>>> misses;
+    size_t triangle_count = 0;
+    size_t narrowed = 0;
+    for (size_t m = 0; m < model.meshes.size(); ++m) {
+      for (size_t i = 0; i < model.meshes[m].primitives.size(); ++i) {
+        const tinygltf::Primitive &p = model.meshes[m].primitives[i];
+        if (!CanOptimize(model, p)) {
+          continue;
+        }
+        OptimizedPrimitive *optimized = new OptimizedPrimitive();
+        optimized_[{static_cast<int>(m), static_cast<int>(i)}].reset(
+            optimized);
+        misses.push_back(pool.Submit([this, &model, &p, optimized] {
+          return Optimize(model, p, optimized);
+        }));
+        triangle_count += model.accessors[p.indices].count / 3;
+      }
+    }
+    double misses_before = 0, misses_after = 0;
+    for (auto &future : misses) {
+      const std::pair<double, double> primitive = future.get();
+      misses_before += primitive.first;
+      misses_after += primitive.second;
+    }
+    for (const auto &kv : optimized_) {
+      const tinygltf::Primitive &p =
+          model.meshes[kv.first.first].primitives[kv.first.second];
+      narrowed += model.accessors[p.indices].componentType ==
+                      TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT &&
+                  kv.second->index_type == VK_INDEX_TYPE_UINT16;
+    }
+    if (triangle_count > 0) {
+      LOG(INFO) << "ModelBuffers: optimized " << misses.size()
+                << " primitives of " << triangle_count << " triangles: ACMR "
+                << misses_before / triangle_count << " -> "
+                << misses_after / triangle_count << ", " << narrowed
+                << " index buffers narrowed to 16 bits\n";
+    }
+  }
+
+  // Returns the optimized primitive, or nullptr if it was not optimized.
+  const OptimizedPrimitive *GetOptimized(int mesh, int primitive) const {
+    auto it = optimized_.find({mesh, primitive});
+    return it != optimized_.end() ? it->second.get() : nullptr;
+  }
+
+private:
+  // Overwrites the elements of dst listed by the sparse storage of a.
+  void ApplySparse(const tinygltf::Model &model, const tinygltf::Accessor &a,
+                   size_t element_size, unsigned char *dst) const {
+    const tinygltf::BufferView &index_view =
+        model.bufferViews[a.sparse.indices.bufferView];
+    const unsigned char *indices = GetData(model, index_view.buffer) +
+                                   index_view.byteOffset +
+                                   a.sparse.indices.byteOffset;
+    const size_t index_size =
+        tinygltf::GetComponentSizeInBytes(a.sparse.indices.componentType);
+    const tinygltf::BufferView &value_view =
+        model.bufferViews[a.sparse.values.bufferView];
+    const unsigned char *values = GetData(model, value_view.buffer) +
+                                  value_view.byteOffset +
+                                  a.sparse.values.byteOffset;
+    for (int i = 0; i < a.sparse.count; ++i) {
+      uint32_t index = 0;
+      switch (index_size) {
+      case 1:
+        index = indices[i];
+        break;
+      case 2: {
+        uint16_t index16;
+        std::memcpy(&index16, indices + 2 * i, sizeof(index16));
+        index = index16;
+        break;
+      }
+      default:
+        std::memcpy(&index, indices + 4 * i, sizeof(index));
+        break;
+      }
+      CHECK_PC(index < a.count, "sparse accessor index out of range");
+      std::memcpy(dst + index * element_size, values + i * element_size,
+                  element_size);
+    }
+  }
+
+  static bool CanOptimize(const tinygltf::Model &model,
+                          const tinygltf::Primitive &p) {
+    if (p.mode != TINYGLTF_MODE_TRIANGLES || p.indices < 0 ||
+        !p.targets.empty() || p.attributes.empty()) {
+      return false;
+    }
+    if (model.accessors[p.indices].count % 3 != 0) {
+      return false;
+    }
+    const size_t vertex_count =
+        model.accessors[p.attributes.begin()->second].count;
+    for (const auto &attribute : p.attributes) {
+      if (model.accessors[attribute.second].count != vertex_count) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<uint32_t> GetIndices(const tinygltf::Model &model,
+                                   const tinygltf::Primitive &p) const {
+    const tinygltf::Accessor &a = model.accessors[p.indices];
+    const unsigned char *src = GetPackedData(model, p.indices);
+    std::vector<uint32_t> indices(a.count);
+    for (size_t i = 0; i < a.count; ++i) {
+      switch (a.componentType) {
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        indices[i] = src[i];
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        indices[i] = reinterpret_cast<const uint16_t *>(src)[i];
+        break;
+      default:
+        indices[i] = reinterpret_cast<const uint32_t *>(src)[i];
+        break;
+      }
+    }
+    return indices;
+  }
+
+  // Returns the number of vertices transformed before and after.
+  std::pair<double, double> Optimize(const tinygltf::Model &model,
+                                     const tinygltf::Primitive &p,
+                                     OptimizedPrimitive *optimized) const {
+    const std::vector<uint32_t> indices = GetIndices(model, p);
+    const size_t vertex_count =
+        model.accessors[p.attributes.begin()->second].count;
+    CHECK_PC(std::all_of(indices.begin(), indices.end(),
+                         [vertex_count](uint32_t i) {
+                           return i < vertex_count;
+                         }),
+             "vertex index out of range");
+    const size_t triangle_count = indices.size() / 3;
+    const double misses_before =
+        ComputeAcmr(indices.data(), indices.size(), vertex_count) *
+        triangle_count;
+    std::vector<uint32_t> reordered(indices.size());
+    OptimizeVertexCache(indices.data(), indices.size(), vertex_count,
+                        reordered.data());
+    const std::vector<uint32_t> old_index =
+        OptimizeVertexFetch(reordered.data(), reordered.size(), vertex_count);
+
+    optimized->vertex_count = static_cast<uint32_t>(old_index.size());
+    optimized->index_count = static_cast<uint32_t>(reordered.size());
+    if (old_index.size() <= 0x10000) {
+      optimized->index_type = VK_INDEX_TYPE_UINT16;
+      optimized->indices.resize(reordered.size() * sizeof(uint16_t));
+      auto *dst = reinterpret_cast<uint16_t *>(optimized->indices.data());
+      std::copy(reordered.begin(), reordered.end(), dst);
+    } else {
+      optimized->index_type = VK_INDEX_TYPE_UINT32;
+      optimized->indices.resize(reordered.size() * sizeof(uint32_t));
+      std::memcpy(optimized->indices.data(), reordered.data(),
+                  optimized->indices.size());
+    }
+    for (const auto &attribute : p.attributes) {
+      const tinygltf::Accessor &a = model.accessors[attribute.second];
+      const size_t element_size =
+          tinygltf::GetComponentSizeInBytes(a.componentType) *
+          tinygltf::GetTypeSizeInBytes(a.type);
+      const unsigned char *src = GetPackedData(model, attribute.second);
+      std::vector<unsigned char> &dst =
+          optimized->attributes[attribute.second];
+      dst.resize(old_index.size() * element_size);
+      for (size_t v = 0; v < old_index.size(); ++v) {
+        std::memcpy(&dst[v * element_size], src + old_index[v] * element_size,
+                    element_size);
+      }
+    }
+    return {misses_before,
+            ComputeAcmr(reordered.data(), reordered.size(), old_index.size()) *
+                triangle_count};
+  }
+
+  // "glTF", "JSON" and "BIN\0" in little endian.
+  static constexpr uint32_t kGlbMagic = 0x46546C67;
+  static constexpr uint32_t kJsonChunk = 0x4E4F534A;
+  static constexpr uint32_t kBinChunk = 0x004E4942;
+
+  std::unique_ptr<MappedFile> file_;
+  const unsigned char *bin_ = nullptr;
+  size_t bin_size_ = 0;
+  mutable std::mutex mu_;
+  mutable std::unordered_map<int, std::vector<unsigned char>> packed_;
+  mutable std::unordered_map<int, std::vector<uint16_t>> widened_;
+  std::map<std::pair<int, int>, std::unique_ptr<OptimizedPrimitive>>
+      optimized_;
+};
+
 template <int ComponentType, int Type>
-void Attribute(const tinygltf::Model &model, int mesh, int primitive,
-               const std::string &attribute, VkDeviceSize &size,
-               void const **src) {
+void Attribute(const tinygltf::Model &model, const ModelBuffers &buffers,
+               int mesh, int primitive, const std::string &attribute,
+               VkDeviceSize &size, void const **src) {
   const tinygltf::Primitive &p = model.meshes[mesh].primitives[primitive];
   CHECK_PC(p.attributes.count(attribute),
            "attribute '" + attribute + "' is required");
-  const tinygltf::Accessor &accessor =
-      model.accessors[p.attributes.at(attribute)];
-  const tinygltf::BufferView &bufferView =
-      model.bufferViews[accessor.bufferView];
-  const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-  const size_t tightStride =
-      tinygltf::GetComponentSizeInBytes(accessor.componentType) *
-      tinygltf::GetTypeSizeInBytes(accessor.type);
-  CHECK_PC(bufferView.byteStride == 0 || bufferView.byteStride == tightStride,
-           "buffer views that are not tighly packed are not supported");
-  CHECK_PC(!accessor.sparse.isSparse, "sparse accessors are not supported");
+  const int index = p.attributes.at(attribute);
+  const tinygltf::Accessor &accessor = model.accessors[index];
   CHECK_PC(accessor.componentType == ComponentType,
            "accessor component type for attribute '" + attribute +
                "' must be " +
@@ -94,15 +508,20 @@ void Attribute(const tinygltf::Model &model, int mesh, int primitive,
   CHECK_PC(accessor.type == Type, "accessor type for attribute '" + attribute +
                                       "' must be " +
                                       std::string(TypeString<Type>()));
-  size = accessor.count * tinygltf::GetComponentSizeInBytes(ComponentType) *
+  const ModelBuffers::OptimizedPrimitive *optimized =
+      buffers.GetOptimized(mesh, primitive);
+  size = (optimized != nullptr ? optimized->vertex_count : accessor.count) *
+         tinygltf::GetComponentSizeInBytes(ComponentType) *
          tinygltf::GetTypeSizeInBytes(Type);
   if (src != nullptr) {
-    *src = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+    *src = optimized != nullptr ? optimized->attributes.at(index).data()
+                                : buffers.GetPackedData(model, index);
   }
 }
 
 template <int ComponentType, int Type>
-bool OptionalAttribute(const tinygltf::Model &model, int mesh, int primitive,
+bool OptionalAttribute(const tinygltf::Model &model,
+                       const ModelBuffers &buffers, int mesh, int primitive,
                        const std::string &attribute, VkDeviceSize &size,
                        void const **src) {
   size = 0;
@@ -111,16 +530,209 @@ bool OptionalAttribute(const tinygltf::Model &model, int mesh, int primitive,
   if (p.attributes.count(attribute) == 0) {
     return false;
   }
-  Attribute<ComponentType, Type>(model, mesh, primitive, attribute, size, src);
+  Attribute<ComponentType, Type>(model, buffers, mesh, primitive, attribute,
+                                 size, src);
   return true;
 }
 
+// An image decoded into RGBA8.
+struct DecodedImage {
+  stbi_uc *pixels;
+  int width;
+  int height;
+  int channels;
+};
+
+// Decodes the images of a model on a thread pool, once per image index, as
+// several materials may share an image.
+//
+// Attached to a tinygltf loader, it receives the encoded images while the
+// model is parsed, whether they come from files, data URIs or buffer views,
+// and starts decoding them right away instead of letting the loader decode
+// them one after the other. Images it did not receive are decoded from their
+// URI on demand. Encoded images are kept, so that a released image can be
+// decoded again.
+//
+// Images with an up to date baked texture next to them, see bake_textures,
+// are mapped instead of decoded, unless the device cannot sample its format.
+class ImageDecoder {
+public:
+  ImageDecoder(ThreadPool &pool, const std::string &base_dir)
+      : pool_(pool), base_dir_(base_dir) {}
+  ~ImageDecoder() { Clear(); }
+
+  ImageDecoder(const ImageDecoder &) = delete;
+  ImageDecoder(ImageDecoder &&) = delete;
+
+  void Attach(tinygltf::TinyGLTF &loader) {
+    loader.SetImageLoader(&ImageDecoder::LoadImageData, this);
+  }
+
+  // Sets the device the textures are sampled on. It is created after the
+  // model is loaded, and must be set before GetBaked() is called.
+  void SetDevice(const zrl::LogicalDevice &device) { device_ = &device; }
+
+  // Returns the decoded image, waiting for it if needed. It remains valid
+  // until the image is released.
+  const DecodedImage &Get(const tinygltf::Model &model,
+                          const std::string &base_dir, int image) {
+    std::shared_future<DecodedImage> decoded;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      Entry &entry = entries_[image];
+      if (!entry.decoded.valid()) {
+        if (entry.name.empty()) {
+          entry.name = base_dir + "/" + model.images[image].uri;
+        }
+        Submit(entry);
+      }
+      decoded = entry.decoded;
+    }
+    return decoded.get();
+  }
+
+  // Returns the baked texture of an image, or nullptr if it has none or if
+  // the device cannot sample its format. The image is then decoded instead.
+  const BakedTexture *GetBaked(int image) {
+    CHECK_PC(device_ != nullptr, "no device to sample the textures on");
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = entries_.find(image);
+    if (it == entries_.end() || it->second.baked == nullptr) {
+      return nullptr;
+    }
+    const BakedTexture *baked = it->second.baked.get();
+    if (!device_->SupportsSampledImage(baked->GetFormat())) {
+      LOG(WARNING) << "ImageDecoder: cannot sample the baked texture of '"
+                   << it->second.name << "', decoding it\n";
+      return nullptr;
+    }
+    return baked;
+  }
+
+  // Frees the decoded pixels of an image.
+  void Release(int image) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = entries_.find(image);
+    if (it != entries_.end() && it->second.decoded.valid()) {
+      stbi_image_free(it->second.decoded.get().pixels);
+      it->second.decoded = {};
+    }
+  }
+
+  // Waits for the images being decoded, and frees all of them.
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto &kv : entries_) {
+      if (kv.second.decoded.valid()) {
+        stbi_image_free(kv.second.decoded.get().pixels);
+      }
+    }
+    entries_.clear();
+  }
+
+private:
+  struct Entry {
+    std::unique_ptr<BakedTexture> baked;
+    // Empty for images read from their URI.
+    std::shared_ptr<const std::vector<unsigned char>> encoded;
+    std::string name;
+    std::shared_future<DecodedImage> decoded;
+  };
+
+  static bool LoadImageData(tinygltf::Image *image, const int image_idx,
+                            std::string *, std::string *, int, int,
+                            const unsigned char *bytes, int size,
+                            void *user_data) {
+    auto *decoder = static_cast<ImageDecoder *>(user_data);
+    std::unique_ptr<BakedTexture> baked = BakedTexture::Open(
+        BakedTexture::PathFor(decoder->base_dir_, image->uri, image_idx));
+    // The image may have been edited since it was baked, even if it kept its
+    // size.
+    const bool up_to_date =
+        baked != nullptr && baked->GetSourceHash() == HashBytes(bytes, size);
+    std::lock_guard<std::mutex> lock(decoder->mu_);
+    Entry &entry = decoder->entries_[image_idx];
+    // Every device samples RGBA8. Other formats may have to be decoded
+    // after all, see GetBaked(), so their encoded image is kept.
+    if (up_to_date && baked->GetFormat() == VK_FORMAT_R8G8B8A8_UNORM) {
+      entry.baked = std::move(baked);
+      return true;
+    }
+    // The bytes only live until this returns.
+    entry.encoded = std::make_shared<std::vector<unsigned char>>(bytes,
+                                                                 bytes + size);
+    entry.name = image->uri.empty() ? image->name : image->uri;
+    if (up_to_date) {
+      entry.baked = std::move(baked);
+      return true;
+    }
+    decoder->Submit(entry);
+    return true;
+  }
+
+  void Submit(Entry &entry) {
+    auto encoded = entry.encoded;
+    const std::string name = entry.name;
+    entry.decoded = pool_.Submit([encoded, name] {
+      DecodedImage decoded = {};
+      if (encoded != nullptr) {
+        decoded.pixels = stbi_load_from_memory(
+            encoded->data(), static_cast<int>(encoded->size()),
+            &decoded.width, &decoded.height, &decoded.channels,
+            STBI_rgb_alpha);
+      } else {
+        decoded.pixels = stbi_load(name.c_str(), &decoded.width,
+                                   &decoded.height, &decoded.channels,
+                                   STBI_rgb_alpha);
+      }
+      CHECK_PC(decoded.pixels != nullptr, "failed to load image: " + name);
+      return decoded;
+    });
+  }
+
+  ThreadPool &pool_;
+  const std::string base_dir_;
+  const zrl::LogicalDevice *device_ = nullptr;
+  std::mutex mu_;
+  std::unordered_map<int, Entry> entries_;
+};
+
+// Points ref at the pixels of an image: all the levels of its baked texture
+// if it has one, or else the decoded image, whose mip chain is then built
+// when uploading it.
+void SetImageData(const tinygltf::Model &model, const std::string &base_dir,
+                  ImageDecoder &decoder, int image,
+                  SampledImage2DReference &ref) {
+  if (const BakedTexture *baked = decoder.GetBaked(image)) {
+    ref.format = baked->GetFormat();
+    ref.image_data.assign(1, {});
+    for (uint32_t level = 0; level < baked->GetLevelCount(); ++level) {
+      ref.image_data[0].push_back(
+          const_cast<uint8_t *>(baked->GetLevelData(level)));
+    }
+    ref.size = baked->GetLevelSize(0);
+    ref.width = baked->GetWidth();
+    ref.height = baked->GetHeight();
+    ref.channels = 4;
+    ref.build_mipmaps = false;
+    return;
+  }
+  const DecodedImage &decoded = decoder.Get(model, base_dir, image);
+  ref.format = VK_FORMAT_R8G8B8A8_UNORM;
+  ref.image_data.assign(1, {decoded.pixels});
+  ref.size = decoded.width * decoded.height * 4;
+  ref.width = static_cast<uint32_t>(decoded.width);
+  ref.height = static_cast<uint32_t>(decoded.height);
+  ref.channels = static_cast<uint32_t>(decoded.channels);
+  ref.build_mipmaps = true;
+}
+
 void LoadTexture(const tinygltf::Model &model, const std::string &base_dir,
-                 const tinygltf::Texture &tex,
+                 ImageDecoder &decoder, const tinygltf::Texture &tex,
                  SampledImage2DReference &ref) noexcept {
   const tinygltf::Sampler sampler =
       (tex.sampler == -1) ? tinygltf::Sampler() : model.samplers[tex.sampler];
-  const tinygltf::Image image = model.images[tex.source];
+  const tinygltf::Image &image = model.images[tex.source];
   // Sampler
   ref.sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
   ref.sampler_create_info.pNext = nullptr;
@@ -218,24 +830,83 @@ void LoadTexture(const tinygltf::Model &model, const std::string &base_dir,
   ref.sampler_create_info.compareOp = VK_COMPARE_OP_ALWAYS;
   ref.sampler_create_info.mipLodBias = 0.0f;
   // Image
-  ref.format = VK_FORMAT_R8G8B8A8_UNORM;
-  int width, height, channels;
-  const std::string filepath = base_dir + "/" + image.uri;
-  ref.image_data.resize(1);
-  ref.image_data[0].push_back(
-      stbi_load(filepath.c_str(), &width, &height, &channels, STBI_rgb_alpha));
-  CHECK_PC(ref.image_data[0][0] != nullptr,
-           "failed to load image: " + filepath);
-  ref.size = width * height * 4;
-  ref.width = static_cast<uint32_t>(width);
-  ref.height = static_cast<uint32_t>(height);
-  ref.channels = static_cast<uint32_t>(channels);
-  ref.build_mipmaps = true;
+  SetImageData(model, base_dir, decoder, tex.source, ref);
 
-  LOG(INFO) << "loaded texture '" << filepath << "': width=" << ref.width
-            << " height=" << ref.height << " channels=" << ref.channels << "\n";
+  LOG(INFO) << "loaded texture " << tex.source << " '" << image.uri
+            << "': width=" << ref.width << " height=" << ref.height
+            << " channels=" << ref.channels << " levels="
+            << ref.image_data[0].size() << "\n";
 }
 
+// Shares the textures of a model between materials. Textures with the same
+// image and sampler are set up once, and all their references point to the
+// same pixels, owned by the decoder.
+//
+// The pixels are only needed until the GPU has uploaded them, after which
+// ReleaseUploaded() frees them. A texture loaded again afterwards is decoded
+// again, from the encoded image the decoder kept.
+class TextureCache {
+public:
+  TextureCache(const tinygltf::Model &model, const std::string &base_dir,
+               ImageDecoder &decoder)
+      : model_(model), base_dir_(base_dir), decoder_(decoder), loads_(0) {}
+
+  TextureCache(const TextureCache &) = delete;
+  TextureCache(TextureCache &&) = delete;
+
+  void Load(int texture, SampledImage2DReference &ref) {
+    const tinygltf::Texture &tex = model_.textures[texture];
+    ++loads_;
+    auto it = entries_.find({tex.source, tex.sampler});
+    if (it == entries_.end()) {
+      it = entries_.emplace(std::make_pair(tex.source, tex.sampler), Entry())
+               .first;
+      LoadTexture(model_, base_dir_, decoder_, tex, it->second.ref);
+      it->second.resident = true;
+    } else if (!it->second.resident) {
+      SetImageData(model_, base_dir_, decoder_, tex.source, it->second.ref);
+      it->second.resident = true;
+    }
+    pending_.insert(tex.source);
+    ref = it->second.ref;
+  }
+
+  bool HasPendingUploads() const { return !pending_.empty(); }
+
+  // Frees the pixels of the textures loaded so far. The GPU must be done
+  // uploading them.
+  void ReleaseUploaded() {
+    for (auto &kv : entries_) {
+      if (pending_.count(kv.first.first) > 0) {
+        kv.second.resident = false;
+        kv.second.ref.image_data.clear();
+      }
+    }
+    for (int image : pending_) {
+      decoder_.Release(image);
+    }
+    LOG(INFO) << "TextureCache: released " << pending_.size()
+              << " images, loads=" << loads_
+              << " textures=" << entries_.size() << "\n";
+    pending_.clear();
+  }
+
+private:
+  struct Entry {
+    SampledImage2DReference ref;
+    bool resident;
+  };
+
+  const tinygltf::Model &model_;
+  const std::string base_dir_;
+  ImageDecoder &decoder_;
+  // Keyed by image and sampler.
+  std::map<std::pair<int, int>, Entry> entries_;
+  // Images whose pixels are referenced by textures not known to be uploaded.
+  std::set<int> pending_;
+  uint64_t loads_;
+};
+
 } // namespace gltf
 } // namespace support
 } // namespace zrl
@@ -12,14 +12,26 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "core/Core.h"
 #include "core/Log.h"
+#include "core/MappedFile.h"
+#include "core/Trace.h"
+#include "util/bvh.h"
 #include "util/camera.h"
-#include "util/fps_counter.h"
+#include "util/ibl.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
 
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
@@ -35,6 +47,13 @@
 // TODO: modify the UIDs.
 
 std::string base_dir;
+zrl::support::gltf::TextureCache *texture_cache = nullptr;
+const zrl::support::gltf::ModelBuffers *model_buffers = nullptr;
+ThreadPool *workers = nullptr;
+// The environment lighting is computed on this core, and its texels are read
+// from the mapped ibl file.
+const zrl::Core *ibl_core = nullptr;
+std::unique_ptr<Ibl> ibl;
 
 struct Node {
   const tinygltf::Model &m;
@@ -66,104 +85,135 @@ template <> struct ForwardPass_env<std::string> {
     info.mipLodBias = 0.0f;
   }
 
-  void LoadTexture(const std::string &filepath,
-                   SampledImage2DReference &ref) const {
-    int width, height, channels;
-    ref.format = VK_FORMAT_R8G8B8A8_UNORM;
-    ref.image_data.resize(1);
-    ref.image_data[0].push_back(stbi_load(filepath.c_str(), &width, &height,
-                                          &channels, STBI_rgb_alpha));
-    CHECK_PC(ref.image_data[0][0] != nullptr,
-             "failed to load image: " + filepath);
-    ref.size = width * height * 4;
-    ref.width = static_cast<uint32_t>(width);
-    ref.height = static_cast<uint32_t>(height);
-    ref.channels = static_cast<uint32_t>(channels);
-    ref.build_mipmaps = false;
-
-    LOG(INFO) << "main: loaded texture '" << filepath
-              << "': width=" << ref.width << " height=" << ref.height
-              << " channels=" << ref.channels << "\n";
-  }
-
-  bool LevelExist(const std::string &name, const std::string &kind,
-                  int level) const {
-    const std::string filename = "assets/textures/" + name + "/" + kind + "/" +
-                                 kind + "_front_" + std::to_string(level) +
-                                 ".hdr";
-    if (FILE *f = fopen(filename.c_str(), "r")) {
-      fclose(f);
-      return true;
+  // Files the radiance of an environment is read from: an equirectangular
+  // environment.hdr if there is one, else the first level of the faces of
+  // the specular cube map shipped with it.
+  static std::vector<std::string> GetEnvSources(const std::string &name) {
+    const std::string dir = "assets/textures/" + name + "/";
+    if (zrl::MappedFile::Exists(dir + "environment.hdr")) {
+      return {dir + "environment.hdr"};
     }
-    return false;
+    std::vector<std::string> sources;
+    for (const char *face :
+         {"right", "left", "top", "bottom", "front", "back"}) {
+      sources.push_back(dir + "specular/specular_" + face + "_0.hdr");
+    }
+    return sources;
   }
 
-  void LoadEnvCubeMaps(const std::string &name,
-                       SampledCubeMapReference &diffuse,
-                       SampledCubeMapReference &specular,
-                       float &mipCount) const {
-    constexpr std::array<const char *, 6> kFaceNames = {
-        "right", "left", "top", "bottom", "front", "back",
+  // Decodes the sources of an environment in parallel into the RGBA32F faces
+  // of a cube map.
+  static std::vector<std::vector<float>>
+  LoadEnvRadiance(const std::vector<std::string> &sources,
+                  uint32_t &face_size) {
+    struct Hdr {
+      std::vector<float> pixels;
+      uint32_t width, height;
     };
-
-    // Diffuse environment map.
-    diffuse.format = VK_FORMAT_R8G8B8A8_UNORM;
-    int mip_levels = 1;
-    while (LevelExist(name, "diffuse", mip_levels)) {
-      ++mip_levels;
+    std::vector<std::future<Hdr>> decoded;
+    for (const std::string &filename : sources) {
+      decoded.push_back(workers->Submit([filename] {
+        int w, h, c;
+        float *pixels =
+            stbi_loadf(filename.c_str(), &w, &h, &c, STBI_rgb_alpha);
+        CHECK_PC(pixels != nullptr, "failed to load image: " + filename);
+        Hdr hdr;
+        hdr.pixels.assign(pixels, pixels + 4 * w * h);
+        hdr.width = static_cast<uint32_t>(w);
+        hdr.height = static_cast<uint32_t>(h);
+        stbi_image_free(pixels);
+        return hdr;
+      }));
     }
-    for (int layer = 0; layer < 6; ++layer) {
-      for (int level = 0; level < mip_levels; ++level) {
-        int width, height, channels;
-        const std::string filename = "assets/textures/" + name +
-                                     "/diffuse/diffuse_" + kFaceNames[layer] +
-                                     "_" + std::to_string(level) + ".hdr";
-        diffuse.image_data[layer].push_back(stbi_load(
-            filename.c_str(), &width, &height, &channels, STBI_rgb_alpha));
-        CHECK_PC(diffuse.image_data[layer][level] != nullptr,
-                 "failed to load image: " + filename);
-        if (layer == 0 && level == 0) {
-          diffuse.width = static_cast<uint32_t>(width);
-          diffuse.height = static_cast<uint32_t>(height);
-          diffuse.channels = static_cast<uint32_t>(channels);
-        }
+    if (decoded.size() == 1) {
+      const Hdr equirect = decoded[0].get();
+      // Faces a quarter as wide as the equirect keep about its texel density
+      // around the horizon.
+      face_size = std::max(equirect.width / 4, 1u);
+      return Ibl::CubeFromEquirect(equirect.pixels.data(), equirect.width,
+                                   equirect.height, face_size);
+    }
+    std::vector<std::vector<float>> faces;
+    for (auto &future : decoded) {
+      Hdr face = future.get();
+      if (faces.empty()) {
+        face_size = face.width;
       }
+      CHECK_PC(face.width == face_size && face.height == face_size,
+               "env cube map faces must be square and of the same size");
+      faces.push_back(std::move(face.pixels));
     }
-    diffuse.size = diffuse.width * diffuse.height * 4;
-    LOG(INFO) << "main: loaded diffuse env cubemap '" << name
-              << "': width=" << diffuse.width << " height=" << diffuse.height
-              << " channels=" << diffuse.channels << " levels=" << mip_levels
-              << "\n";
-
-    // Specular environment map.
-    specular.format = VK_FORMAT_R8G8B8A8_UNORM;
-    mip_levels = 1;
-    while (LevelExist(name, "specular", mip_levels)) {
-      ++mip_levels;
+    return faces;
+  }
+
+  // Loads the image based lighting of an environment from its cache file,
+  // which is computed on the device first if it is missing or stale.
+  void LoadEnv(const std::string &name, Environment *data) const {
+    const std::vector<std::string> sources = GetEnvSources(name);
+    for (const std::string &filename : sources) {
+      CHECK_PC(zrl::MappedFile::Exists(filename),
+               "failed to open image: " + filename);
     }
-    mipCount = static_cast<float>(mip_levels);
-    for (int layer = 0; layer < 6; ++layer) {
-      for (int level = 0; level < mip_levels; ++level) {
-        int width, height, channels;
-        const std::string filename = "assets/textures/" + name +
-                                     "/specular/specular_" + kFaceNames[layer] +
-                                     "_" + std::to_string(level) + ".hdr";
-        specular.image_data[layer].push_back(stbi_load(
-            filename.c_str(), &width, &height, &channels, STBI_rgb_alpha));
-        CHECK_PC(specular.image_data[layer][level] != nullptr,
-                 "failed to load image: " + filename);
-        if (layer == 0 && level == 0) {
-          specular.width = static_cast<uint32_t>(width);
-          specular.height = static_cast<uint32_t>(height);
-          specular.channels = static_cast<uint32_t>(channels);
-        }
+    const uint64_t source_hash = Ibl::HashSources(sources);
+    const std::string filename = "gltf-viewer." + name + ".ibl";
+    ibl = Ibl::Open(filename, source_hash);
+    if (ibl == nullptr) {
+      LOG(INFO) << "main: computing the lighting of env '" << name << "'\n";
+      uint32_t face_size;
+      const std::vector<std::vector<float>> faces =
+          LoadEnvRadiance(sources, face_size);
+      std::vector<const float *> face_data;
+      for (const auto &face : faces) {
+        face_data.push_back(face.data());
+      }
+      CHECK_PC(Ibl::Bake(*ibl_core, face_data, face_size, source_hash,
+                         filename),
+               "failed to compute the lighting of env '" + name + "'");
+      ibl = Ibl::Open(filename, source_hash);
+      CHECK_PC(ibl != nullptr, "failed to read back '" + filename + "'");
+    }
+
+    // The texels stay in the mapped file, which outlives the renderer.
+    constexpr uint32_t kTexelSize = 4 * sizeof(uint16_t);
+    auto texels = [](const uint8_t *data) {
+      return const_cast<stbi_uc *>(data);
+    };
+    data->diffuse.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    data->diffuse.width = data->diffuse.height = ibl->GetIrradianceSize();
+    data->diffuse.channels = 4;
+    data->diffuse.size =
+        data->diffuse.width * data->diffuse.height * kTexelSize;
+    data->specular.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    data->specular.width = data->specular.height = ibl->GetSpecularSize();
+    data->specular.channels = 4;
+    data->specular.size =
+        data->specular.width * data->specular.height * kTexelSize;
+    for (uint32_t face = 0; face < 6; ++face) {
+      data->diffuse.image_data[face] = {texels(ibl->GetIrradiance(face))};
+      data->specular.image_data[face].clear();
+      for (uint32_t level = 0; level < ibl->GetSpecularLevelCount();
+           ++level) {
+        data->specular.image_data[face].push_back(
+            texels(ibl->GetSpecular(face, level)));
       }
     }
-    specular.size = specular.width * specular.height * 4;
-    LOG(INFO) << "main: loaded specular env cubemap '" << name
-              << "': width=" << specular.width << " height=" << specular.height
-              << " channels=" << specular.channels << " levels=" << mip_levels
-              << "\n";
+    // Level l is prefiltered for a roughness of l / (levels - 1).
+    data->mipCount = static_cast<float>(ibl->GetSpecularLevelCount() - 1);
+    data->specular.sampler_create_info.maxLod = data->mipCount;
+
+    data->brdfLUT.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    data->brdfLUT.image_data.resize(1);
+    data->brdfLUT.image_data[0] = {texels(ibl->GetBrdfLut())};
+    data->brdfLUT.width = data->brdfLUT.height = ibl->GetBrdfLutSize();
+    data->brdfLUT.channels = 4;
+    data->brdfLUT.size =
+        data->brdfLUT.width * data->brdfLUT.height * kTexelSize;
+    data->brdfLUT.build_mipmaps = false;
+
+    LOG(INFO) << "main: loaded env '" << name
+              << "': irradiance=" << ibl->GetIrradianceSize()
+              << " specular=" << ibl->GetSpecularSize() << " levels="
+              << ibl->GetSpecularLevelCount() << "\n";
   }
 
   void operator()(const std::string &name, uint32_t &uid,
@@ -175,12 +225,11 @@ template <> struct ForwardPass_env<std::string> {
           VK_SAMPLER_MIPMAP_MODE_NEAREST;
       data->diffuse.sampler_create_info.maxLod = 0.25f;
       SetSampler(data->specular.sampler_create_info);
-      LoadEnvCubeMaps(name, data->diffuse, data->specular, data->mipCount);
       SetSampler(data->brdfLUT.sampler_create_info);
       data->brdfLUT.sampler_create_info.mipmapMode =
           VK_SAMPLER_MIPMAP_MODE_NEAREST;
       data->brdfLUT.sampler_create_info.maxLod = 0.25f;
-      LoadTexture("assets/textures/brdfLUT.png", data->brdfLUT);
+      LoadEnv(name, data);
     }
   }
 };
@@ -203,10 +252,8 @@ template <> struct ForwardPass_mat<Node> {
       CHECK_PC(mat.pbrMetallicRoughness.baseColorTexture.texCoord == 0,
                "Only one texture coordinate set is supported");
       m->hasBaseColor = true;
-      zrl::support::gltf::LoadTexture(
-          node.m, base_dir,
-          node.m.textures[mat.pbrMetallicRoughness.baseColorTexture.index],
-          m->baseColor);
+      texture_cache->Load(mat.pbrMetallicRoughness.baseColorTexture.index,
+                          m->baseColor);
     }
     m->metallicFactor = mat.pbrMetallicRoughness.metallicFactor;
     m->roughnessFactor = mat.pbrMetallicRoughness.roughnessFactor;
@@ -214,10 +261,8 @@ template <> struct ForwardPass_mat<Node> {
       CHECK_PC(mat.pbrMetallicRoughness.metallicRoughnessTexture.texCoord == 0,
                "Only one texture coordinate set is supported");
       m->hasMetallicRoughness = true;
-      zrl::support::gltf::LoadTexture(
-          node.m, base_dir,
-          node.m.textures[mat.pbrMetallicRoughness.metallicRoughnessTexture
-                              .index],
+      texture_cache->Load(
+          mat.pbrMetallicRoughness.metallicRoughnessTexture.index,
           m->metallicRoughness);
     }
     if (mat.normalTexture.index != -1) {
@@ -225,27 +270,21 @@ template <> struct ForwardPass_mat<Node> {
                "Only one texture coordinate set is supported");
       m->hasNormal = true;
       m->normalScale = mat.normalTexture.scale;
-      zrl::support::gltf::LoadTexture(node.m, base_dir,
-                                      node.m.textures[mat.normalTexture.index],
-                                      m->normal);
+      texture_cache->Load(mat.normalTexture.index, m->normal);
     }
     if (mat.occlusionTexture.index != -1) {
       CHECK_PC(mat.occlusionTexture.texCoord == 0,
                "Only one texture coordinate set is supported");
       m->hasOcclusion = true;
       m->occlusionStrength = mat.occlusionTexture.strength;
-      zrl::support::gltf::LoadTexture(
-          node.m, base_dir, node.m.textures[mat.occlusionTexture.index],
-          m->occlusion);
+      texture_cache->Load(mat.occlusionTexture.index, m->occlusion);
     }
     if (mat.emissiveTexture.index != -1) {
       CHECK_PC(mat.emissiveTexture.texCoord == 0,
                "Only one texture coordinate set is supported");
       m->hasEmissive = true;
       m->emissiveFactor = glm::make_vec3(mat.emissiveFactor.data());
-      zrl::support::gltf::LoadTexture(
-          node.m, base_dir, node.m.textures[mat.emissiveTexture.index],
-          m->emissive);
+      texture_cache->Load(mat.emissiveTexture.index, m->emissive);
     }
     if (mat.alphaMode == "OPAQUE") {
       m->alphaMode = 0;
@@ -282,21 +321,15 @@ template <> struct ForwardPass_indices_<Node> {
         node.m.meshes[node.mesh].primitives[node.primitive];
     uid = (node.mesh << 20) + (node.primitive << 10) + 1;
     if (src != nullptr) {
-      const tinygltf::Accessor &accessor = node.m.accessors[p.indices];
-      const tinygltf::BufferView &bufferView =
-          node.m.bufferViews[accessor.bufferView];
-      const tinygltf::Buffer &buffer = node.m.buffers[bufferView.buffer];
-      CHECK_PC(bufferView.byteStride == 0, "strided buffers are not supported");
-      switch (accessor.componentType) {
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-        index_type = VK_INDEX_TYPE_UINT16;
-        break;
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-        index_type = VK_INDEX_TYPE_UINT32;
-        break;
+      if (const auto *optimized =
+              model_buffers->GetOptimized(node.mesh, node.primitive)) {
+        index_type = optimized->index_type;
+        index_count = optimized->index_count;
+        *src = optimized->indices.data();
+        return;
       }
-      index_count = accessor.count;
-      *src = buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+      index_count = node.m.accessors[p.indices].count;
+      *src = model_buffers->GetIndexData(node.m, p.indices, index_type);
     }
   }
 };
@@ -307,7 +340,8 @@ template <> struct ForwardPass_position<Node> {
     uid = (node.mesh << 20) + (node.primitive << 10) + 2;
     zrl::support::gltf::Attribute<TINYGLTF_COMPONENT_TYPE_FLOAT,
                                   TINYGLTF_TYPE_VEC3>(
-        node.m, node.mesh, node.primitive, "POSITION", size, src);
+        node.m, *model_buffers, node.mesh, node.primitive, "POSITION", size,
+        src);
   }
 };
 
@@ -317,7 +351,8 @@ template <> struct ForwardPass_normal<Node> {
     uid = 0;
     if (zrl::support::gltf::OptionalAttribute<TINYGLTF_COMPONENT_TYPE_FLOAT,
                                               TINYGLTF_TYPE_VEC3>(
-            node.m, node.mesh, node.primitive, "NORMAL", size, src)) {
+            node.m, *model_buffers, node.mesh, node.primitive, "NORMAL", size,
+            src)) {
       uid = (node.mesh << 20) + (node.primitive << 10) + 3;
     }
   }
@@ -329,7 +364,8 @@ template <> struct ForwardPass_color<Node> {
     uid = 0;
     if (zrl::support::gltf::OptionalAttribute<TINYGLTF_COMPONENT_TYPE_FLOAT,
                                               TINYGLTF_TYPE_VEC4>(
-            node.m, node.mesh, node.primitive, "COLOR_0", size, src)) {
+            node.m, *model_buffers, node.mesh, node.primitive, "COLOR_0", size,
+            src)) {
       uid = (node.mesh << 20) + (node.primitive << 10) + 4;
     }
   }
@@ -341,7 +377,8 @@ template <> struct ForwardPass_tangent<Node> {
     uid = 0;
     if (zrl::support::gltf::OptionalAttribute<TINYGLTF_COMPONENT_TYPE_FLOAT,
                                               TINYGLTF_TYPE_VEC4>(
-            node.m, node.mesh, node.primitive, "TANGENT", size, src)) {
+            node.m, *model_buffers, node.mesh, node.primitive, "TANGENT", size,
+            src)) {
       uid = (node.mesh << 20) + (node.primitive << 10) + 5;
     }
   }
@@ -353,7 +390,8 @@ template <> struct ForwardPass_uv<Node> {
     uid = (node.mesh << 20) + (node.primitive << 10) + 6;
     zrl::support::gltf::Attribute<TINYGLTF_COMPONENT_TYPE_FLOAT,
                                   TINYGLTF_TYPE_VEC2>(
-        node.m, node.mesh, node.primitive, "TEXCOORD_0", size, src);
+        node.m, *model_buffers, node.mesh, node.primitive, "TEXCOORD_0", size,
+        src);
   }
 };
 
@@ -391,6 +429,88 @@ void AddNodes(const tinygltf::Model &model, const tinygltf::Node &node,
   }
 }
 
+// Returns the world space bounds of each node, in the order of nodes. They
+// are derived from the bounds of the POSITION accessor, which glTF requires.
+// Nodes without them are never culled.
+std::vector<Bvh::Box> GetBounds(const std::vector<Node> &nodes) {
+  std::vector<Bvh::Box> boxes;
+  constexpr float kInfinity = std::numeric_limits<float>::infinity();
+  for (const Node &node : nodes) {
+    const auto &attributes =
+        node.m.meshes[node.mesh].primitives[node.primitive].attributes;
+    const auto position = attributes.find("POSITION");
+    float min[3] = {-kInfinity, -kInfinity, -kInfinity};
+    float max[3] = {kInfinity, kInfinity, kInfinity};
+    if (position != attributes.end()) {
+      const tinygltf::Accessor &accessor = node.m.accessors[position->second];
+      if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+        std::fill(min, min + 3, kInfinity);
+        std::fill(max, max + 3, -kInfinity);
+        for (int corner = 0; corner < 8; ++corner) {
+          glm::fvec4 p(1.0f);
+          for (int i = 0; i < 3; ++i) {
+            const auto &bound =
+                corner & (1 << i) ? accessor.maxValues : accessor.minValues;
+            p[i] = static_cast<float>(bound[i]);
+          }
+          p = node.model * p;
+          for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+          }
+        }
+      }
+    }
+    boxes.push_back({{min[0], min[1], min[2]}, {max[0], max[1], max[2]}});
+  }
+  return boxes;
+}
+
+// Replaces visible by the nodes whose bounds intersect the view frustum.
+void CullNodes(const Bvh &bvh, const glm::fmat4 &proj_view,
+               const std::vector<Node> &nodes, std::vector<Node> &visible,
+               Profiler &profiler) {
+  auto scope = profiler.Cpu("cull");
+  TRACE_SCOPE("CullNodes");
+  std::vector<uint32_t> indices;
+  bvh.Cull(&proj_view[0][0], indices);
+  // Keeps the draw order of the scene.
+  std::sort(indices.begin(), indices.end());
+  visible.clear();
+  for (uint32_t i : indices) {
+    visible.push_back(nodes[i]);
+  }
+}
+
+// Logs the primitive at the center of the screen when the left mouse button
+// is pressed. Primitives are picked by their bounds.
+void PickNode(GLFWwindow *window, const Bvh &bvh, const glm::fmat4 &proj_view,
+              const std::vector<Node> &nodes) {
+  static bool was_pressed = false;
+  const bool pressed =
+      glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+  if (!pressed || was_pressed) {
+    was_pressed = pressed;
+    return;
+  }
+  was_pressed = true;
+  const glm::fmat4 inverse = glm::inverse(proj_view);
+  const glm::fvec4 near_point = inverse * glm::fvec4(0.0f, 0.0f, 0.0f, 1.0f);
+  const glm::fvec4 far_point = inverse * glm::fvec4(0.0f, 0.0f, 1.0f, 1.0f);
+  const glm::fvec3 origin = glm::fvec3(near_point) / near_point.w;
+  const glm::fvec3 direction = glm::fvec3(far_point) / far_point.w - origin;
+  float distance = 0.0f;
+  const int64_t picked = bvh.Pick(&origin[0], &direction[0], distance);
+  if (picked < 0) {
+    LOG(INFO) << "main: picked nothing\n";
+    return;
+  }
+  const Node &node = nodes[picked];
+  LOG(INFO) << "main: picked primitive " << node.primitive << " of mesh "
+            << node.mesh << " \"" << node.m.meshes[node.mesh].name
+            << "\" at " << glm::length(direction) * distance << "\n";
+}
+
 void HandleInput(GLFWwindow *window, Camera &camera, int &mode) {
   static double last_x = 0, last_y = 0;
 
@@ -425,17 +545,55 @@ void HandleInput(GLFWwindow *window, Camera &camera, int &mode) {
   }
 }
 
+// Frees the pixels of the textures bound by the last frame, once the GPU has
+// uploaded them.
+void ReleaseUploadedTextures(const zrl::Core &core) {
+  if (texture_cache->HasPendingUploads()) {
+    CHECK_VK(vkDeviceWaitIdle(core.GetLogicalDevice().GetHandle()));
+    texture_cache->ReleaseUploaded();
+  }
+}
+
 int main(int argc, char *argv[]) {
-  if (argc == 1) {
-    LOG(ERROR) << "usage: gltf_viewer <gltf_file>\n";
+  std::string trace_file;
+  bool optimize_meshes = false;
+  bool usage_ok = argc >= 2;
+  for (int i = 2; usage_ok && i < argc; i += 2) {
+    const std::string option = argv[i];
+    usage_ok = i + 1 < argc;
+    if (usage_ok && option == "--trace") {
+      trace_file = argv[i + 1];
+    } else if (usage_ok && option == "--optimize-meshes") {
+      const std::string value = argv[i + 1];
+      usage_ok = value == "on" || value == "off";
+      optimize_meshes = value == "on";
+    } else {
+      usage_ok = false;
+    }
+  }
+  if (!usage_ok) {
+    LOG(ERROR) << "usage: gltf_viewer <gltf_file> [--trace <json_file>] "
+                  "[--optimize-meshes <on|off>]\n";
     return -1;
   }
+  if (!trace_file.empty()) {
+    zrl::Trace::Start();
+  }
   LOG(INFO) << "main: loading input model\n";
   tinygltf::Model model;
   tinygltf::TinyGLTF loader;
+  // Images are decoded in the background while the model and the renderer
+  // are set up, and picked up by the material binder.
+  base_dir = tinygltf::GetBaseDir(argv[1]);
+  ThreadPool thread_pool;
+  workers = &thread_pool;
+  zrl::support::gltf::ImageDecoder decoder(thread_pool, base_dir);
+  decoder.Attach(loader);
   std::string err;
   std::string warn;
-  bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, argv[1]);
+  zrl::support::gltf::ModelBuffers buffers;
+  model_buffers = &buffers;
+  bool ret = buffers.Load(loader, argv[1], &model, &err, &warn);
   if (!warn.empty()) {
     LOG(WARNING) << warn << "\n";
   }
@@ -446,17 +604,33 @@ int main(int argc, char *argv[]) {
     LOG(ERROR) << "failed to parse glTF\n";
     return -1;
   }
-  base_dir = tinygltf::GetBaseDir(argv[1]);
+  zrl::support::gltf::TextureCache textures(model, base_dir, decoder);
+  texture_cache = &textures;
+  if (optimize_meshes) {
+    buffers.OptimizePrimitives(model, thread_pool);
+  }
 
   LOG(INFO) << "main: creating renderer\n";
+  const auto startup_begin = std::chrono::steady_clock::now();
   const zrl::Config config{/* app_name */ "gltf-viewer",
                            /* engine_name */ "zrl",
                            /* width */ 1920,
                            /* height */ 1080,
                            /* fullscreen*/ false,
-                           /* debug*/ true};
+                           /* debug*/ true,
+                           /* pipeline_cache_path */
+                           "gltf-viewer.pipeline_cache"};
   zrl::Core core(config);
+  ibl_core = &core;
+  decoder.SetDevice(core.GetLogicalDevice());
   PBR renderer(core);
+  LOG(INFO) << "main: startup took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - startup_begin)
+                   .count()
+            << "ms with a "
+            << (core.IsPipelineCacheWarm() ? "warm" : "cold")
+            << " pipeline cache\n";
   Global global;
   Camera camera(30.0f);
   std::vector<Node> nodes;
@@ -473,14 +647,33 @@ int main(int argc, char *argv[]) {
   for (int i : model.scenes[model.defaultScene].nodes) {
     AddNodes(model, model.nodes[i], glm::fmat4(1.0), nodes);
   }
+  Bvh bvh;
+  bvh.Build(GetBounds(nodes), &thread_pool);
+  std::vector<Node> visible;
 
   const std::string env_name = "papermill";
+  // Only the CPU side and the frame pacing are measured: GPU timings are not
+  // collected until the generated renderer records its passes with
+  // CmdBeginGpu() and CmdEndGpu().
+  Profiler profiler;
 
   using namespace std::chrono_literals;
-  FpsCounter fps_counter(core.GetWindow(), 1s);
+  auto title_update = std::chrono::steady_clock::now();
   glfwSetInputMode(core.GetWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
   while (!glfwWindowShouldClose(core.GetWindow())) {
-    fps_counter.Update();
+    profiler.BeginFrame();
+    const auto now = std::chrono::steady_clock::now();
+    if (now - title_update >= 1s && profiler.GetFrameCount() > 0) {
+      const Profiler::Percentiles frame_times = profiler.GetFrameTimes();
+      std::stringstream title;
+      title << std::fixed << std::setprecision(2)
+            << "FPS=" << 1000.0 / frame_times.p50
+            << " frame_time p50=" << frame_times.p50
+            << "ms p99=" << frame_times.p99 << "ms drawn=" << visible.size()
+            << "/" << nodes.size();
+      glfwSetWindowTitle(core.GetWindow(), title.str().c_str());
+      title_update = now;
+    }
     HandleInput(core.GetWindow(), camera, global.debugMode);
 
     glm::fmat4 proj = glm::perspective(
@@ -489,7 +682,18 @@ int main(int argc, char *argv[]) {
     global.projView = proj * view;
     global.cameraPosition = glm::fvec4(camera.Eye(), 1.0);
 
-    renderer.Render(global, env_name, nodes);
+    CullNodes(bvh, global.projView, nodes, visible, profiler);
+    PickNode(core.GetWindow(), bvh, global.projView, nodes);
+    auto scope = profiler.Cpu("render");
+    TRACE_SCOPE("PBR::Render");
+    renderer.Render(global, env_name, visible);
+    ReleaseUploadedTextures(core);
+  }
+  profiler.BeginFrame();
+  profiler.Report(std::cout);
+  profiler.Dump("gltf-viewer.profile.csv");
+  if (!trace_file.empty()) {
+    zrl::Trace::Stop(trace_file);
   }
   return 0;
 }
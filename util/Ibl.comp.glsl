@@ -0,0 +1,176 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Computes the image based lighting of an environment, see util/ibl.h. The
+// pipeline is specialized for each output:
+//   0: the irradiance cube map,
+//   1: a level of the GGX prefiltered specular cube map,
+//   2: the split-sum BRDF lookup table.
+// Cube map outputs are dispatched with one z slice per face. Texels are
+// written as RGBA16F.
+
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(constant_id = 0) const uint kOutput = 0;
+
+layout(binding = 0) uniform samplerCube radiance;
+
+layout(std430, binding = 1) writeonly buffer Texels { uvec2 texels[]; };
+
+layout(push_constant) uniform Params {
+  // First texel of the output in texels.
+  uint offset;
+  // Width and height of the output, or of each of its faces.
+  uint size;
+  uint sampleCount;
+  float roughness;
+};
+
+const float kPI = 3.14159265358979;
+const float kHalfMax = 65504.0;
+
+vec2 Hammersley(uint i, uint n) {
+  return vec2(float(i) / float(n), float(bitfieldReverse(i)) * 2.3283064e-10);
+}
+
+// Direction through the center of a texel of a cube map face, with the face
+// orientations of the Vulkan specification.
+vec3 CubeDirection(uint face, uvec2 texel) {
+  const vec2 uv = (vec2(texel) + 0.5) / float(size) * 2.0 - 1.0;
+  vec3 dir;
+  switch (int(face)) {
+  case 0: dir = vec3(1.0, -uv.y, -uv.x); break;
+  case 1: dir = vec3(-1.0, -uv.y, uv.x); break;
+  case 2: dir = vec3(uv.x, 1.0, uv.y); break;
+  case 3: dir = vec3(uv.x, -1.0, -uv.y); break;
+  case 4: dir = vec3(uv.x, -uv.y, 1.0); break;
+  default: dir = vec3(-uv.x, -uv.y, -1.0); break;
+  }
+  return normalize(dir);
+}
+
+// Maps directions around +z to directions around n.
+mat3 TangentFrame(vec3 n) {
+  const vec3 up =
+      abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+  const vec3 t = normalize(cross(up, n));
+  return mat3(t, cross(n, t), n);
+}
+
+// Half vector around +z distributed as D * cos(theta) for GGX.
+vec3 SampleGGX(vec2 xi, float alpha) {
+  const float cosTheta =
+      sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+  const float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+  const float phi = 2.0 * kPI * xi.x;
+  return vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+float DistributionGGX(float NdotH, float alpha) {
+  const float a2 = alpha * alpha;
+  const float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+  return a2 / (kPI * d * d);
+}
+
+// Level of the radiance whose texels cover the solid angle of one sample of
+// the given density, so that few samples still see the whole lobe. The
+// level is never sharper than the output resolution.
+float SampleLod(float pdf) {
+  const float sourceSize = float(textureSize(radiance, 0).x);
+  const float texelAngle = 4.0 * kPI / (6.0 * sourceSize * sourceSize);
+  const float sampleAngle = 1.0 / (float(sampleCount) * pdf + 1e-6);
+  const float minLod = max(log2(sourceSize / float(size)), 0.0);
+  return max(0.5 * log2(sampleAngle / texelAngle) + 1.0, minLod);
+}
+
+// Cosine weighted average of the radiance, which is the irradiance over pi.
+vec3 Irradiance(vec3 n) {
+  const mat3 frame = TangentFrame(n);
+  vec3 sum = vec3(0.0);
+  for (uint i = 0; i < sampleCount; ++i) {
+    const vec2 xi = Hammersley(i, sampleCount);
+    const float r = sqrt(xi.y);
+    const float phi = 2.0 * kPI * xi.x;
+    const vec3 l = vec3(r * cos(phi), r * sin(phi), sqrt(1.0 - xi.y));
+    sum += textureLod(radiance, frame * l, SampleLod(l.z / kPI)).rgb;
+  }
+  return sum / float(sampleCount);
+}
+
+// Radiance convolved with the GGX lobe around n, assuming the view
+// direction is n as in the split-sum approximation.
+vec3 Prefilter(vec3 n) {
+  if (roughness == 0.0) {
+    return textureLod(radiance, n, SampleLod(1e30)).rgb;
+  }
+  const float alpha = roughness * roughness;
+  const mat3 frame = TangentFrame(n);
+  vec3 sum = vec3(0.0);
+  float weight = 0.0;
+  for (uint i = 0; i < sampleCount; ++i) {
+    const vec3 h = SampleGGX(Hammersley(i, sampleCount), alpha);
+    const vec3 l = 2.0 * h.z * h - vec3(0.0, 0.0, 1.0);
+    if (l.z > 0.0) {
+      // With v = n, the density of l is D / 4.
+      const float pdf = DistributionGGX(h.z, alpha) / 4.0;
+      sum += textureLod(radiance, frame * l, SampleLod(pdf)).rgb * l.z;
+      weight += l.z;
+    }
+  }
+  return sum / max(weight, 1e-6);
+}
+
+// Scale and bias applied to F0 by the specular term, for a view angle and a
+// perceptual roughness.
+vec2 IntegrateBrdf(float NdotV, float perceptualRoughness) {
+  const vec3 v = vec3(sqrt(1.0 - NdotV * NdotV), 0.0, NdotV);
+  const float alpha = perceptualRoughness * perceptualRoughness;
+  // Smith-Schlick geometric shadowing, with k remapped for IBL.
+  const float k = alpha / 2.0;
+  vec2 sum = vec2(0.0);
+  for (uint i = 0; i < sampleCount; ++i) {
+    const vec3 h = SampleGGX(Hammersley(i, sampleCount), alpha);
+    const vec3 l = 2.0 * dot(v, h) * h - v;
+    const float NdotL = l.z;
+    if (NdotL > 0.0) {
+      const float VdotH = max(dot(v, h), 0.0);
+      const float G = NdotV / (NdotV * (1.0 - k) + k) * NdotL /
+                      (NdotL * (1.0 - k) + k);
+      const float visibility = G * VdotH / (h.z * NdotV);
+      const float Fc = pow(1.0 - VdotH, 5.0);
+      sum += vec2((1.0 - Fc) * visibility, Fc * visibility);
+    }
+  }
+  return sum / float(sampleCount);
+}
+
+void main() {
+  const uvec3 id = gl_GlobalInvocationID;
+  if (id.x >= size || id.y >= size) {
+    return;
+  }
+  vec4 color = vec4(0.0, 0.0, 0.0, 1.0);
+  if (kOutput == 2) {
+    color.rg = IntegrateBrdf((float(id.x) + 0.5) / float(size),
+                             (float(id.y) + 0.5) / float(size));
+  } else {
+    const vec3 n = CubeDirection(id.z, id.xy);
+    color.rgb = kOutput == 0 ? Irradiance(n) : Prefilter(n);
+  }
+  color = min(color, vec4(kHalfMax));
+  texels[offset + (id.z * size + id.y) * size + id.x] =
+      uvec2(packHalf2x16(color.rg), packHalf2x16(color.ba));
+}
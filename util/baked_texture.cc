@@ -0,0 +1,124 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/baked_texture.h"
+
+#include <vector>
+
+#include "core/AtomicFile.h"
+#include "core/Log.h"
+
+// "ZRLT"
+constexpr uint32_t kBakedTextureMagic = 0x544c525a;
+constexpr uint32_t kBakedTextureVersion = 3;
+constexpr uint64_t kBakedLevelAlignment = 16;
+constexpr const char *kBakedTextureExtension = ".zrltex";
+
+std::unique_ptr<BakedTexture> BakedTexture::Open(const std::string &filename) {
+  if (!zrl::MappedFile::Exists(filename)) {
+    return nullptr;
+  }
+  std::unique_ptr<zrl::MappedFile> file(new zrl::MappedFile(filename));
+  const uint64_t size = file->GetSize();
+  if (size < sizeof(BakedTextureHeader)) {
+    LOG(WARNING) << "BakedTexture: '" << filename << "' is truncated\n";
+    return nullptr;
+  }
+  const auto *header =
+      reinterpret_cast<const BakedTextureHeader *>(file->GetData());
+  if (header->magic != kBakedTextureMagic ||
+      header->version != kBakedTextureVersion || header->level_count == 0) {
+    LOG(WARNING) << "BakedTexture: '" << filename
+                 << "' is not a baked texture of version "
+                 << kBakedTextureVersion << "\n";
+    return nullptr;
+  }
+  const uint64_t table_end = sizeof(BakedTextureHeader) +
+                             header->level_count * sizeof(BakedTextureLevel);
+  if (table_end > size) {
+    LOG(WARNING) << "BakedTexture: '" << filename << "' is truncated\n";
+    return nullptr;
+  }
+  const auto *levels = reinterpret_cast<const BakedTextureLevel *>(header + 1);
+  for (uint32_t level = 0; level < header->level_count; ++level) {
+    if (levels[level].offset < table_end ||
+        levels[level].offset % kBakedLevelAlignment != 0 ||
+        levels[level].size > size - levels[level].offset) {
+      LOG(WARNING) << "BakedTexture: '" << filename << "' level " << level
+                   << " is out of bounds\n";
+      return nullptr;
+    }
+  }
+  // The levels are read in full by the upload, let the kernel read them
+  // ahead in the meantime.
+  file->WillNeed(0, size);
+  return std::unique_ptr<BakedTexture>(new BakedTexture(std::move(file)));
+}
+
+bool BakedTexture::Write(const std::string &filename, VkFormat format,
+                         uint64_t source_hash,
+                         const std::vector<Level> &levels) {
+  CHECK_ARG(!levels.empty(), "a baked texture needs at least one level");
+  BakedTextureHeader header = {};
+  header.magic = kBakedTextureMagic;
+  header.version = kBakedTextureVersion;
+  header.format = static_cast<uint32_t>(format);
+  header.width = levels[0].width;
+  header.height = levels[0].height;
+  header.level_count = static_cast<uint32_t>(levels.size());
+  header.source_hash = source_hash;
+
+  std::vector<BakedTextureLevel> table(levels.size());
+  uint64_t offset = sizeof(header) + table.size() * sizeof(BakedTextureLevel);
+  for (size_t i = 0; i < levels.size(); ++i) {
+    offset = (offset + kBakedLevelAlignment - 1) / kBakedLevelAlignment *
+             kBakedLevelAlignment;
+    table[i].offset = offset;
+    table[i].size = levels[i].data.size();
+    table[i].width = levels[i].width;
+    table[i].height = levels[i].height;
+    offset += table[i].size;
+  }
+
+  // Each level is preceded by zeros up to its aligned offset.
+  static const uint8_t kPadding[kBakedLevelAlignment] = {};
+  std::vector<zrl::FileChunk> chunks = {
+      {&header, sizeof(header)},
+      {table.data(), table.size() * sizeof(BakedTextureLevel)}};
+  uint64_t end = sizeof(header) + table.size() * sizeof(BakedTextureLevel);
+  for (size_t i = 0; i < levels.size(); ++i) {
+    chunks.push_back({kPadding, static_cast<size_t>(table[i].offset - end)});
+    chunks.push_back({levels[i].data.data(), levels[i].data.size()});
+    end = table[i].offset + table[i].size;
+  }
+  const bool ok = zrl::WriteFileAtomically(filename, chunks);
+  if (!ok) {
+    LOG(WARNING) << "BakedTexture: failed to write '" << filename << "'\n";
+  }
+  return ok;
+}
+
+std::string BakedTexture::PathFor(const std::string &base_dir,
+                                  const std::string &uri, int image) {
+  if (uri.empty() || uri.compare(0, 5, "data:") == 0) {
+    return base_dir + "/image" + std::to_string(image) +
+           kBakedTextureExtension;
+  }
+  return base_dir + "/" + uri + kBakedTextureExtension;
+}
+
+BakedTexture::BakedTexture(std::unique_ptr<zrl::MappedFile> file)
+    : file_(std::move(file)),
+      header_(reinterpret_cast<const BakedTextureHeader *>(file_->GetData())),
+      levels_(reinterpret_cast<const BakedTextureLevel *>(header_ + 1)) {}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BAKED_TEXTURE_H_
+#define BAKED_TEXTURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "core/MappedFile.h"
+
+// File layout of a baked texture, in host byte order:
+//   BakedTextureHeader
+//   BakedTextureLevel[level_count]
+//   the levels, each starting at a multiple of 16 bytes.
+struct BakedTextureHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format; // VkFormat
+  uint32_t width;
+  uint32_t height;
+  uint32_t level_count;
+  // HashBytes() of the encoded image it was baked from, to detect stale
+  // files.
+  uint64_t source_hash;
+};
+
+struct BakedTextureLevel {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t width;
+  uint32_t height;
+};
+
+// A texture with a precomputed mip chain, ready to be copied to the GPU as
+// is. The file is memory-mapped, so that loading it costs no more than
+// reading it.
+class BakedTexture {
+public:
+  struct Level {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+  };
+
+  // Returns nullptr if the file does not exist or is not a valid baked
+  // texture.
+  static std::unique_ptr<BakedTexture> Open(const std::string &filename);
+  static bool Write(const std::string &filename, VkFormat format,
+                    uint64_t source_hash, const std::vector<Level> &levels);
+  // Path of the baked version of an image of a glTF model. Images without an
+  // external file are named after their index.
+  static std::string PathFor(const std::string &base_dir,
+                             const std::string &uri, int image);
+
+  VkFormat GetFormat() const { return static_cast<VkFormat>(header_->format); }
+  uint32_t GetWidth() const { return header_->width; }
+  uint32_t GetHeight() const { return header_->height; }
+  uint32_t GetLevelCount() const { return header_->level_count; }
+  uint64_t GetSourceHash() const { return header_->source_hash; }
+  const uint8_t *GetLevelData(uint32_t level) const {
+    return file_->GetData() + levels_[level].offset;
+  }
+  uint64_t GetLevelSize(uint32_t level) const { return levels_[level].size; }
+
+private:
+  explicit BakedTexture(std::unique_ptr<zrl::MappedFile> file);
+
+  std::unique_ptr<zrl::MappedFile> file_;
+  const BakedTextureHeader *header_;
+  const BakedTextureLevel *levels_;
+};
+
+#endif // BAKED_TEXTURE_H_
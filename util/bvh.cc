@@ -0,0 +1,411 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <utility>
+
+#include "util/frustum_culler.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+// Number of buckets the centroids are sorted into to evaluate the split
+// costs.
+constexpr int kBinCount = 16;
+constexpr uint32_t kMaxLeafSize = 4;
+// The cost of visiting an inner node, relative to testing a box.
+constexpr float kTraversalCost = 1.0f;
+// Subtrees with fewer boxes are built by a single task.
+constexpr uint32_t kMinTaskSize = 4096;
+
+struct Bounds {
+  float min[3] = {kInfinity, kInfinity, kInfinity};
+  float max[3] = {-kInfinity, -kInfinity, -kInfinity};
+
+  void Grow(const float min_point[3], const float max_point[3]) {
+    for (int i = 0; i < 3; ++i) {
+      min[i] = std::min(min[i], min_point[i]);
+      max[i] = std::max(max[i], max_point[i]);
+    }
+  }
+
+  void Grow(const Bounds &other) { Grow(other.min, other.max); }
+
+  float HalfArea() const {
+    const float x = max[0] - min[0];
+    const float y = max[1] - min[1];
+    const float z = max[2] - min[2];
+    return x * y + y * z + z * x;
+  }
+};
+
+} // namespace
+
+// Builds the nodes of a subtree by recursively splitting a range of boxes.
+// The boxes are moved around with their centroids and indices rather than
+// through an index array, so that each split reads them in order.
+class Bvh::Builder {
+public:
+  struct Task {
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  explicit Builder(const std::vector<Box> &boxes) : refs_(boxes.size()) {
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      Ref &ref = refs_[i];
+      ref.box = boxes[i];
+      ref.index = static_cast<uint32_t>(i);
+      // Infinite boxes are put at the origin so that they don't make the
+      // centroid bounds infinite.
+      for (int axis = 0; axis < 3; ++axis) {
+        const float c = 0.5f * (ref.box.min[axis] + ref.box.max[axis]);
+        ref.centroid[axis] = std::isfinite(c) ? c : 0.0f;
+      }
+    }
+  }
+
+  // Splits the boxes in [begin, end) under nodes[node], which must exist.
+  // Subtrees of at most task_size boxes are added to tasks instead of
+  // being split, unless tasks is null. Tasks on disjoint ranges can run
+  // concurrently.
+  void Split(std::vector<Node> &nodes, uint32_t node, uint32_t begin,
+             uint32_t end, uint32_t task_size, std::vector<Task> *tasks) {
+    if (tasks != nullptr && end - begin <= task_size) {
+      tasks->push_back({node, begin, end});
+      return;
+    }
+    Bounds bounds, centroids;
+    for (uint32_t i = begin; i < end; ++i) {
+      bounds.Grow(refs_[i].box.min, refs_[i].box.max);
+      centroids.Grow(refs_[i].centroid, refs_[i].centroid);
+    }
+    std::copy(bounds.min, bounds.min + 3, nodes[node].min);
+    std::copy(bounds.max, bounds.max + 3, nodes[node].max);
+    const uint32_t count = end - begin;
+    if (count == 1) {
+      MakeLeaf(nodes[node], begin, end);
+      return;
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+      if (centroids.max[i] - centroids.min[i] >
+          centroids.max[axis] - centroids.min[axis]) {
+        axis = i;
+      }
+    }
+    const float offset = centroids.min[axis];
+    const float extent = centroids.max[axis] - offset;
+    const auto first = refs_.begin() + begin;
+    const auto last = refs_.begin() + end;
+    auto mid = first;
+    if (extent > 0.0f) {
+      // The split after the bin that minimizes the area weighted box counts
+      // of both sides.
+      const float scale = kBinCount / extent;
+      const auto bin = [&](const Ref &ref) {
+        const int b =
+            static_cast<int>((ref.centroid[axis] - offset) * scale);
+        return std::min(b, kBinCount - 1);
+      };
+      Bounds bin_bounds[kBinCount];
+      uint32_t bin_counts[kBinCount] = {};
+      for (auto ref = first; ref != last; ++ref) {
+        const int b = bin(*ref);
+        bin_bounds[b].Grow(ref->box.min, ref->box.max);
+        ++bin_counts[b];
+      }
+      float right_costs[kBinCount];
+      Bounds right;
+      uint32_t right_count = 0;
+      for (int b = kBinCount - 1; b > 0; --b) {
+        right.Grow(bin_bounds[b]);
+        right_count += bin_counts[b];
+        right_costs[b] = right_count * right.HalfArea();
+      }
+      float best_cost = kInfinity;
+      int best_split = 0;
+      Bounds left;
+      uint32_t left_count = 0;
+      for (int b = 0; b < kBinCount - 1; ++b) {
+        left.Grow(bin_bounds[b]);
+        left_count += bin_counts[b];
+        const float cost = left_count * left.HalfArea() + right_costs[b + 1];
+        if (left_count > 0 && left_count < count && cost < best_cost) {
+          best_cost = cost;
+          best_split = b;
+        }
+      }
+      if (count <= kMaxLeafSize &&
+          kTraversalCost + best_cost / bounds.HalfArea() >= count) {
+        MakeLeaf(nodes[node], begin, end);
+        return;
+      }
+      if (best_cost < kInfinity) {
+        mid = std::partition(first, last, [&](const Ref &ref) {
+          return bin(ref) <= best_split;
+        });
+      }
+    } else if (count <= kMaxLeafSize) {
+      MakeLeaf(nodes[node], begin, end);
+      return;
+    }
+    if (mid == first || mid == last) {
+      // The boxes are on top of each other or have infinite areas, halve
+      // them.
+      mid = first + count / 2;
+      std::nth_element(first, mid, last, [axis](const Ref &a, const Ref &b) {
+        return a.centroid[axis] < b.centroid[axis];
+      });
+    }
+
+    const uint32_t split = static_cast<uint32_t>(mid - refs_.begin());
+    const uint32_t left_child = static_cast<uint32_t>(nodes.size());
+    nodes[node].first = left_child;
+    nodes[node].count = 0;
+    nodes.resize(nodes.size() + 2);
+    Split(nodes, left_child, begin, split, task_size, tasks);
+    Split(nodes, left_child + 1, split, end, task_size, tasks);
+  }
+
+  // Sets boxes and indices to the boxes in leaf order and their indices.
+  void GetLeafOrder(std::vector<Box> &boxes,
+                    std::vector<uint32_t> &indices) const {
+    boxes.resize(refs_.size());
+    indices.resize(refs_.size());
+    for (size_t i = 0; i < refs_.size(); ++i) {
+      boxes[i] = refs_[i].box;
+      indices[i] = refs_[i].index;
+    }
+  }
+
+private:
+  struct Ref {
+    Box box;
+    float centroid[3];
+    uint32_t index;
+  };
+
+  static void MakeLeaf(Node &node, uint32_t begin, uint32_t end) {
+    node.first = begin;
+    node.count = end - begin;
+  }
+
+  std::vector<Ref> refs_;
+};
+
+void Bvh::Build(const std::vector<Box> &boxes, ThreadPool *pool) {
+  nodes_.clear();
+  boxes_.clear();
+  indices_.clear();
+  if (boxes.empty()) {
+    return;
+  }
+  Builder builder(boxes);
+  const uint32_t count = static_cast<uint32_t>(boxes.size());
+  nodes_.resize(1);
+  if (pool == nullptr || count < 2 * kMinTaskSize) {
+    builder.Split(nodes_, 0, 0, count, 0, nullptr);
+  } else {
+    // The top of the tree is split on this thread into a few tasks per
+    // thread, which build their subtrees into separate node arrays that are
+    // then appended to nodes_.
+    const uint32_t task_size = std::max(
+        kMinTaskSize,
+        count / static_cast<uint32_t>(4 * pool->GetThreadCount()));
+    std::vector<Builder::Task> tasks;
+    builder.Split(nodes_, 0, 0, count, task_size, &tasks);
+    std::vector<std::future<std::vector<Node>>> subtrees;
+    for (const Builder::Task &task : tasks) {
+      subtrees.push_back(pool->Submit([&builder, task] {
+        std::vector<Node> nodes(1);
+        builder.Split(nodes, 0, task.begin, task.end, 0, nullptr);
+        return nodes;
+      }));
+    }
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      std::vector<Node> nodes = subtrees[i].get();
+      // The root of the subtree takes the place of the task, and its other
+      // nodes are shifted from index 1 to the end of nodes_.
+      const uint32_t shift = static_cast<uint32_t>(nodes_.size()) - 1;
+      for (Node &node : nodes) {
+        if (node.count == 0) {
+          node.first += shift;
+        }
+      }
+      nodes_[tasks[i].node] = nodes[0];
+      nodes_.insert(nodes_.end(), nodes.begin() + 1, nodes.end());
+    }
+  }
+  builder.GetLeafOrder(boxes_, indices_);
+}
+
+void Bvh::Refit(const std::vector<Box> &boxes) {
+  for (size_t i = 0; i < boxes_.size(); ++i) {
+    boxes_[i] = boxes[indices_[i]];
+  }
+  // Children come after their parent, so walking backwards refits them
+  // first.
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    Node &node = nodes_[i];
+    Bounds bounds;
+    if (node.count > 0) {
+      for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+        bounds.Grow(boxes_[j].min, boxes_[j].max);
+      }
+    } else {
+      bounds.Grow(nodes_[node.first].min, nodes_[node.first].max);
+      bounds.Grow(nodes_[node.first + 1].min, nodes_[node.first + 1].max);
+    }
+    std::copy(bounds.min, bounds.min + 3, node.min);
+    std::copy(bounds.max, bounds.max + 3, node.max);
+  }
+}
+
+void Bvh::Cull(const float view_proj[16],
+               std::vector<uint32_t> &visible) const {
+  visible.clear();
+  if (nodes_.empty()) {
+    return;
+  }
+  float planes[6][4];
+  FrustumCuller::GetPlanes(view_proj, planes);
+  // Whether a box is outside of the planes in mask. Planes the box is
+  // inside of are removed from mask, as the boxes below it are inside them
+  // too.
+  const auto outside = [&planes](const float min[3], const float max[3],
+                                 uint32_t &mask) {
+    for (int p = 0; p < 6; ++p) {
+      if ((mask & (1 << p)) == 0) {
+        continue;
+      }
+      const float *plane = planes[p];
+      float furthest = plane[3];
+      float nearest = plane[3];
+      for (int i = 0; i < 3; ++i) {
+        furthest += plane[i] * (plane[i] >= 0.0f ? max[i] : min[i]);
+        nearest += plane[i] * (plane[i] >= 0.0f ? min[i] : max[i]);
+      }
+      if (furthest < 0.0f) {
+        return true;
+      }
+      if (nearest >= 0.0f) {
+        mask &= ~(1u << p);
+      }
+    }
+    return false;
+  };
+
+  // Nodes to visit, with the planes they may be outside of.
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  stack.reserve(64);
+  stack.push_back({0, 0x3f});
+  while (!stack.empty()) {
+    const Node &node = nodes_[stack.back().first];
+    uint32_t mask = stack.back().second;
+    stack.pop_back();
+    if (mask != 0 && outside(node.min, node.max, mask)) {
+      continue;
+    }
+    if (node.count == 0) {
+      stack.push_back({node.first + 1, mask});
+      stack.push_back({node.first, mask});
+      continue;
+    }
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+      uint32_t box_mask = mask;
+      if (mask == 0 || !outside(boxes_[i].min, boxes_[i].max, box_mask)) {
+        visible.push_back(indices_[i]);
+      }
+    }
+  }
+}
+
+int64_t Bvh::Pick(const float origin[3], const float direction[3],
+                  float &distance) const {
+  if (nodes_.empty()) {
+    return -1;
+  }
+  float inverse[3];
+  for (int i = 0; i < 3; ++i) {
+    inverse[i] = 1.0f / direction[i];
+  }
+  // Returns the ray parameter where the ray enters a box, or infinity if it
+  // misses it.
+  const auto enter = [&](const float min[3], const float max[3]) {
+    float t_enter = 0.0f;
+    float t_exit = kInfinity;
+    for (int i = 0; i < 3; ++i) {
+      float t0 = (min[i] - origin[i]) * inverse[i];
+      float t1 = (max[i] - origin[i]) * inverse[i];
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      // Written so that NaNs, from a ray in the plane of a face, keep the
+      // current bounds.
+      t_enter = t0 > t_enter ? t0 : t_enter;
+      t_exit = t1 < t_exit ? t1 : t_exit;
+    }
+    return t_enter <= t_exit ? t_enter : kInfinity;
+  };
+
+  int64_t closest = -1;
+  distance = kInfinity;
+  std::vector<std::pair<uint32_t, float>> stack;
+  stack.reserve(64);
+  stack.push_back({0, enter(nodes_[0].min, nodes_[0].max)});
+  while (!stack.empty()) {
+    const Node &node = nodes_[stack.back().first];
+    const float t = stack.back().second;
+    stack.pop_back();
+    if (t >= distance) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        const float box_t = enter(boxes_[i].min, boxes_[i].max);
+        if (box_t < distance) {
+          distance = box_t;
+          closest = indices_[i];
+        }
+      }
+      continue;
+    }
+    // Visits the nearest child first, so that the other one can be skipped
+    // once a closer box is found.
+    std::pair<uint32_t, float> left = {
+        node.first, enter(nodes_[node.first].min, nodes_[node.first].max)};
+    std::pair<uint32_t, float> right = {
+        node.first + 1,
+        enter(nodes_[node.first + 1].min, nodes_[node.first + 1].max)};
+    if (left.second < right.second) {
+      std::swap(left, right);
+    }
+    if (left.second < distance) {
+      stack.push_back(left);
+    }
+    if (right.second < distance) {
+      stack.push_back(right);
+    }
+  }
+  return closest;
+}
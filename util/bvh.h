@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Bounding volume hierarchy over world space axis aligned boxes, for
+// frustum culling and picking scenes too large to test box by box. Subtrees
+// that are entirely inside or outside the frustum are accepted or rejected
+// with a single test.
+class Bvh {
+public:
+  struct Box {
+    float min[3];
+    float max[3];
+  };
+
+  // Builds the hierarchy over boxes with the surface area heuristic. Large
+  // subtrees are built on pool when it is not null. Boxes with infinite
+  // bounds are never culled.
+  void Build(const std::vector<Box> &boxes, ThreadPool *pool = nullptr);
+  // Updates the bounds of the hierarchy after boxes moved, keeping its
+  // topology. boxes must hold as many boxes as in the last Build(). This is
+  // much cheaper than a rebuild, but queries slow down as the boxes move
+  // away from where they were when it was built.
+  void Refit(const std::vector<Box> &boxes);
+
+  // Replaces visible by the indices of the boxes that intersect the frustum
+  // of view_proj, as FrustumCuller::Cull() does but in no particular order.
+  void Cull(const float view_proj[16], std::vector<uint32_t> &visible) const;
+  // Returns the index of the first box entered by the ray from origin along
+  // direction and sets distance to the ray parameter where it enters it,
+  // which is 0 if origin is inside. Returns -1 if the ray misses every box.
+  int64_t Pick(const float origin[3], const float direction[3],
+               float &distance) const;
+
+  size_t GetBoxCount() const { return boxes_.size(); }
+  size_t GetNodeCount() const { return nodes_.size(); }
+
+private:
+  // 32 bytes, so that both children of a node share a cache line. Children
+  // are adjacent and stored after their parent.
+  struct Node {
+    float min[3];
+    // The first child of an inner node, or the first box of a leaf in
+    // boxes_.
+    uint32_t first;
+    float max[3];
+    // The number of boxes of a leaf, 0 for inner nodes.
+    uint32_t count;
+  };
+
+  class Builder;
+
+  std::vector<Node> nodes_;
+  // The boxes in leaf order, and their indices in the boxes given to
+  // Build().
+  std::vector<Box> boxes_;
+  std::vector<uint32_t> indices_;
+};
+
+#endif // BVH_H_
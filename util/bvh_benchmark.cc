@@ -0,0 +1,134 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Measures building, refitting, culling and picking with Bvh on scenes of
+// 1k to 1M boxes, against culling every box with FrustumCuller.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "util/bvh.h"
+#include "util/frustum_culler.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+constexpr int kRepetitions = 20;
+constexpr int kPicks = 1000;
+
+// A column-major perspective projection with a Vulkan clip volume, looking
+// along +z from the origin.
+void Perspective(float fovy, float aspect, float z_near, float z_far,
+                 float m[16]) {
+  std::fill(m, m + 16, 0.0f);
+  const float t = std::tan(fovy / 2);
+  m[0] = 1 / (aspect * t);
+  m[5] = 1 / t;
+  m[10] = z_far / (z_far - z_near);
+  m[11] = 1;
+  m[14] = -(z_far * z_near) / (z_far - z_near);
+}
+
+// count boxes around the origin, about as dense whatever their number, so
+// that the frustum sees a similar part of every scene.
+std::vector<Bvh::Box> RandomBoxes(std::mt19937 &rng, size_t count) {
+  const float extent = 2 * std::cbrt(static_cast<float>(count));
+  std::uniform_real_distribution<float> position(-extent, extent);
+  std::uniform_real_distribution<float> size(0.01f, 1.0f);
+  std::vector<Bvh::Box> boxes(count);
+  for (auto &box : boxes) {
+    for (int i = 0; i < 3; ++i) {
+      box.min[i] = position(rng);
+      box.max[i] = box.min[i] + size(rng);
+    }
+  }
+  return boxes;
+}
+
+// Returns the best time of f over kRepetitions runs, in milliseconds.
+template <typename F> double Measure(const F &f) {
+  double best = 0.0;
+  for (int i = 0; i < kRepetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    best = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  ThreadPool pool;
+  float view_proj[16];
+  Perspective(1.1f, 16.0f / 9.0f, 0.1f, 100.0f, view_proj);
+
+  for (size_t count : {1000, 10000, 100000, 1000000}) {
+    std::vector<Bvh::Box> boxes = RandomBoxes(rng, count);
+    Bvh bvh;
+    const double build_ms = Measure([&] { bvh.Build(boxes); });
+    const double pool_build_ms = Measure([&] { bvh.Build(boxes, &pool); });
+    FrustumCuller culler;
+    for (const auto &box : boxes) {
+      culler.AddBox(box.min, box.max);
+    }
+
+    std::vector<uint32_t> visible;
+    const double cull_ms = Measure([&] { bvh.Cull(view_proj, visible); });
+    const size_t visible_count = visible.size();
+    const double flat_cull_ms =
+        Measure([&] { culler.Cull(view_proj, visible); });
+
+    std::uniform_real_distribution<float> direction(-1, 1);
+    std::vector<float> directions(3 * kPicks);
+    for (auto &d : directions) {
+      d = direction(rng);
+    }
+    const float origin[3] = {0, 0, 0};
+    const double pick_ms = Measure([&] {
+      float distance;
+      for (int i = 0; i < kPicks; ++i) {
+        bvh.Pick(origin, &directions[3 * i], distance);
+      }
+    });
+
+    std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+    for (auto &box : boxes) {
+      for (int i = 0; i < 3; ++i) {
+        const float offset = jitter(rng);
+        box.min[i] += offset;
+        box.max[i] += offset;
+      }
+    }
+    const double refit_ms = Measure([&] { bvh.Refit(boxes); });
+
+    std::cout << count << " boxes, " << bvh.GetNodeCount() << " nodes:\n"
+              << "  build: " << build_ms << " ms, on " << pool.GetThreadCount()
+              << " threads: " << pool_build_ms << " ms\n"
+              << "  refit: " << refit_ms << " ms\n"
+              << "  cull: " << cull_ms << " ms, FrustumCuller: "
+              << flat_cull_ms << " ms, " << visible_count << " visible\n"
+              << "  pick: " << pick_ms * 1000 / kPicks << " us\n";
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Checks Bvh::Cull against FrustumCuller, before and after a Refit(), and
+// Bvh::Pick against testing the ray against every box, for hierarchies
+// built serially and on a thread pool.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "core/Log.h"
+#include "util/bvh.h"
+#include "util/frustum_culler.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+constexpr int kPicks = 200;
+
+// A column-major perspective projection with a Vulkan clip volume, looking
+// along +z from the origin.
+void Perspective(float fovy, float aspect, float z_near, float z_far,
+                 float m[16]) {
+  std::fill(m, m + 16, 0.0f);
+  const float t = std::tan(fovy / 2);
+  m[0] = 1 / (aspect * t);
+  m[5] = 1 / t;
+  m[10] = z_far / (z_far - z_near);
+  m[11] = 1;
+  m[14] = -(z_far * z_near) / (z_far - z_near);
+}
+
+// count boxes around the origin, about as dense whatever their number. With
+// enough boxes, one is infinite and a few are duplicates.
+std::vector<Bvh::Box> RandomBoxes(std::mt19937 &rng, size_t count) {
+  const float extent = 2 * std::cbrt(static_cast<float>(count));
+  std::uniform_real_distribution<float> position(-extent, extent);
+  std::uniform_real_distribution<float> size(0.01f, 1.0f);
+  std::vector<Bvh::Box> boxes(count);
+  for (auto &box : boxes) {
+    for (int i = 0; i < 3; ++i) {
+      box.min[i] = position(rng);
+      box.max[i] = box.min[i] + size(rng);
+    }
+  }
+  if (count >= 20) {
+    boxes[5] = {{-kInfinity, -kInfinity, -kInfinity},
+                {kInfinity, kInfinity, kInfinity}};
+    std::fill(boxes.begin() + 10, boxes.begin() + 20, boxes[9]);
+  }
+  return boxes;
+}
+
+// Returns where the ray enters box, 0 if origin is inside, or infinity.
+float Enter(const Bvh::Box &box, const float origin[3],
+            const float direction[3]) {
+  float enter = 0, exit = kInfinity;
+  for (int i = 0; i < 3; ++i) {
+    float t0 = (box.min[i] - origin[i]) / direction[i];
+    float t1 = (box.max[i] - origin[i]) / direction[i];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    enter = std::max(enter, t0);
+    exit = std::min(exit, t1);
+  }
+  return enter <= exit ? enter : kInfinity;
+}
+
+std::vector<uint32_t> Cull(const Bvh &bvh, const float view_proj[16]) {
+  std::vector<uint32_t> visible;
+  bvh.Cull(view_proj, visible);
+  std::sort(visible.begin(), visible.end());
+  return visible;
+}
+
+std::vector<uint32_t> Cull(const std::vector<Bvh::Box> &boxes,
+                           const float view_proj[16]) {
+  FrustumCuller culler;
+  for (const auto &box : boxes) {
+    culler.AddBox(box.min, box.max);
+  }
+  std::vector<uint32_t> visible;
+  culler.Cull(view_proj, visible);
+  return visible;
+}
+
+void CheckPick(std::mt19937 &rng, const Bvh &bvh,
+               const std::vector<Bvh::Box> &boxes) {
+  std::uniform_real_distribution<float> direction(-1, 1);
+  for (int i = 0; i < kPicks; ++i) {
+    const float o[3] = {0, 0, 0};
+    const float d[3] = {direction(rng), direction(rng), direction(rng)};
+    float nearest = kInfinity;
+    for (const auto &box : boxes) {
+      nearest = std::min(nearest, Enter(box, o, d));
+    }
+    float distance;
+    const int64_t hit = bvh.Pick(o, d, distance);
+    if (std::isinf(nearest)) {
+      CHECK(hit == -1, "hit box " << hit << " of " << boxes.size());
+      continue;
+    }
+    CHECK(hit >= 0, "missed " << boxes.size() << " boxes");
+    // Ties and rounding may pick another box entered at the same distance.
+    const float tolerance = 1e-4f * (1 + nearest);
+    CHECK(std::fabs(distance - nearest) <= tolerance,
+          distance << " instead of " << nearest);
+    CHECK(std::fabs(Enter(boxes[hit], o, d) - nearest) <= tolerance,
+          "box " << hit << " is not the nearest");
+  }
+}
+
+void TestBvh(std::mt19937 &rng, size_t count, ThreadPool *pool) {
+  float view_proj[16];
+  Perspective(1.1f, 16.0f / 9.0f, 0.1f, 100.0f, view_proj);
+  std::vector<Bvh::Box> boxes = RandomBoxes(rng, count);
+  Bvh bvh;
+  bvh.Build(boxes, pool);
+  CHECK(bvh.GetBoxCount() == count, bvh.GetBoxCount());
+  CHECK(Cull(bvh, view_proj) == Cull(boxes, view_proj), "count " << count);
+  CheckPick(rng, bvh, boxes);
+
+  // Every box but the infinite one moves by up to half its largest size.
+  std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    if (count >= 20 && i == 5) {
+      continue;
+    }
+    for (int j = 0; j < 3; ++j) {
+      const float offset = jitter(rng);
+      boxes[i].min[j] += offset;
+      boxes[i].max[j] += offset;
+    }
+  }
+  bvh.Refit(boxes);
+  CHECK(Cull(bvh, view_proj) == Cull(boxes, view_proj),
+        "refit, count " << count);
+  CheckPick(rng, bvh, boxes);
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  ThreadPool pool(4);
+  for (size_t count : {0, 1, 3, 20, 1000, 100000}) {
+    TestBvh(rng, count, nullptr);
+    TestBvh(rng, count, &pool);
+  }
+  return 0;
+}
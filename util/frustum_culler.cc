@@ -0,0 +1,104 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/frustum_culler.h"
+
+#include "util/simd.h"
+
+uint32_t FrustumCuller::AddBox(const float min[3], const float max[3]) {
+  if (count_ % 4 == 0) {
+    for (auto *bounds :
+         {&min_x_, &min_y_, &min_z_, &max_x_, &max_y_, &max_z_}) {
+      bounds->resize(count_ + 4, 0.0f);
+    }
+  }
+  min_x_[count_] = min[0];
+  min_y_[count_] = min[1];
+  min_z_[count_] = min[2];
+  max_x_[count_] = max[0];
+  max_y_[count_] = max[1];
+  max_z_[count_] = max[2];
+  return static_cast<uint32_t>(count_++);
+}
+
+void FrustumCuller::GetPlanes(const float view_proj[16],
+                              float planes[6][4]) {
+  // A point is inside the clip volume when -w <= x <= w, -w <= y <= w and
+  // 0 <= z <= w, each of which is a plane dot(row, p) >= 0 made of the rows
+  // of the matrix.
+  for (int i = 0; i < 4; ++i) {
+    const float x = view_proj[4 * i];
+    const float y = view_proj[4 * i + 1];
+    const float z = view_proj[4 * i + 2];
+    const float w = view_proj[4 * i + 3];
+    planes[0][i] = w + x;
+    planes[1][i] = w - x;
+    planes[2][i] = w + y;
+    planes[3][i] = w - y;
+    planes[4][i] = z;
+    planes[5][i] = w - z;
+  }
+}
+
+void FrustumCuller::Cull(const float view_proj[16],
+                         std::vector<uint32_t> &visible) const {
+  float planes[6][4];
+  GetPlanes(view_proj, planes);
+  // A box is outside a plane when its corner furthest along the normal of
+  // the plane is.
+  const float *corner[6][3];
+  for (int p = 0; p < 6; ++p) {
+    corner[p][0] = planes[p][0] >= 0.0f ? max_x_.data() : min_x_.data();
+    corner[p][1] = planes[p][1] >= 0.0f ? max_y_.data() : min_y_.data();
+    corner[p][2] = planes[p][2] >= 0.0f ? max_z_.data() : min_z_.data();
+  }
+
+  visible.clear();
+  for (size_t i = 0; i < count_; i += 4) {
+    int outside = 0;
+#ifdef ZRL_SSE2
+    __m128 out = _mm_setzero_ps();
+    for (int p = 0; p < 6; ++p) {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(
+              _mm_mul_ps(_mm_set1_ps(planes[p][0]),
+                         _mm_loadu_ps(corner[p][0] + i)),
+              _mm_mul_ps(_mm_set1_ps(planes[p][1]),
+                         _mm_loadu_ps(corner[p][1] + i))),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p][2]),
+                                _mm_loadu_ps(corner[p][2] + i)),
+                     _mm_set1_ps(planes[p][3])));
+      out = _mm_or_ps(out, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+    }
+    outside = _mm_movemask_ps(out);
+#else
+    for (int lane = 0; lane < 4; ++lane) {
+      for (int p = 0; p < 6; ++p) {
+        const float distance = (planes[p][0] * corner[p][0][i + lane] +
+                                planes[p][1] * corner[p][1][i + lane]) +
+                               (planes[p][2] * corner[p][2][i + lane] +
+                                planes[p][3]);
+        if (distance < 0.0f) {
+          outside |= 1 << lane;
+        }
+      }
+    }
+#endif
+    for (int lane = 0; lane < 4 && i + lane < count_; ++lane) {
+      if ((outside & (1 << lane)) == 0) {
+        visible.push_back(static_cast<uint32_t>(i + lane));
+      }
+    }
+  }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRUSTUM_CULLER_H_
+#define FRUSTUM_CULLER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tests world space axis aligned boxes against a view frustum. The boxes are
+// stored as a structure of arrays, so that SSE2 tests 4 of them against each
+// plane at once.
+class FrustumCuller {
+public:
+  // Adds a box and returns its index. Boxes with infinite bounds are always
+  // visible.
+  uint32_t AddBox(const float min[3], const float max[3]);
+  size_t GetBoxCount() const { return count_; }
+
+  // Replaces visible by the indices of the boxes that intersect the frustum
+  // of view_proj, a column-major matrix with a Vulkan clip volume. Boxes
+  // that only intersect the planes of the frustum near its corners may be
+  // reported as visible.
+  void Cull(const float view_proj[16], std::vector<uint32_t> &visible) const;
+
+  // Sets planes to the frustum planes of view_proj, as (a, b, c, d) such
+  // that a point p is on the inner side of a plane when
+  // a * p.x + b * p.y + c * p.z + d >= 0. The normals are not normalized.
+  static void GetPlanes(const float view_proj[16], float planes[6][4]);
+
+private:
+  size_t count_ = 0;
+  // The bounds of the boxes, padded to a multiple of 4 boxes.
+  std::vector<float> min_x_, min_y_, min_z_;
+  std::vector<float> max_x_, max_y_, max_z_;
+};
+
+#endif // FRUSTUM_CULLER_H_
@@ -0,0 +1,106 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/half.h"
+
+#include <cstring>
+
+#include "util/simd.h"
+
+// Both versions work on the bits of the absolute value:
+// - from 2^16 up, the result is an infinity, or a quiet NaN;
+// - below 2^-14, the result is subnormal. Adding a magic number lines the
+//   mantissa up with that of a half, and the FPU rounds it;
+// - otherwise, the exponent is rebiased and the mantissa rounded by adding
+//   half an ulp, plus one when the result would be odd.
+constexpr uint32_t kF32Infinity = 255u << 23;
+constexpr uint32_t kF16Overflow = (127u + 16) << 23;
+constexpr uint32_t kF16MinNormal = (127u - 14) << 23;
+constexpr uint32_t kSubnormalMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+constexpr uint32_t kNormalBias = 0xfff - ((127u - 15) << 23);
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+  uint32_t half;
+  if (bits >= kF16Overflow) {
+    half = bits > kF32Infinity ? 0x7e00 : 0x7c00;
+  } else if (bits < kF16MinNormal) {
+    float magic;
+    std::memcpy(&magic, &kSubnormalMagic, sizeof(magic));
+    float abs_value;
+    std::memcpy(&abs_value, &bits, sizeof(abs_value));
+    abs_value += magic;
+    std::memcpy(&half, &abs_value, sizeof(half));
+    half -= kSubnormalMagic;
+  } else {
+    const uint32_t odd = (bits >> 13) & 1;
+    half = (bits + kNormalBias + odd) >> 13;
+  }
+  return static_cast<uint16_t>(half | sign >> 16);
+}
+
+#ifdef ZRL_SSE2
+static inline __m128i FloatToHalf4(__m128 value) {
+  const __m128i sign_mask = _mm_set1_epi32(0x80000000u);
+  const __m128i subnormal_magic = _mm_set1_epi32(kSubnormalMagic);
+  const __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(sign_mask));
+  const __m128 abs_value = _mm_xor_ps(value, sign);
+  const __m128i bits = _mm_castps_si128(abs_value);
+
+  const __m128i is_nan =
+      _mm_castps_si128(_mm_cmpunord_ps(abs_value, abs_value));
+  const __m128i is_finite =
+      _mm_cmpgt_epi32(_mm_set1_epi32(kF16Overflow), bits);
+  const __m128i is_subnormal =
+      _mm_cmpgt_epi32(_mm_set1_epi32(kF16MinNormal), bits);
+  const __m128i special = _mm_or_si128(
+      _mm_and_si128(is_nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+  const __m128i subnormal = _mm_sub_epi32(
+      _mm_castps_si128(
+          _mm_add_ps(abs_value, _mm_castsi128_ps(subnormal_magic))),
+      subnormal_magic);
+  // -1 when the result would be odd.
+  const __m128i odd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+  const __m128i normal = _mm_srli_epi32(
+      _mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(kNormalBias)), odd),
+      13);
+
+  const __m128i finite = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal),
+                                      _mm_andnot_si128(is_subnormal, normal));
+  const __m128i half = _mm_or_si128(_mm_and_si128(is_finite, finite),
+                                    _mm_andnot_si128(is_finite, special));
+  // The sign is shifted in arithmetically, so that negative results are
+  // negative 32-bit integers that the signed pack keeps intact.
+  return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+#endif
+
+void FloatToHalf(const float *src, size_t count, uint16_t *dst) {
+  size_t i = 0;
+#ifdef ZRL_SSE2
+  for (; i + 8 <= count; i += 8) {
+    const __m128i lo = FloatToHalf4(_mm_loadu_ps(src + i));
+    const __m128i hi = FloatToHalf4(_mm_loadu_ps(src + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = FloatToHalf(src[i]);
+  }
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HALF_H_
+#define HALF_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Converts a float to an IEEE half float, rounding to nearest even. Values
+// too large for a half become infinities and NaNs stay NaNs.
+uint16_t FloatToHalf(float value);
+
+// Converts count floats, with SSE2 where available. The results are the same
+// as FloatToHalf's bit for bit.
+void FloatToHalf(const float *src, size_t count, uint16_t *dst);
+
+#endif // HALF_H_
@@ -0,0 +1,48 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/hash.h"
+
+#include <cstring>
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed) {
+  constexpr uint64_t kMul = 0xc6a4a7935bd1e995ull;
+  constexpr int kShift = 47;
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = seed ^ (size * kMul);
+  const size_t word_end = size & ~size_t(7);
+  for (size_t i = 0; i < word_end; i += 8) {
+    // Host byte order, as the files that store the hashes.
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    word *= kMul;
+    word ^= word >> kShift;
+    word *= kMul;
+    hash ^= word;
+    hash *= kMul;
+  }
+  if (size > word_end) {
+    uint64_t tail = 0;
+    for (size_t i = size; i-- > word_end;) {
+      tail = tail << 8 | bytes[i];
+    }
+    hash ^= tail;
+    hash *= kMul;
+  }
+  hash ^= hash >> kShift;
+  hash *= kMul;
+  hash ^= hash >> kShift;
+  return hash;
+}
@@ -14,23 +14,16 @@
  * limitations under the License.
  */
 
-#ifndef FPS_COUNTER_H_
-#define FPS_COUNTER_H_
 
-#include <chrono>
+#ifndef HASH_H_
+#define HASH_H_
 
-#include "GLFW/glfw3.h"
+#include <cstddef>
+#include <cstdint>
 
-class FpsCounter {
-public:
-  FpsCounter(GLFWwindow *window, std::chrono::duration<double> refresh_period);
-  void Update();
+// A 64-bit hash of size bytes (MurmurHash64A), to tell whether the file a
+// cache was computed from changed. It is not cryptographic. Hashes of
+// several buffers are chained by passing each one as the seed of the next.
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0);
 
-private:
-  GLFWwindow *window_;
-  const std::chrono::duration<double> refresh_period_;
-  std::chrono::system_clock::time_point prev_;
-  int frame_count_;
-};
-
-#endif // FPS_COUNTER_H_
+#endif // HASH_H_
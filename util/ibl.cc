@@ -0,0 +1,534 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/ibl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "core/AsyncCompute.h"
+#include "core/AtomicFile.h"
+#include "core/Buffer.h"
+#include "core/Image.h"
+#include "core/Log.h"
+#include "core/StagingBuffer.h"
+#include "util/half.h"
+#include "util/hash.h"
+#include "util/mipmap.h"
+
+// Generated from Ibl.comp.glsl by the ibl_shaders target.
+#include "util/IblComp.h"
+
+// "ZRLE"
+constexpr uint32_t kIblMagic = 0x454c525a;
+constexpr uint32_t kIblVersion = 2;
+constexpr uint64_t kTexelSize = 4 * sizeof(uint16_t);
+constexpr uint32_t kGroupSize = 8;
+constexpr uint32_t kIrradianceSamples = 1024;
+constexpr uint32_t kSpecularSamples = 1024;
+constexpr uint32_t kBrdfLutSamples = 1024;
+
+constexpr uint32_t Ibl::kIrradianceSize;
+constexpr uint32_t Ibl::kMaxSpecularSize;
+constexpr uint32_t Ibl::kBrdfLutSize;
+
+// Values of the kOutput specialization constant of Ibl.comp.glsl.
+enum IblOutput : uint32_t {
+  kIrradianceOutput = 0,
+  kSpecularOutput = 1,
+  kBrdfLutOutput = 2,
+};
+
+// Push constants of Ibl.comp.glsl.
+struct IblParams {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t sample_count;
+  float roughness;
+};
+
+// Offsets of the outputs, in texels after the header.
+static uint64_t SpecularOffset(const IblHeader &header, uint32_t level) {
+  uint64_t offset = 6ull * header.irradiance_size * header.irradiance_size;
+  for (uint32_t l = 0; l < level; ++l) {
+    const uint64_t size = MipLevelSize(header.specular_size, l);
+    offset += 6 * size * size;
+  }
+  return offset;
+}
+
+static uint64_t BrdfLutOffset(const IblHeader &header) {
+  return SpecularOffset(header, header.specular_level_count);
+}
+
+static uint64_t TexelCount(const IblHeader &header) {
+  return BrdfLutOffset(header) +
+         static_cast<uint64_t>(header.brdf_lut_size) * header.brdf_lut_size;
+}
+
+// A buffer the compute shaders write and the host reads back.
+class ReadbackBuffer final : public zrl::Buffer {
+public:
+  ReadbackBuffer(const zrl::Core &core, VkDeviceSize size)
+      : Buffer(core, size,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+    mapped_ = allocator_.Map(allocation_);
+  }
+  ~ReadbackBuffer() { allocator_.Unmap(allocation_); }
+
+  const void *GetData() const { return mapped_; }
+
+private:
+  void *mapped_;
+};
+
+uint64_t Ibl::HashSources(const std::vector<std::string> &filenames) {
+  uint64_t hash = 0;
+  for (const std::string &filename : filenames) {
+    const zrl::MappedFile file(filename, /* populate */ true);
+    hash = HashBytes(file.GetData(), file.GetSize(), hash);
+  }
+  return hash;
+}
+
+std::unique_ptr<Ibl> Ibl::Open(const std::string &filename,
+                               uint64_t source_hash) {
+  if (!zrl::MappedFile::Exists(filename)) {
+    return nullptr;
+  }
+  std::unique_ptr<zrl::MappedFile> file(new zrl::MappedFile(filename));
+  if (file->GetSize() < sizeof(IblHeader)) {
+    LOG(WARNING) << "Ibl: '" << filename << "' is truncated\n";
+    return nullptr;
+  }
+  const auto *header = reinterpret_cast<const IblHeader *>(file->GetData());
+  if (header->magic != kIblMagic || header->version != kIblVersion) {
+    LOG(WARNING) << "Ibl: '" << filename << "' is not an IBL file of version "
+                 << kIblVersion << "\n";
+    return nullptr;
+  }
+  if (header->source_hash != source_hash) {
+    LOG(INFO) << "Ibl: '" << filename << "' is stale\n";
+    return nullptr;
+  }
+  if (header->specular_level_count !=
+          MipLevelCount(header->specular_size, header->specular_size) ||
+      file->GetSize() != sizeof(IblHeader) + TexelCount(*header) * kTexelSize) {
+    LOG(WARNING) << "Ibl: '" << filename << "' has an invalid size\n";
+    return nullptr;
+  }
+  file->WillNeed(0, file->GetSize());
+  return std::unique_ptr<Ibl>(new Ibl(std::move(file)));
+}
+
+Ibl::Ibl(std::unique_ptr<zrl::MappedFile> file)
+    : file_(std::move(file)),
+      header_(reinterpret_cast<const IblHeader *>(file_->GetData())) {}
+
+const uint8_t *Ibl::GetIrradiance(uint32_t face) const {
+  const uint64_t size = header_->irradiance_size;
+  return file_->GetData() + sizeof(IblHeader) + kTexelSize * face * size * size;
+}
+
+const uint8_t *Ibl::GetSpecular(uint32_t face, uint32_t level) const {
+  const uint64_t size = MipLevelSize(header_->specular_size, level);
+  return file_->GetData() + sizeof(IblHeader) +
+         kTexelSize * (SpecularOffset(*header_, level) + face * size * size);
+}
+
+const uint8_t *Ibl::GetBrdfLut() const {
+  return file_->GetData() + sizeof(IblHeader) +
+         kTexelSize * BrdfLutOffset(*header_);
+}
+
+bool Ibl::Bake(const zrl::Core &core, const std::vector<const float *> &faces,
+               uint32_t face_size, uint64_t source_hash,
+               const std::string &filename) {
+  CHECK_ARG(faces.size() == 6, "a cube map has 6 faces");
+  TRACE_SCOPE("Ibl::Bake");
+  const auto start = std::chrono::steady_clock::now();
+  const VkDevice device = core.GetLogicalDevice().GetHandle();
+
+  IblHeader header = {};
+  header.magic = kIblMagic;
+  header.version = kIblVersion;
+  header.irradiance_size = kIrradianceSize;
+  header.specular_size = std::min(face_size, kMaxSpecularSize);
+  header.specular_level_count =
+      MipLevelCount(header.specular_size, header.specular_size);
+  header.brdf_lut_size = kBrdfLutSize;
+  header.source_hash = source_hash;
+
+  // The radiance is sampled through a full mip chain, so that each sample
+  // reads the level matching the solid angle it stands for.
+  const uint32_t source_levels = MipLevelCount(face_size, face_size);
+  const std::vector<MipLevel> layout = GetMipChainLayout(
+      face_size, face_size, source_levels, 4 * sizeof(float));
+  const size_t chain_size = layout.back().offset + layout.back().size;
+  zrl::StagingBuffer staging(core, 6 * (chain_size / 2 + 16));
+  std::vector<VkBufferImageCopy> regions;
+  {
+    std::vector<std::vector<float>> chains(
+        6, std::vector<float>(chain_size / sizeof(float)));
+    std::vector<float *> chain_data;
+    for (uint32_t face = 0; face < 6; ++face) {
+      std::memcpy(chains[face].data(), faces[face], layout[0].size);
+      chain_data.push_back(chains[face].data());
+    }
+    BuildMipChainsRGBA32F(layout, chain_data, nullptr);
+    // Half floats take half the space, so the offsets are halved too.
+    for (uint32_t face = 0; face < 6; ++face) {
+      void *data;
+      const VkDeviceSize offset = staging.PushInPlace(chain_size / 2, &data);
+      FloatToHalf(chains[face].data(), chain_size / sizeof(float),
+                  static_cast<uint16_t *>(data));
+      for (uint32_t level = 0; level < source_levels; ++level) {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset + layout[level].offset / 2;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = face;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {layout[level].width, layout[level].height, 1};
+        regions.push_back(region);
+      }
+    }
+    staging.Flush();
+  }
+  auto radiance = zrl::Image::CubeMap(
+      core, {face_size, face_size}, source_levels,
+      VK_FORMAT_R16G16B16A16_SFLOAT,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  ReadbackBuffer output(core, TexelCount(header) * kTexelSize);
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.pNext = nullptr;
+  sampler_info.flags = 0;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.mipLodBias = 0.0f;
+  sampler_info.anisotropyEnable = VK_FALSE;
+  sampler_info.maxAnisotropy = 1.0f;
+  sampler_info.compareEnable = VK_FALSE;
+  sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
+  sampler_info.minLod = 0.0f;
+  sampler_info.maxLod = static_cast<float>(source_levels);
+  sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+  sampler_info.unnormalizedCoordinates = VK_FALSE;
+  VkSampler sampler;
+  CHECK_VK(vkCreateSampler(device, &sampler_info, nullptr, &sampler));
+
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[0].pImmutableSamplers = nullptr;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].pImmutableSamplers = nullptr;
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = 2;
+  set_layout_info.pBindings = bindings;
+  VkDescriptorSetLayout set_layout;
+  CHECK_VK(vkCreateDescriptorSetLayout(device, &set_layout_info, nullptr,
+                                       &set_layout));
+
+  VkPushConstantRange push_constants = {};
+  push_constants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constants.offset = 0;
+  push_constants.size = sizeof(IblParams);
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.pNext = nullptr;
+  pipeline_layout_info.flags = 0;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &set_layout;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constants;
+  VkPipelineLayout pipeline_layout;
+  CHECK_VK(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
+                                  &pipeline_layout));
+
+  VkDescriptorPoolSize pool_sizes[2] = {};
+  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pool_sizes[0].descriptorCount = 1;
+  pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[1].descriptorCount = 1;
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = 0;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = 2;
+  pool_info.pPoolSizes = pool_sizes;
+  VkDescriptorPool descriptor_pool;
+  CHECK_VK(
+      vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool));
+
+  VkDescriptorSetAllocateInfo set_info = {};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  set_info.pNext = nullptr;
+  set_info.descriptorPool = descriptor_pool;
+  set_info.descriptorSetCount = 1;
+  set_info.pSetLayouts = &set_layout;
+  VkDescriptorSet set;
+  CHECK_VK(vkAllocateDescriptorSets(device, &set_info, &set));
+
+  VkDescriptorImageInfo image_info = {};
+  image_info.sampler = sampler;
+  image_info.imageView = radiance->GetViewHandle();
+  image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkDescriptorBufferInfo buffer_info = {};
+  buffer_info.buffer = output.GetHandle();
+  buffer_info.offset = 0;
+  buffer_info.range = VK_WHOLE_SIZE;
+  VkWriteDescriptorSet writes[2] = {};
+  for (int i = 0; i < 2; ++i) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].pNext = nullptr;
+    writes[i].dstSet = set;
+    writes[i].dstBinding = i;
+    writes[i].dstArrayElement = 0;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = bindings[i].descriptorType;
+  }
+  writes[0].pImageInfo = &image_info;
+  writes[1].pBufferInfo = &buffer_info;
+  vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+  VkShaderModuleCreateInfo module_info = {};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.pNext = nullptr;
+  module_info.flags = 0;
+  module_info.codeSize = sizeof(kIblComp);
+  module_info.pCode = kIblComp;
+  VkShaderModule module;
+  CHECK_VK(vkCreateShaderModule(device, &module_info, nullptr, &module));
+
+  const uint32_t outputs[3] = {kIrradianceOutput, kSpecularOutput,
+                               kBrdfLutOutput};
+  VkSpecializationMapEntry specialization_entry = {};
+  specialization_entry.constantID = 0;
+  specialization_entry.offset = 0;
+  specialization_entry.size = sizeof(uint32_t);
+  VkSpecializationInfo specializations[3] = {};
+  VkComputePipelineCreateInfo pipeline_infos[3] = {};
+  for (int i = 0; i < 3; ++i) {
+    specializations[i].mapEntryCount = 1;
+    specializations[i].pMapEntries = &specialization_entry;
+    specializations[i].dataSize = sizeof(uint32_t);
+    specializations[i].pData = &outputs[i];
+    VkComputePipelineCreateInfo &info = pipeline_infos[i];
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.flags = 0;
+    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage.pNext = nullptr;
+    info.stage.flags = 0;
+    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    info.stage.module = module;
+    info.stage.pName = "main";
+    info.stage.pSpecializationInfo = &specializations[i];
+    info.layout = pipeline_layout;
+    info.basePipelineHandle = VK_NULL_HANDLE;
+    info.basePipelineIndex = -1;
+  }
+  VkPipeline pipelines[3];
+  CHECK_VK(vkCreateComputePipelines(device, core.GetPipelineCache(), 3,
+                                    pipeline_infos, nullptr, pipelines));
+
+  {
+    zrl::AsyncCompute compute(core);
+    VkCommandBuffer upload = compute.Record();
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = radiance->GetHandle();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = source_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 6;
+    vkCmdPipelineBarrier(upload, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+    vkCmdCopyBufferToImage(upload, staging.GetHandle(), radiance->GetHandle(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(upload, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+
+    // Each output is submitted on its own, so that no submission runs long
+    // enough to trip a driver watchdog. The upload goes with the first one.
+    auto dispatch = [&](IblOutput out, const IblParams &params,
+                        uint32_t faces) {
+      VkCommandBuffer cmd = compute.Record();
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[out]);
+      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              pipeline_layout, 0, 1, &set, 0, nullptr);
+      vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(params), &params);
+      const uint32_t groups = (params.size + kGroupSize - 1) / kGroupSize;
+      vkCmdDispatch(cmd, groups, groups, faces);
+      compute.Submit(VK_NULL_HANDLE);
+    };
+    dispatch(kIrradianceOutput,
+             {0, header.irradiance_size, kIrradianceSamples, 0.0f}, 6);
+    for (uint32_t level = 0; level < header.specular_level_count; ++level) {
+      const float roughness =
+          header.specular_level_count > 1
+              ? static_cast<float>(level) / (header.specular_level_count - 1)
+              : 0.0f;
+      dispatch(kSpecularOutput,
+               {static_cast<uint32_t>(SpecularOffset(header, level)),
+                MipLevelSize(header.specular_size, level), kSpecularSamples,
+                roughness},
+               6);
+    }
+    dispatch(kBrdfLutOutput,
+             {static_cast<uint32_t>(BrdfLutOffset(header)),
+              header.brdf_lut_size, kBrdfLutSamples, 0.0f},
+             1);
+
+    VkBufferMemoryBarrier host_barrier = {};
+    host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    host_barrier.pNext = nullptr;
+    host_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.buffer = output.GetHandle();
+    host_barrier.offset = 0;
+    host_barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(compute.Record(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &host_barrier, 0, nullptr);
+    compute.Submit(VK_NULL_HANDLE);
+    compute.WaitIdle();
+  }
+
+  for (VkPipeline pipeline : pipelines) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  vkDestroyShaderModule(device, module, nullptr);
+  vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+  vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+  vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+  vkDestroySampler(device, sampler, nullptr);
+
+  if (!zrl::WriteFileAtomically(
+          filename, {{&header, sizeof(header)},
+                     {output.GetData(), output.GetSize()}})) {
+    LOG(WARNING) << "Ibl: failed to write '" << filename << "'\n";
+    return false;
+  }
+  LOG(INFO) << "Ibl: baked '" << filename << "' from a " << face_size
+            << "x" << face_size << " environment in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << "ms\n";
+  return true;
+}
+
+// Same face orientations as CubeDirection in Ibl.comp.glsl.
+static void CubeDirection(uint32_t face, float u, float v, float dir[3]) {
+  switch (face) {
+  case 0: dir[0] = 1; dir[1] = -v; dir[2] = -u; break;
+  case 1: dir[0] = -1; dir[1] = -v; dir[2] = u; break;
+  case 2: dir[0] = u; dir[1] = 1; dir[2] = v; break;
+  case 3: dir[0] = u; dir[1] = -1; dir[2] = -v; break;
+  case 4: dir[0] = u; dir[1] = -v; dir[2] = 1; break;
+  default: dir[0] = -u; dir[1] = -v; dir[2] = -1; break;
+  }
+  const float length =
+      std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+  for (int c = 0; c < 3; ++c) {
+    dir[c] /= length;
+  }
+}
+
+std::vector<std::vector<float>>
+Ibl::CubeFromEquirect(const float *pixels, uint32_t width, uint32_t height,
+                      uint32_t face_size) {
+  const float kPI = 3.14159265358979f;
+  std::vector<std::vector<float>> faces(
+      6, std::vector<float>(4 * face_size * face_size));
+  for (uint32_t face = 0; face < 6; ++face) {
+    float *out = faces[face].data();
+    for (uint32_t y = 0; y < face_size; ++y) {
+      for (uint32_t x = 0; x < face_size; ++x, out += 4) {
+        float dir[3];
+        CubeDirection(face, (x + 0.5f) / face_size * 2 - 1,
+                      (y + 0.5f) / face_size * 2 - 1, dir);
+        // Longitude wraps around the columns and +y is the top row.
+        const float u =
+            (std::atan2(dir[0], -dir[2]) / (2 * kPI) + 0.5f) * width - 0.5f;
+        const float v = std::acos(std::max(std::min(dir[1], 1.0f), -1.0f)) /
+                            kPI * height -
+                        0.5f;
+        const float fu = std::floor(u);
+        const float fv = std::floor(v);
+        const int x0 = static_cast<int>(fu);
+        const int y0 = static_cast<int>(fv);
+        for (int c = 0; c < 4; ++c) {
+          float value = 0;
+          for (int j = 0; j < 2; ++j) {
+            const int row = std::min(std::max(y0 + j, 0),
+                                     static_cast<int>(height) - 1);
+            const float wy = j == 0 ? 1 - (v - fv) : v - fv;
+            for (int i = 0; i < 2; ++i) {
+              const int col = ((x0 + i) % static_cast<int>(width) + width) %
+                              width;
+              const float wx = i == 0 ? 1 - (u - fu) : u - fu;
+              value += wx * wy * pixels[4 * (row * width + col) + c];
+            }
+          }
+          out[c] = value;
+        }
+      }
+    }
+  }
+  return faces;
+}
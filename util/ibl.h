@@ -0,0 +1,100 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IBL_H_
+#define IBL_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/Core.h"
+#include "core/MappedFile.h"
+
+// File layout of precomputed image based lighting, in host byte order:
+//   IblHeader
+//   the irradiance cube map, face after face,
+//   the specular cube map, level after level and face after face within a
+//   level,
+//   the BRDF lookup table.
+// All the texels are RGBA16F.
+struct IblHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t irradiance_size;
+  uint32_t specular_size;
+  uint32_t specular_level_count;
+  uint32_t brdf_lut_size;
+  // Hash of the files of the environment it was computed from, to detect
+  // stale files.
+  uint64_t source_hash;
+};
+
+// Image based lighting of an environment, as sampled by pbr.zrl:
+// - the irradiance cube map, which holds the cosine weighted average of the
+//   radiance around each direction;
+// - the specular cube map, whose level l holds the radiance convolved with
+//   a GGX lobe of perceptual roughness l / (levels - 1);
+// - the split-sum BRDF lookup table, indexed by NdotV and roughness, which
+//   holds the scale and bias of F0 in red and green.
+//
+// It is computed on the device by Bake() and memory-mapped by Open(), so
+// that loading an environment costs a single file read.
+class Ibl {
+public:
+  static constexpr uint32_t kIrradianceSize = 32;
+  static constexpr uint32_t kMaxSpecularSize = 512;
+  static constexpr uint32_t kBrdfLutSize = 256;
+
+  // Returns the hash of the contents of the files an environment is loaded
+  // from, which identifies it for Open() and Bake().
+  static uint64_t HashSources(const std::vector<std::string> &filenames);
+  // Returns nullptr if the file does not exist, is not valid or was computed
+  // from another environment.
+  static std::unique_ptr<Ibl> Open(const std::string &filename,
+                                   uint64_t source_hash);
+  // Computes the lighting of an environment on the compute queue and writes
+  // it to filename. faces holds the radiance of the 6 faces of a cube map as
+  // RGBA32F texels, in the order of Vulkan cube map layers.
+  static bool Bake(const zrl::Core &core,
+                   const std::vector<const float *> &faces,
+                   uint32_t face_size, uint64_t source_hash,
+                   const std::string &filename);
+  // Resamples an equirectangular RGBA32F image into the 6 faces of a cube
+  // map, for Bake().
+  static std::vector<std::vector<float>>
+  CubeFromEquirect(const float *pixels, uint32_t width, uint32_t height,
+                   uint32_t face_size);
+
+  uint32_t GetIrradianceSize() const { return header_->irradiance_size; }
+  const uint8_t *GetIrradiance(uint32_t face) const;
+  uint32_t GetSpecularSize() const { return header_->specular_size; }
+  uint32_t GetSpecularLevelCount() const {
+    return header_->specular_level_count;
+  }
+  const uint8_t *GetSpecular(uint32_t face, uint32_t level) const;
+  uint32_t GetBrdfLutSize() const { return header_->brdf_lut_size; }
+  const uint8_t *GetBrdfLut() const;
+
+private:
+  explicit Ibl(std::unique_ptr<zrl::MappedFile> file);
+
+  std::unique_ptr<zrl::MappedFile> file_;
+  const IblHeader *header_;
+};
+
+#endif // IBL_H_
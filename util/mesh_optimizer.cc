@@ -0,0 +1,196 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+float ComputeAcmr(const uint32_t *indices, size_t index_count,
+                  size_t vertex_count, uint32_t cache_size) {
+  if (index_count < 3) {
+    return 0.0f;
+  }
+  // A vertex is in the cache if fewer than cache_size vertices were
+  // transformed since it was.
+  std::vector<uint64_t> transformed_at(vertex_count, 0);
+  uint64_t misses = 0;
+  for (size_t i = 0; i < index_count; ++i) {
+    uint64_t &at = transformed_at[indices[i]];
+    if (at == 0 || misses + 1 - at > cache_size) {
+      at = ++misses;
+    }
+  }
+  return static_cast<float>(misses) / (index_count / 3);
+}
+
+namespace {
+
+// The cache modeled by Forsyth's scores. Its size matters little as long as
+// it is larger than the actual cache.
+constexpr int kCacheSize = 32;
+constexpr uint32_t kMaxValence = 32;
+
+struct Scores {
+  Scores() {
+    for (int i = 0; i < kCacheSize; ++i) {
+      // The vertices of the last triangle get a fixed score, so that the
+      // next triangle does not reuse all three of them.
+      cache[i] = i < 3 ? 0.75f
+                       : std::pow(1.0f - static_cast<float>(i - 3) /
+                                             (kCacheSize - 3),
+                                  1.5f);
+    }
+    // Vertices with few triangles left get a boost, to get rid of them
+    // before they leave the cache.
+    valence[0] = 0.0f;
+    for (uint32_t i = 1; i <= kMaxValence; ++i) {
+      valence[i] = 2.0f / std::sqrt(static_cast<float>(i));
+    }
+  }
+
+  float Vertex(int cache_position, uint32_t remaining) const {
+    if (remaining == 0) {
+      return -1.0f;
+    }
+    return (cache_position >= 0 ? cache[cache_position] : 0.0f) +
+           (remaining <= kMaxValence ? valence[remaining]
+                                     : 2.0f / std::sqrt(remaining * 1.0f));
+  }
+
+  float cache[kCacheSize];
+  float valence[kMaxValence + 1];
+};
+
+} // namespace
+
+void OptimizeVertexCache(const uint32_t *indices, size_t index_count,
+                         size_t vertex_count, uint32_t *dst) {
+  static const Scores scores;
+  const size_t triangle_count = index_count / 3;
+  constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+  // The triangles not emitted yet of each vertex are the first remaining[v]
+  // of its adjacency range.
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (size_t i = 0; i < triangle_count * 3; ++i) {
+    ++remaining[indices[i]];
+  }
+  std::vector<size_t> first(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    first[v + 1] = first[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  {
+    std::vector<size_t> next(first.begin(), first.end() - 1);
+    for (size_t t = 0; t < triangle_count; ++t) {
+      for (int k = 0; k < 3; ++k) {
+        adjacency[next[indices[3 * t + k]]++] = static_cast<uint32_t>(t);
+      }
+    }
+  }
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> vertex_score(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    vertex_score[v] = scores.Vertex(-1, remaining[v]);
+  }
+  std::vector<float> triangle_score(triangle_count);
+  std::vector<bool> emitted(triangle_count, false);
+  size_t best = kNone;
+  float best_score = -1.0f;
+  for (size_t t = 0; t < triangle_count; ++t) {
+    triangle_score[t] = vertex_score[indices[3 * t]] +
+                        vertex_score[indices[3 * t + 1]] +
+                        vertex_score[indices[3 * t + 2]];
+    if (triangle_score[t] > best_score) {
+      best = t;
+      best_score = triangle_score[t];
+    }
+  }
+
+  std::vector<uint32_t> cache, next_cache;
+  cache.reserve(kCacheSize + 3);
+  next_cache.reserve(kCacheSize + 3);
+  size_t cursor = 0;
+  for (size_t out = 0; out < triangle_count; ++out) {
+    if (best == kNone) {
+      // None of the triangles in the cache is left, restart from any.
+      while (emitted[cursor]) {
+        ++cursor;
+      }
+      best = cursor;
+    }
+    const uint32_t *triangle = indices + 3 * best;
+    std::copy(triangle, triangle + 3, dst + 3 * out);
+    emitted[best] = true;
+
+    next_cache.assign(triangle, triangle + 3);
+    for (uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        next_cache.push_back(v);
+      }
+    }
+    for (int k = 0; k < 3; ++k) {
+      const uint32_t v = triangle[k];
+      uint32_t *begin = &adjacency[first[v]];
+      uint32_t *end = begin + remaining[v];
+      *std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+      --remaining[v];
+    }
+    for (size_t i = 0; i < next_cache.size(); ++i) {
+      const uint32_t v = next_cache[i];
+      cache_position[v] = i < kCacheSize ? static_cast<int>(i) : -1;
+      vertex_score[v] = scores.Vertex(cache_position[v], remaining[v]);
+    }
+
+    // Only the triangles of the vertices whose score changed can change.
+    best = kNone;
+    best_score = -1.0f;
+    for (uint32_t v : next_cache) {
+      for (size_t a = first[v]; a < first[v] + remaining[v]; ++a) {
+        const uint32_t t = adjacency[a];
+        triangle_score[t] = vertex_score[indices[3 * t]] +
+                            vertex_score[indices[3 * t + 1]] +
+                            vertex_score[indices[3 * t + 2]];
+        if (triangle_score[t] > best_score) {
+          best = t;
+          best_score = triangle_score[t];
+        }
+      }
+    }
+    if (next_cache.size() > kCacheSize) {
+      next_cache.resize(kCacheSize);
+    }
+    cache.swap(next_cache);
+  }
+}
+
+std::vector<uint32_t> OptimizeVertexFetch(uint32_t *indices,
+                                          size_t index_count,
+                                          size_t vertex_count) {
+  constexpr uint32_t kUnused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> new_index(vertex_count, kUnused);
+  std::vector<uint32_t> old_index;
+  for (size_t i = 0; i < index_count; ++i) {
+    uint32_t &v = new_index[indices[i]];
+    if (v == kUnused) {
+      v = static_cast<uint32_t>(old_index.size());
+      old_index.push_back(indices[i]);
+    }
+    indices[i] = v;
+  }
+  return old_index;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Average cache miss ratio of an indexed triangle list: the number of
+// vertices transformed per triangle by a FIFO post-transform cache of
+// cache_size entries. It ranges from 0.5 for a regular grid with a perfect
+// cache to 3.
+float ComputeAcmr(const uint32_t *indices, size_t index_count,
+                  size_t vertex_count, uint32_t cache_size = 16);
+
+// Reorders the triangles of an indexed triangle list into dst so that
+// consecutive triangles share vertices, with Tom Forsyth's "Linear-Speed
+// Vertex Cache Optimisation". dst cannot alias indices.
+void OptimizeVertexCache(const uint32_t *indices, size_t index_count,
+                         size_t vertex_count, uint32_t *dst);
+
+// Renumbers the vertices in the order the indices first use them, so that
+// vertex fetches walk the attribute streams forward. Returns the previous
+// index of each vertex; vertices no index uses are dropped.
+std::vector<uint32_t> OptimizeVertexFetch(uint32_t *indices,
+                                          size_t index_count,
+                                          size_t vertex_count);
+
+#endif // MESH_OPTIMIZER_H_
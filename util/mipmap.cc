@@ -0,0 +1,278 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/mipmap.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+
+#include "util/simd.h"
+
+// Rows of a level are split into bands of about this many texels, so that
+// the threads of a pool share the large levels.
+constexpr uint32_t kBandTexels = 16384;
+
+static float SrgbToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSrgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f
+                         : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t ToUnorm8(float c) {
+  return static_cast<uint8_t>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f +
+                              0.5f);
+}
+
+// sRGB averaging goes through 16-bit linear values, so that it is exact
+// integer arithmetic and costs two table lookups per channel instead of pow.
+struct SrgbTables {
+  std::array<uint16_t, 256> to_linear;
+  std::array<uint8_t, 65536> to_srgb;
+};
+
+static const SrgbTables &GetSrgbTables() {
+  static const SrgbTables *tables = [] {
+    auto *t = new SrgbTables;
+    for (int i = 0; i < 256; ++i) {
+      t->to_linear[i] =
+          static_cast<uint16_t>(SrgbToLinear(i / 255.0f) * 65535.0f + 0.5f);
+    }
+    for (int i = 0; i < 65536; ++i) {
+      t->to_srgb[i] = ToUnorm8(LinearToSrgb(i / 65535.0f));
+    }
+    return t;
+  }();
+  return *tables;
+}
+
+static void DownsampleTexelRGBA8(const uint8_t *const texels[4],
+                                 MipFilter filter, const SrgbTables &srgb,
+                                 uint8_t *out) {
+  switch (filter) {
+  case MipFilter::kLinear:
+    for (int c = 0; c < 3; ++c) {
+      out[c] = static_cast<uint8_t>(
+          (texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) >>
+          2);
+    }
+    break;
+  case MipFilter::kSrgb:
+    for (int c = 0; c < 3; ++c) {
+      const uint32_t sum =
+          srgb.to_linear[texels[0][c]] + srgb.to_linear[texels[1][c]] +
+          srgb.to_linear[texels[2][c]] + srgb.to_linear[texels[3][c]];
+      out[c] = srgb.to_srgb[(sum + 2) >> 2];
+    }
+    break;
+  case MipFilter::kNormal: {
+    float n[3] = {0, 0, 0};
+    for (int t = 0; t < 4; ++t) {
+      for (int c = 0; c < 3; ++c) {
+        n[c] += texels[t][c] / 127.5f - 1.0f;
+      }
+    }
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int c = 0; c < 3; ++c) {
+      // Opposite normals cancel out, in which case z is kept up.
+      const float unit = length > 0 ? n[c] / length : (c == 2 ? 1 : 0);
+      out[c] = ToUnorm8(unit * 0.5f + 0.5f);
+    }
+    break;
+  }
+  }
+  out[3] = static_cast<uint8_t>(
+      (texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) >> 2);
+}
+
+#ifdef ZRL_SSE2
+// Averages 8 texels of two rows into 4, with the rounding of the scalar code.
+static inline void Downsample4RGBA8(const uint8_t *row0, const uint8_t *row1,
+                                    uint8_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0));
+  const __m128i a1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 16));
+  const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1));
+  const __m128i b1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 16));
+  // Vertical sums of the texel pairs 0-1, 2-3, 4-5 and 6-7, widened to 16
+  // bits per channel.
+  const __m128i s01 =
+      _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+  const __m128i s23 =
+      _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+  const __m128i s45 =
+      _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+  const __m128i s67 =
+      _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+  // Horizontal sums: even columns plus odd columns.
+  const __m128i d01 = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23),
+                                    _mm_unpackhi_epi64(s01, s23));
+  const __m128i d23 = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67),
+                                    _mm_unpackhi_epi64(s45, s67));
+  const __m128i two = _mm_set1_epi16(2);
+  const __m128i avg01 = _mm_srli_epi16(_mm_add_epi16(d01, two), 2);
+  const __m128i avg23 = _mm_srli_epi16(_mm_add_epi16(d23, two), 2);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                   _mm_packus_epi16(avg01, avg23));
+}
+#endif
+
+static void DownsampleRowsRGBA8(const uint8_t *src, uint32_t width,
+                                uint32_t height, MipFilter filter,
+                                uint8_t *dst, uint32_t row_begin,
+                                uint32_t row_end) {
+  const uint32_t dst_width = MipLevelSize(width, 1);
+  const SrgbTables &srgb = GetSrgbTables();
+  for (uint32_t y = row_begin; y < row_end; ++y) {
+    const uint8_t *row0 = src + 4 * std::min(2 * y, height - 1) * width;
+    const uint8_t *row1 = src + 4 * std::min(2 * y + 1, height - 1) * width;
+    uint8_t *out = dst + 4 * y * dst_width;
+    uint32_t x = 0;
+#ifdef ZRL_SSE2
+    // Only a single column is clamped, when width is 1.
+    if (filter == MipFilter::kLinear && width > 1) {
+      for (; x + 4 <= dst_width; x += 4) {
+        Downsample4RGBA8(row0 + 8 * x, row1 + 8 * x, out + 4 * x);
+      }
+    }
+#endif
+    for (; x < dst_width; ++x) {
+      const uint32_t x0 = std::min(2 * x, width - 1);
+      const uint32_t x1 = std::min(2 * x + 1, width - 1);
+      const uint8_t *const texels[4] = {row0 + 4 * x0, row0 + 4 * x1,
+                                        row1 + 4 * x0, row1 + 4 * x1};
+      DownsampleTexelRGBA8(texels, filter, srgb, out + 4 * x);
+    }
+  }
+}
+
+static void DownsampleRowsRGBA32F(const float *src, uint32_t width,
+                                  uint32_t height, float *dst,
+                                  uint32_t row_begin, uint32_t row_end) {
+  const uint32_t dst_width = MipLevelSize(width, 1);
+  for (uint32_t y = row_begin; y < row_end; ++y) {
+    const float *row0 = src + 4 * std::min(2 * y, height - 1) * width;
+    const float *row1 = src + 4 * std::min(2 * y + 1, height - 1) * width;
+    float *out = dst + 4 * y * dst_width;
+    for (uint32_t x = 0; x < dst_width; ++x) {
+      const float *t00 = row0 + 4 * std::min(2 * x, width - 1);
+      const float *t01 = row0 + 4 * std::min(2 * x + 1, width - 1);
+      const float *t10 = row1 + 4 * std::min(2 * x, width - 1);
+      const float *t11 = row1 + 4 * std::min(2 * x + 1, width - 1);
+      // Both paths add in the same order, so that they round the same way.
+#ifdef ZRL_SSE2
+      const __m128 sum =
+          _mm_add_ps(_mm_add_ps(_mm_loadu_ps(t00), _mm_loadu_ps(t01)),
+                     _mm_add_ps(_mm_loadu_ps(t10), _mm_loadu_ps(t11)));
+      _mm_storeu_ps(out + 4 * x, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+      for (int c = 0; c < 4; ++c) {
+        out[4 * x + c] = ((t00[c] + t01[c]) + (t10[c] + t11[c])) * 0.25f;
+      }
+#endif
+    }
+  }
+}
+
+uint32_t MipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+    ++levels;
+  }
+  return levels;
+}
+
+void DownsampleRGBA8(const uint8_t *src, uint32_t width, uint32_t height,
+                     MipFilter filter, uint8_t *dst) {
+  DownsampleRowsRGBA8(src, width, height, filter, dst, 0,
+                      MipLevelSize(height, 1));
+}
+
+void DownsampleRGBA32F(const float *src, uint32_t width, uint32_t height,
+                       float *dst) {
+  DownsampleRowsRGBA32F(src, width, height, dst, 0, MipLevelSize(height, 1));
+}
+
+std::vector<MipLevel> GetMipChainLayout(uint32_t width, uint32_t height,
+                                        uint32_t level_count,
+                                        size_t texel_size) {
+  std::vector<MipLevel> layout(level_count);
+  size_t offset = 0;
+  for (uint32_t level = 0; level < level_count; ++level) {
+    MipLevel &cur = layout[level];
+    cur.width = MipLevelSize(width, level);
+    cur.height = MipLevelSize(height, level);
+    cur.offset = offset;
+    cur.size = texel_size * cur.width * cur.height;
+    offset = (offset + cur.size + 15) / 16 * 16;
+  }
+  return layout;
+}
+
+// Downsamples level after level, as each one is read by the next. Within a
+// level, every band of every chain is independent.
+template <typename T, typename DownsampleRows>
+static void BuildMipChains(const std::vector<MipLevel> &layout,
+                           const std::vector<T *> &chains, ThreadPool *pool,
+                           DownsampleRows downsample_rows) {
+  for (size_t level = 1; level < layout.size(); ++level) {
+    const MipLevel &src = layout[level - 1];
+    const MipLevel &dst = layout[level];
+    const uint32_t band = std::max<uint32_t>(kBandTexels / dst.width, 1);
+    std::vector<std::future<void>> bands;
+    for (T *chain : chains) {
+      auto *base = reinterpret_cast<uint8_t *>(chain);
+      const T *src_data = reinterpret_cast<const T *>(base + src.offset);
+      T *dst_data = reinterpret_cast<T *>(base + dst.offset);
+      for (uint32_t row = 0; row < dst.height; row += band) {
+        const uint32_t row_end = std::min(row + band, dst.height);
+        auto task = [=] {
+          downsample_rows(src_data, src.width, src.height, dst_data, row,
+                          row_end);
+        };
+        if (pool != nullptr) {
+          bands.push_back(pool->Submit(task));
+        } else {
+          task();
+        }
+      }
+    }
+    for (auto &result : bands) {
+      result.get();
+    }
+  }
+}
+
+void BuildMipChainsRGBA8(const std::vector<MipLevel> &layout, MipFilter filter,
+                         const std::vector<uint8_t *> &chains,
+                         ThreadPool *pool) {
+  BuildMipChains(layout, chains, pool,
+                 [filter](const uint8_t *src, uint32_t width, uint32_t height,
+                          uint8_t *dst, uint32_t row_begin, uint32_t row_end) {
+                   DownsampleRowsRGBA8(src, width, height, filter, dst,
+                                       row_begin, row_end);
+                 });
+}
+
+void BuildMipChainsRGBA32F(const std::vector<MipLevel> &layout,
+                           const std::vector<float *> &chains,
+                           ThreadPool *pool) {
+  BuildMipChains(layout, chains, pool, DownsampleRowsRGBA32F);
+}
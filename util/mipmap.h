@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MIPMAP_H_
+#define MIPMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+// How the texels of an RGBA8 image are averaged into the next level.
+enum class MipFilter {
+  // Plain average of each channel, rounded to nearest. This is what a linear
+  // blit of a UNORM image computes.
+  kLinear,
+  // RGB is sRGB encoded and averaged in linear space. Alpha is linear.
+  kSrgb,
+  // RGB is a unit vector mapped to [0, 1], renormalized after averaging.
+  kNormal,
+};
+
+// Number of levels of a full mip chain, down to 1x1.
+uint32_t MipLevelCount(uint32_t width, uint32_t height);
+
+// Size of a level of a mip chain.
+inline uint32_t MipLevelSize(uint32_t size, uint32_t level) {
+  return size >> level > 0 ? size >> level : 1;
+}
+
+// Downsamples the RGBA8 image src with a 2x2 box filter into dst, which must
+// hold MipLevelSize(width, 1) x MipLevelSize(height, 1) texels. On odd sizes,
+// the last row or column of src is dropped.
+//
+// The kLinear and RGBA32F filters use SSE2 where available, and give the same
+// results as the scalar code bit for bit.
+void DownsampleRGBA8(const uint8_t *src, uint32_t width, uint32_t height,
+                     MipFilter filter, uint8_t *dst);
+void DownsampleRGBA32F(const float *src, uint32_t width, uint32_t height,
+                       float *dst);
+
+// Where a level of a mip chain stored in a single buffer lives.
+struct MipLevel {
+  uint32_t width;
+  uint32_t height;
+  size_t offset;
+  size_t size;
+};
+
+// Lays out level_count levels one after the other, each starting at a
+// multiple of 16 bytes.
+std::vector<MipLevel> GetMipChainLayout(uint32_t width, uint32_t height,
+                                        uint32_t level_count,
+                                        size_t texel_size);
+
+// Fills in the levels after the first of each chain, laid out as layout,
+// from its first level. The chains can live anywhere, including mapped
+// staging memory. With a pool, the chains and the rows of large levels are
+// downsampled in parallel; it must not be the pool running the caller.
+void BuildMipChainsRGBA8(const std::vector<MipLevel> &layout, MipFilter filter,
+                         const std::vector<uint8_t *> &chains,
+                         ThreadPool *pool);
+void BuildMipChainsRGBA32F(const std::vector<MipLevel> &layout,
+                           const std::vector<float *> &chains,
+                           ThreadPool *pool);
+
+#endif // MIPMAP_H_
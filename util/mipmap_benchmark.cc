@@ -0,0 +1,126 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Measures the downsampling of util/mipmap.cc with SSE2 against its scalar
+// code, built with ZRL_NO_SIMD: one level of a large image per filter, and
+// whole mip chains on a thread pool.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "util/mipmap.h"
+#include "util/mipmap_scalar.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+constexpr uint32_t kSize = 4096;
+constexpr int kRepetitions = 8;
+
+// Returns the best time of f over kRepetitions runs, in milliseconds.
+template <typename F> double Measure(const F &f) {
+  double best = 0.0;
+  for (int i = 0; i < kRepetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    best = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+void Report(const char *name, double scalar_ms, double simd_ms) {
+  std::cout << name << ": scalar " << scalar_ms << " ms, SSE2 " << simd_ms
+            << " ms, " << scalar_ms / simd_ms << "x\n";
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::uniform_real_distribution<float> value(0.0f, 1.0f);
+
+  const size_t texels = kSize * kSize;
+  std::vector<uint8_t> src8(4 * texels);
+  for (auto &b : src8) {
+    b = static_cast<uint8_t>(byte(rng));
+  }
+  std::vector<float> src32(4 * texels);
+  for (auto &v : src32) {
+    v = value(rng);
+  }
+  std::vector<uint8_t> dst8(src8.size() / 4);
+  std::vector<float> dst32(src32.size() / 4);
+
+  std::cout << "one " << kSize << "x" << kSize << " level:\n";
+  const std::pair<const char *, MipFilter> filters[] = {
+      {"  RGBA8 linear", MipFilter::kLinear},
+      {"  RGBA8 sRGB", MipFilter::kSrgb},
+      {"  RGBA8 normal", MipFilter::kNormal}};
+  for (const auto &filter : filters) {
+    Report(filter.first, Measure([&] {
+             mipmap_scalar::DownsampleRGBA8(src8.data(), kSize, kSize,
+                                            filter.second, dst8.data());
+           }),
+           Measure([&] {
+             DownsampleRGBA8(src8.data(), kSize, kSize, filter.second,
+                             dst8.data());
+           }));
+  }
+  Report("  RGBA32F", Measure([&] {
+           mipmap_scalar::DownsampleRGBA32F(src32.data(), kSize, kSize,
+                                            dst32.data());
+         }),
+         Measure([&] {
+           DownsampleRGBA32F(src32.data(), kSize, kSize, dst32.data());
+         }));
+
+  // The chains are built in place; only their first level is ever read.
+  ThreadPool pool;
+  const uint32_t levels = MipLevelCount(kSize, kSize);
+  const auto layout8 = GetMipChainLayout(kSize, kSize, levels, 4);
+  std::vector<uint8_t> chain8(layout8.back().offset + layout8.back().size);
+  std::copy(src8.begin(), src8.end(), chain8.begin());
+  const auto layout32 =
+      GetMipChainLayout(kSize, kSize, levels, 4 * sizeof(float));
+  std::vector<float> chain32(
+      (layout32.back().offset + layout32.back().size) / sizeof(float));
+  std::copy(src32.begin(), src32.end(), chain32.begin());
+
+  std::cout << "full " << kSize << "x" << kSize << " chain on "
+            << "a thread pool:\n";
+  Report("  RGBA8 linear", Measure([&] {
+           mipmap_scalar::BuildMipChainsRGBA8(layout8, MipFilter::kLinear,
+                                              {chain8.data()}, &pool);
+         }),
+         Measure([&] {
+           BuildMipChainsRGBA8(layout8, MipFilter::kLinear, {chain8.data()},
+                               &pool);
+         }));
+  Report("  RGBA32F", Measure([&] {
+           mipmap_scalar::BuildMipChainsRGBA32F(layout32, {chain32.data()},
+                                                &pool);
+         }),
+         Measure([&] {
+           BuildMipChainsRGBA32F(layout32, {chain32.data()}, &pool);
+         }));
+  return 0;
+}
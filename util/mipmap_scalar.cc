@@ -0,0 +1,35 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/mipmap_scalar.h"
+
+// The standard headers of mipmap.cc are included here, outside of the
+// namespace, so that its own includes of them are no-ops.
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+
+#ifndef ZRL_NO_SIMD
+#define ZRL_NO_SIMD
+#endif
+// util/simd.h is first included by mipmap.cc below, and so sees ZRL_NO_SIMD.
+#ifdef ZRL_SSE2
+#error "util/simd.h must not be included before ZRL_NO_SIMD is defined"
+#endif
+
+namespace mipmap_scalar {
+#include "util/mipmap.cc"
+} // namespace mipmap_scalar
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MIPMAP_SCALAR_H_
+#define MIPMAP_SCALAR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "util/mipmap.h"
+#include "util/thread_pool.h"
+
+// The functions of util/mipmap.h built from the same source with
+// ZRL_NO_SIMD, so that tests and benchmarks can hold the SSE2 code against
+// the scalar code in a single binary.
+namespace mipmap_scalar {
+
+void DownsampleRGBA8(const uint8_t *src, uint32_t width, uint32_t height,
+                     MipFilter filter, uint8_t *dst);
+void DownsampleRGBA32F(const float *src, uint32_t width, uint32_t height,
+                       float *dst);
+void BuildMipChainsRGBA8(const std::vector<MipLevel> &layout, MipFilter filter,
+                         const std::vector<uint8_t *> &chains,
+                         ThreadPool *pool);
+void BuildMipChainsRGBA32F(const std::vector<MipLevel> &layout,
+                           const std::vector<float *> &chains,
+                           ThreadPool *pool);
+
+} // namespace mipmap_scalar
+
+#endif // MIPMAP_SCALAR_H_
@@ -0,0 +1,129 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Checks that the SSE2 code of util/mipmap.cc gives the same bytes as its
+// scalar code, built with ZRL_NO_SIMD, for every filter and for sizes that
+// exercise the vector loop, its scalar tail and the clamping of odd sizes.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "core/Log.h"
+#include "util/mipmap.h"
+#include "util/mipmap_scalar.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+struct Size {
+  uint32_t width;
+  uint32_t height;
+};
+
+constexpr Size kSizes[] = {{1, 1},   {1, 7},    {7, 1},    {2, 2},
+                           {3, 5},   {8, 8},    {9, 4},    {16, 3},
+                           {17, 33}, {64, 64},  {255, 129}, {256, 256},
+                           {1023, 2}, {513, 511}};
+
+constexpr MipFilter kFilters[] = {MipFilter::kLinear, MipFilter::kSrgb,
+                                  MipFilter::kNormal};
+
+std::vector<uint8_t> RandomRGBA8(std::mt19937 &rng, size_t texels) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<uint8_t> data(4 * texels);
+  for (auto &b : data) {
+    b = static_cast<uint8_t>(byte(rng));
+  }
+  return data;
+}
+
+std::vector<float> RandomRGBA32F(std::mt19937 &rng, size_t texels) {
+  // HDR values, so that the sums round.
+  std::uniform_real_distribution<float> value(0.0f, 1000.0f);
+  std::vector<float> data(4 * texels);
+  for (auto &v : data) {
+    v = value(rng);
+  }
+  return data;
+}
+
+void TestDownsample(std::mt19937 &rng) {
+  for (const Size &size : kSizes) {
+    const size_t texels = size.width * size.height;
+    const size_t dst_texels =
+        MipLevelSize(size.width, 1) * MipLevelSize(size.height, 1);
+    const std::vector<uint8_t> src = RandomRGBA8(rng, texels);
+    for (MipFilter filter : kFilters) {
+      std::vector<uint8_t> simd(4 * dst_texels), scalar(4 * dst_texels);
+      DownsampleRGBA8(src.data(), size.width, size.height, filter,
+                      simd.data());
+      mipmap_scalar::DownsampleRGBA8(src.data(), size.width, size.height,
+                                     filter, scalar.data());
+      CHECK(simd == scalar, "RGBA8 " << size.width << "x" << size.height
+                                     << " filter "
+                                     << static_cast<int>(filter));
+    }
+    const std::vector<float> src_f = RandomRGBA32F(rng, texels);
+    std::vector<float> simd(4 * dst_texels), scalar(4 * dst_texels);
+    DownsampleRGBA32F(src_f.data(), size.width, size.height, simd.data());
+    mipmap_scalar::DownsampleRGBA32F(src_f.data(), size.width, size.height,
+                                     scalar.data());
+    CHECK(std::memcmp(simd.data(), scalar.data(), 4 * sizeof(float) *
+                                                      dst_texels) == 0,
+          "RGBA32F " << size.width << "x" << size.height);
+  }
+}
+
+// Whole chains, with and without a pool, also cover the row bands.
+void TestMipChains(std::mt19937 &rng, ThreadPool *pool) {
+  constexpr Size kChainSizes[] = {{1, 1}, {5, 3}, {300, 200}, {1024, 1024}};
+  for (const Size &size : kChainSizes) {
+    const uint32_t levels = MipLevelCount(size.width, size.height);
+    const auto layout8 = GetMipChainLayout(size.width, size.height, levels, 4);
+    const size_t size8 = layout8.back().offset + layout8.back().size;
+    for (MipFilter filter : kFilters) {
+      std::vector<uint8_t> simd = RandomRGBA8(rng, size8 / 4);
+      std::vector<uint8_t> scalar = simd;
+      BuildMipChainsRGBA8(layout8, filter, {simd.data()}, pool);
+      mipmap_scalar::BuildMipChainsRGBA8(layout8, filter, {scalar.data()},
+                                         nullptr);
+      CHECK(simd == scalar, "RGBA8 chain " << size.width << "x"
+                                           << size.height << " filter "
+                                           << static_cast<int>(filter));
+    }
+    const auto layout32 =
+        GetMipChainLayout(size.width, size.height, levels, 4 * sizeof(float));
+    const size_t size32 = layout32.back().offset + layout32.back().size;
+    std::vector<float> simd = RandomRGBA32F(rng, size32 / (4 * sizeof(float)));
+    std::vector<float> scalar = simd;
+    BuildMipChainsRGBA32F(layout32, {simd.data()}, pool);
+    mipmap_scalar::BuildMipChainsRGBA32F(layout32, {scalar.data()}, nullptr);
+    CHECK(std::memcmp(simd.data(), scalar.data(),
+                      simd.size() * sizeof(float)) == 0,
+          "RGBA32F chain " << size.width << "x" << size.height);
+  }
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(1);
+  TestDownsample(rng);
+  TestMipChains(rng, nullptr);
+  ThreadPool pool(4);
+  TestMipChains(rng, &pool);
+  return 0;
+}
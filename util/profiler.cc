@@ -0,0 +1,435 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+#include "core/Log.h"
+#include "core/Trace.h"
+
+constexpr uint32_t kNoQuery = std::numeric_limits<uint32_t>::max();
+
+static double Milliseconds(Profiler::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Nearest-rank percentile of sorted values.
+static double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static Profiler::Percentiles ComputePercentiles(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return {Percentile(values, 0.50), Percentile(values, 0.95),
+          Percentile(values, 0.99), values.empty() ? 0 : values.back()};
+}
+
+static double Mean(const std::vector<double> &values) {
+  if (values.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (double v : values) {
+    sum += v;
+  }
+  return sum / values.size();
+}
+
+Profiler::CpuScope::CpuScope(Profiler &profiler, uint32_t scope)
+    : profiler_(&profiler), scope_(scope), start_(Clock::now()) {}
+
+Profiler::CpuScope::CpuScope(CpuScope &&other)
+    : profiler_(other.profiler_), scope_(other.scope_), start_(other.start_) {
+  other.profiler_ = nullptr;
+}
+
+Profiler::CpuScope::~CpuScope() {
+  if (profiler_ != nullptr) {
+    profiler_->EndCpuScope(scope_, start_);
+  }
+}
+
+Profiler::Profiler(size_t history_size)
+    : history_size_(history_size), frame_number_(0), started_(false),
+      device_(VK_NULL_HANDLE), query_pool_(VK_NULL_HANDLE),
+      frames_in_flight_(1), max_gpu_scopes_(0), timestamp_period_ns_(0),
+      timestamp_mask_(0), gpu_epoch_ns_(0), slot_(0), slot_frame_(1, 0),
+      slot_queries_(1) {
+  CHECK_ARG(history_size_ > 0, "history_size must be positive");
+  history_.reserve(history_size_);
+}
+
+Profiler::Profiler(const zrl::Core &core, uint32_t frames_in_flight,
+                   uint32_t max_gpu_scopes, size_t history_size)
+    : Profiler(history_size) {
+  CHECK_ARG(frames_in_flight > 0, "frames_in_flight must be positive");
+  CHECK_ARG(max_gpu_scopes > 0, "max_gpu_scopes must be positive");
+  const zrl::LogicalDevice &device = core.GetLogicalDevice();
+  const auto queue_families = device.GetPhysicalDevice().GetQueueFamilies();
+  const uint32_t valid_bits =
+      queue_families[device.GetGCTQueueFamily()].timestampValidBits;
+  frames_in_flight_ = frames_in_flight;
+  slot_frame_.assign(frames_in_flight_, 0);
+  slot_queries_.assign(frames_in_flight_, {});
+  if (valid_bits == 0) {
+    LOG(WARNING) << "Profiler: timestamps not supported on the gct queue, "
+                    "GPU scopes will not be measured\n";
+    return;
+  }
+
+  device_ = device.GetHandle();
+  max_gpu_scopes_ = max_gpu_scopes;
+  timestamp_period_ns_ =
+      device.GetPhysicalDevice().GetProperties().limits.timestampPeriod;
+  timestamp_mask_ = valid_bits >= 64 ? std::numeric_limits<uint64_t>::max()
+                                     : (uint64_t{1} << valid_bits) - 1;
+
+  VkQueryPoolCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  // The last query is used by Calibrate().
+  create_info.queryCount = 2 * max_gpu_scopes_ * frames_in_flight_ + 1;
+  CHECK_VK(vkCreateQueryPool(device_, &create_info, nullptr, &query_pool_));
+  Calibrate(device);
+}
+
+Profiler::~Profiler() {
+  if (query_pool_ != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device_, query_pool_, nullptr);
+  }
+}
+
+void Profiler::BeginFrame(uint32_t slot) {
+  CHECK_PC(slot < frames_in_flight_, "slot out of range");
+  const Clock::time_point now = Clock::now();
+  if (started_) {
+    FindFrame(frame_number_)->frame_ms = Milliseconds(now - frame_start_);
+  }
+  if (HasGpuTimings()) {
+    ReadGpuTimings(slot);
+  }
+
+  Frame frame = {++frame_number_, -1, -1, {}, {}};
+  if (history_.size() < history_size_) {
+    history_.push_back(std::move(frame));
+  } else {
+    history_[(frame.number - 1) % history_size_] = std::move(frame);
+  }
+  slot_ = slot;
+  slot_frame_[slot] = frame_number_;
+  slot_queries_[slot].clear();
+  frame_start_ = now;
+  started_ = true;
+}
+
+Profiler::CpuScope Profiler::Cpu(const char *name) {
+  return CpuScope(*this, ScopeId(cpu_scope_ids_, cpu_scope_names_, name));
+}
+
+void Profiler::CmdReset(VkCommandBuffer cmd) {
+  if (!HasGpuTimings()) {
+    return;
+  }
+  vkCmdResetQueryPool(cmd, query_pool_, 2 * max_gpu_scopes_ * slot_,
+                      2 * max_gpu_scopes_);
+}
+
+uint32_t Profiler::CmdBeginGpu(VkCommandBuffer cmd, const char *name) {
+  if (!HasGpuTimings()) {
+    return kNoQuery;
+  }
+  auto &queries = slot_queries_[slot_];
+  if (queries.size() == max_gpu_scopes_) {
+    DLOG << "Profiler: too many GPU scopes, dropping '" << name << "'\n";
+    return kNoQuery;
+  }
+  const uint32_t query = static_cast<uint32_t>(queries.size());
+  const uint32_t scope = ScopeId(gpu_scope_ids_, gpu_scope_names_, name);
+  if (scope == gpu_scope_trace_names_.size()) {
+    gpu_scope_trace_names_.push_back(zrl::Trace::Intern(name));
+  }
+  queries.push_back({scope});
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_,
+                      2 * (max_gpu_scopes_ * slot_ + query));
+  return query;
+}
+
+void Profiler::CmdEndGpu(VkCommandBuffer cmd, uint32_t query) {
+  if (query == kNoQuery) {
+    return;
+  }
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_,
+                      2 * (max_gpu_scopes_ * slot_ + query) + 1);
+}
+
+size_t Profiler::GetFrameCount() const {
+  return Collect(&Frame::frame_ms).size();
+}
+
+Profiler::Percentiles Profiler::GetFrameTimes() const {
+  return ComputePercentiles(Collect(&Frame::frame_ms));
+}
+
+Profiler::Percentiles Profiler::GetGpuFrameTimes() const {
+  return ComputePercentiles(Collect(&Frame::gpu_ms));
+}
+
+void Profiler::Report(std::ostream &out) const {
+  const std::vector<double> frame_ms = Collect(&Frame::frame_ms);
+  const std::vector<double> gpu_ms = Collect(&Frame::gpu_ms);
+  const double mean_frame_ms = Mean(frame_ms);
+  out << std::fixed << std::setprecision(3);
+  out << "frames: " << frame_ms.size() << "\n";
+  out << "frame time (ms): " << ComputePercentiles(frame_ms) << "\n";
+  if (!gpu_ms.empty()) {
+    out << "gpu time (ms): " << ComputePercentiles(gpu_ms) << "\n";
+  }
+
+  // Busy ratios relate each timing to the frame time. A GPU busy for most of
+  // the frame while the CPU scopes are short means the GPU is the
+  // bottleneck, and the other way around. Without GPU scopes there is
+  // nothing to compare the CPU with, and they are left out.
+  const bool busy = !gpu_scope_names_.empty();
+  auto report_scopes = [&](const char *kind,
+                           const std::vector<std::string> &names,
+                           std::vector<double> Frame::*scopes) {
+    for (size_t scope = 0; scope < names.size(); ++scope) {
+      std::vector<double> values;
+      for (const auto &frame : history_) {
+        if (frame.frame_ms >= 0 && scope < (frame.*scopes).size()) {
+          values.push_back((frame.*scopes)[scope]);
+        }
+      }
+      const Percentiles p = ComputePercentiles(values);
+      out << kind << " " << names[scope] << ": mean=" << Mean(values)
+          << " p95=" << p.p95 << " p99=" << p.p99;
+      if (busy && mean_frame_ms > 0) {
+        out << " busy=" << 100 * Mean(values) / mean_frame_ms << "%";
+      }
+      out << "\n";
+    }
+  };
+  report_scopes("cpu", cpu_scope_names_, &Frame::cpu_scope_ms);
+  report_scopes("gpu", gpu_scope_names_, &Frame::gpu_scope_ms);
+  if (busy && !gpu_ms.empty() && mean_frame_ms > 0) {
+    out << "gpu busy: " << 100 * Mean(gpu_ms) / mean_frame_ms
+        << "% of frame time\n";
+  }
+}
+
+bool Profiler::Dump(const std::string &filename) const {
+  std::ofstream out(filename);
+  if (!out) {
+    LOG(WARNING) << "Profiler: cannot write '" << filename << "'\n";
+    return false;
+  }
+  out << "frame,frame_ms,gpu_ms";
+  for (const auto &name : cpu_scope_names_) {
+    out << ",cpu:" << name;
+  }
+  for (const auto &name : gpu_scope_names_) {
+    out << ",gpu:" << name;
+  }
+  out << "\n" << std::fixed << std::setprecision(4);
+
+  const uint64_t first =
+      frame_number_ > history_.size() ? frame_number_ - history_.size() + 1 : 1;
+  size_t rows = 0;
+  for (uint64_t number = first; number <= frame_number_; ++number) {
+    const Frame &frame = history_[(number - 1) % history_size_];
+    if (frame.frame_ms < 0) {
+      continue;
+    }
+    out << frame.number << "," << frame.frame_ms << ",";
+    if (frame.gpu_ms >= 0) {
+      out << frame.gpu_ms;
+    }
+    for (size_t i = 0; i < cpu_scope_names_.size(); ++i) {
+      out << "," << (i < frame.cpu_scope_ms.size() ? frame.cpu_scope_ms[i] : 0);
+    }
+    for (size_t i = 0; i < gpu_scope_names_.size(); ++i) {
+      out << ",";
+      if (frame.gpu_ms >= 0) {
+        out << (i < frame.gpu_scope_ms.size() ? frame.gpu_scope_ms[i] : 0);
+      }
+    }
+    out << "\n";
+    ++rows;
+  }
+  LOG(INFO) << "Profiler: wrote " << rows << " frames to '"
+            << filename << "'\n";
+  return static_cast<bool>(out);
+}
+
+uint32_t Profiler::ScopeId(std::unordered_map<std::string, uint32_t> &ids,
+                           std::vector<std::string> &names, const char *name) {
+  auto it = ids.find(name);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  const uint32_t id = static_cast<uint32_t>(names.size());
+  names.push_back(name);
+  ids.emplace(name, id);
+  return id;
+}
+
+Profiler::Frame *Profiler::FindFrame(uint64_t number) {
+  if (number == 0 || number > frame_number_ ||
+      frame_number_ - number >= history_.size()) {
+    return nullptr;
+  }
+  Frame &frame = history_[(number - 1) % history_size_];
+  return frame.number == number ? &frame : nullptr;
+}
+
+void Profiler::EndCpuScope(uint32_t scope, Clock::time_point start) {
+  Frame *frame = FindFrame(frame_number_);
+  if (frame == nullptr) {
+    return;
+  }
+  if (frame->cpu_scope_ms.size() <= scope) {
+    frame->cpu_scope_ms.resize(scope + 1, 0);
+  }
+  frame->cpu_scope_ms[scope] += Milliseconds(Clock::now() - start);
+}
+
+void Profiler::Calibrate(const zrl::LogicalDevice &device) {
+  const uint32_t query = 2 * max_gpu_scopes_ * frames_in_flight_;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  pool_info.queueFamilyIndex = device.GetGCTQueueFamily();
+  CHECK_VK(vkCreateCommandPool(device_, &pool_info, nullptr, &command_pool));
+
+  VkCommandBuffer cmd = VK_NULL_HANDLE;
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.pNext = nullptr;
+  alloc_info.commandPool = command_pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  CHECK_VK(vkAllocateCommandBuffers(device_, &alloc_info, &cmd));
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  CHECK_VK(vkBeginCommandBuffer(cmd, &begin_info));
+  vkCmdResetQueryPool(cmd, query_pool_, query, 1);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_,
+                      query);
+  CHECK_VK(vkEndCommandBuffer(cmd));
+
+  VkFence fence = VK_NULL_HANDLE;
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = nullptr;
+  fence_info.flags = 0;
+  CHECK_VK(vkCreateFence(device_, &fence_info, nullptr, &fence));
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  // Without VK_EXT_calibrated_timestamps, the timestamp is assumed to be
+  // written halfway between the submission and the end of the wait. The error
+  // is bounded by the round trip, typically tens of microseconds.
+  const int64_t submit_ns = zrl::Trace::Now();
+  CHECK_VK(vkQueueSubmit(device.GetGCTQueue(), 1, &submit_info, fence));
+  CHECK_VK(vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX));
+  const int64_t signaled_ns = zrl::Trace::Now();
+
+  uint64_t timestamp = 0;
+  CHECK_VK(vkGetQueryPoolResults(device_, query_pool_, query, 1,
+                                 sizeof(timestamp), &timestamp,
+                                 sizeof(timestamp), VK_QUERY_RESULT_64_BIT));
+  const double timestamp_ns =
+      (timestamp & timestamp_mask_) * timestamp_period_ns_;
+  gpu_epoch_ns_ =
+      (submit_ns + signaled_ns) / 2 - static_cast<int64_t>(timestamp_ns);
+  vkDestroyFence(device_, fence, nullptr);
+  vkDestroyCommandPool(device_, command_pool, nullptr);
+}
+
+void Profiler::ReadGpuTimings(uint32_t slot) {
+  const auto &queries = slot_queries_[slot];
+  Frame *frame = FindFrame(slot_frame_[slot]);
+  if (queries.empty() || frame == nullptr) {
+    return;
+  }
+  const uint32_t count = static_cast<uint32_t>(2 * queries.size());
+  std::vector<uint64_t> timestamps(count);
+  VkResult result = vkGetQueryPoolResults(
+      device_, query_pool_, 2 * max_gpu_scopes_ * slot, count,
+      count * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT);
+  if (result == VK_NOT_READY) {
+    // Some scope was never ended or submitted; the frame has no GPU timings.
+    return;
+  }
+  CHECK_VK(result);
+
+  uint64_t first = std::numeric_limits<uint64_t>::max();
+  uint64_t last = 0;
+  frame->gpu_scope_ms.assign(gpu_scope_names_.size(), 0);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const uint64_t begin = timestamps[2 * i] & timestamp_mask_;
+    const uint64_t end = timestamps[2 * i + 1] & timestamp_mask_;
+    if (end < begin) {
+      continue;
+    }
+    first = std::min(first, begin);
+    last = std::max(last, end);
+    frame->gpu_scope_ms[queries[i].scope] +=
+        (end - begin) * timestamp_period_ns_ / 1e6;
+    zrl::Trace::CompleteGpu(
+        gpu_scope_trace_names_[queries[i].scope],
+        gpu_epoch_ns_ + static_cast<int64_t>(begin * timestamp_period_ns_),
+        static_cast<int64_t>((end - begin) * timestamp_period_ns_));
+  }
+  frame->gpu_ms = last >= first ? (last - first) * timestamp_period_ns_ / 1e6
+                                : 0;
+}
+
+std::vector<double> Profiler::Collect(double Frame::*field) const {
+  std::vector<double> values;
+  values.reserve(history_.size());
+  for (const auto &frame : history_) {
+    if (frame.frame_ms >= 0 && frame.*field >= 0) {
+      values.push_back(frame.*field);
+    }
+  }
+  return values;
+}
+
+std::ostream &operator<<(std::ostream &out,
+                         const Profiler::Percentiles &percentiles) {
+  return out << "p50=" << percentiles.p50 << " p95=" << percentiles.p95
+             << " p99=" << percentiles.p99 << " max=" << percentiles.max;
+}
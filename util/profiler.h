@@ -0,0 +1,157 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "core/Core.h"
+
+// Records per-frame CPU and GPU timings into a history of the last frames, so
+// that frame time distributions, and not just averages, can be reported.
+//
+// CPU scopes are timed with steady_clock. GPU scopes are timed with timestamp
+// queries written into the command buffers of each frame, and their results
+// are read back once the frame slot comes around again. While a zrl::Trace is
+// recording, GPU scopes are also added to its GPU track. Not thread-safe: all
+// calls are expected from the thread driving the frame loop.
+class Profiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Percentiles {
+    double p50;
+    double p95;
+    double p99;
+    double max;
+  };
+
+  class CpuScope {
+  public:
+    CpuScope(Profiler &profiler, uint32_t scope);
+    ~CpuScope();
+    CpuScope(CpuScope &&other);
+    CpuScope(const CpuScope &) = delete;
+
+  private:
+    Profiler *profiler_;
+    const uint32_t scope_;
+    const Clock::time_point start_;
+  };
+
+  // Creates a CPU-only profiler.
+  explicit Profiler(size_t history_size = 1024);
+  // Creates a profiler that also measures GPU scopes on the gct queue, with
+  // one set of queries per frame in flight.
+  Profiler(const zrl::Core &core, uint32_t frames_in_flight,
+           uint32_t max_gpu_scopes = 32, size_t history_size = 1024);
+  ~Profiler();
+
+  Profiler(const Profiler &) = delete;
+  Profiler(Profiler &&) = delete;
+
+  // Starts a new frame, ending the previous one. slot is the frame in flight
+  // about to be recorded, whose previous submission must have completed, as
+  // its GPU timings are read back here.
+  void BeginFrame(uint32_t slot = 0);
+
+  // Times the CPU work until the returned object goes out of scope.
+  CpuScope Cpu(const char *name);
+
+  // Resets the queries of the current frame. Must be recorded in the frame's
+  // first command buffer, outside of a render pass, before any GPU scope.
+  void CmdReset(VkCommandBuffer cmd);
+  // Writes the timestamps around a GPU scope, such as a render pass or a
+  // pipeline's draws. Scopes with the same name in a frame are added up.
+  uint32_t CmdBeginGpu(VkCommandBuffer cmd, const char *name);
+  void CmdEndGpu(VkCommandBuffer cmd, uint32_t query);
+
+  bool HasGpuTimings() const { return query_pool_ != VK_NULL_HANDLE; }
+  size_t GetFrameCount() const;
+
+  // Time between the start of consecutive frames, in milliseconds.
+  Percentiles GetFrameTimes() const;
+  // Time the GPU spent between the first and the last timestamp of each
+  // frame, in milliseconds.
+  Percentiles GetGpuFrameTimes() const;
+
+  // Writes a summary of the history: frame time percentiles, per scope
+  // timings, and, when GPU scopes were recorded, how busy the CPU and the
+  // GPU were over the frame time.
+  void Report(std::ostream &out) const;
+  // Writes the history as CSV, one row per frame and one column per scope.
+  bool Dump(const std::string &filename) const;
+
+private:
+  // Timings of one frame, in milliseconds. Negative GPU times are unknown.
+  struct Frame {
+    uint64_t number;
+    double frame_ms;
+    double gpu_ms;
+    std::vector<double> cpu_scope_ms;
+    std::vector<double> gpu_scope_ms;
+  };
+
+  struct GpuQuery {
+    uint32_t scope;
+  };
+
+  uint32_t ScopeId(std::unordered_map<std::string, uint32_t> &ids,
+                   std::vector<std::string> &names, const char *name);
+  Frame *FindFrame(uint64_t number);
+  void EndCpuScope(uint32_t scope, Clock::time_point start);
+  // Measures the steady clock time of GPU timestamp 0, on the gct queue.
+  void Calibrate(const zrl::LogicalDevice &device);
+  void ReadGpuTimings(uint32_t slot);
+  std::vector<double> Collect(double Frame::*field) const;
+
+  const size_t history_size_;
+  std::vector<Frame> history_;
+  uint64_t frame_number_;
+  Clock::time_point frame_start_;
+  bool started_;
+
+  std::unordered_map<std::string, uint32_t> cpu_scope_ids_;
+  std::vector<std::string> cpu_scope_names_;
+  std::unordered_map<std::string, uint32_t> gpu_scope_ids_;
+  std::vector<std::string> gpu_scope_names_;
+  std::vector<const char *> gpu_scope_trace_names_;
+
+  VkDevice device_;
+  VkQueryPool query_pool_;
+  uint32_t frames_in_flight_;
+  uint32_t max_gpu_scopes_;
+  double timestamp_period_ns_;
+  uint64_t timestamp_mask_;
+  int64_t gpu_epoch_ns_;
+  uint32_t slot_;
+  // Per slot: the frame it was last recorded for and its queries.
+  std::vector<uint64_t> slot_frame_;
+  std::vector<std::vector<GpuQuery>> slot_queries_;
+};
+
+std::ostream &operator<<(std::ostream &out,
+                         const Profiler::Percentiles &percentiles);
+
+#endif // PROFILER_H_
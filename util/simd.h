@@ -0,0 +1,27 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMD_H_
+#define SIMD_H_
+
+// SSE2 is part of x86-64. ZRL_SSE2 is defined when the SSE2 code is built,
+// which defining ZRL_NO_SIMD turns off to build the scalar code only.
+#if !defined(ZRL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define ZRL_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif // SIMD_H_
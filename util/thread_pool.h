@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs tasks on a fixed set of threads, in submission order.
+class ThreadPool {
+public:
+  // Uses one thread per hardware thread by default.
+  explicit ThreadPool(size_t thread_count = 0);
+  // Runs the tasks still queued before returning.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+
+  // Queues task and returns a future for its result. Exceptions thrown by
+  // task are rethrown by the future.
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F &&task) {
+    using Result = typename std::result_of<F()>::type;
+    // std::function needs a copyable target, and packaged_task is move-only.
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<F>(task));
+    std::future<Result> result = packaged->get_future();
+    Enqueue([packaged] { (*packaged)(); });
+    return result;
+  }
+
+  size_t GetThreadCount() const { return threads_.size(); }
+
+private:
+  void Enqueue(std::function<void()> task);
+  void Run();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+};
+
+#endif // THREAD_POOL_H_